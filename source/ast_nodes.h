@@ -5,16 +5,20 @@
 
 #include "defines.h"
 #include "lexer.h"
+#include "types.h"
+#include "base/ds.h"
 
 //~ Ast node definitions
 
 typedef struct IR_Ast IR_Ast;
+typedef IR_Ast* IR_AstRef;
 
 typedef struct IR_AstExprIntLiteral {
 	i32 value;
 } IR_AstIntLiteral;
 
 typedef struct IR_AstExprFloatLiteral {
+	L_Token token;
 	f32 value;
 } IR_AstFloatLiteral;
 
@@ -29,11 +33,80 @@ typedef struct IR_AstExprBinary {
 	IR_Ast* b;
 } IR_AstExprBinary;
 
+// symbol fields are filled in by the checker
+typedef struct IR_AstExprIdent {
+	L_Token name;
+	u32 symbol;
+} IR_AstExprIdent;
+
+// Only ever the value of a declaration, the declared name is how it gets called
+typedef struct IR_AstExprFunc {
+	L_Token token;
+	L_Token* param_names;
+	L_Token* param_types;
+	u32 param_count;
+	L_Token return_type; // TokenType_Error if the function returns nothing
+	IR_Ast* body; // Null for #native functions, those are looked up by the declared name
+	u32* param_symbols;
+} IR_AstExprFunc;
+
+// Calls are always direct, the callee is the name of a function declaration
+typedef struct IR_AstExprCall {
+	L_Token name;
+	IR_Ast** args;
+	u32 arg_count;
+	u32 symbol;
+} IR_AstExprCall;
+
+typedef struct IR_AstStmtVarDecl {
+	L_Token name;
+	L_Token type; // TokenType_Error if the type is inferred
+	IR_Ast* value; // Can be null
+	u32 symbol;
+} IR_AstStmtVarDecl;
+
+typedef struct IR_AstStmtAssign {
+	L_Token name;
+	IR_Ast* value;
+	u32 symbol;
+} IR_AstStmtAssign;
+
+typedef struct IR_AstStmtBlock {
+	IR_Ast** statements;
+	u32 count;
+	b8 scoped; // False for the top level
+} IR_AstStmtBlock;
 
 typedef struct IR_AstStmtPrint {
+	L_Token token;
 	IR_Ast* value;
 } IR_AstStmtPrint;
 
+typedef struct IR_AstStmtReturn {
+	L_Token token;
+	IR_Ast* value; // Can be null
+} IR_AstStmtReturn;
+
+typedef struct IR_AstStmtExpr {
+	IR_Ast* expr;
+} IR_AstStmtExpr;
+
+// Conditions are ints, anything but 0 is true
+typedef struct IR_AstStmtIf {
+	L_Token token;
+	IR_Ast* condition;
+	IR_Ast* then_body;
+	IR_Ast* else_body; // Can be null
+} IR_AstStmtIf;
+
+typedef struct IR_AstStmtWhile {
+	L_Token token;
+	IR_Ast* condition;
+	IR_Ast* body;
+} IR_AstStmtWhile;
+
+DArray_Prototype(IR_AstRef);
+
 //~ Ast struct definition
 
 typedef u32 IR_AstType;
@@ -42,22 +115,53 @@ enum {
 	AstType_FloatLiteral,
 	AstType_ExprUnary,
 	AstType_ExprBinary,
+	AstType_ExprIdent,
+	AstType_ExprFunc,
+	AstType_ExprCall,
 	
 	AstType_StmtPrint,
+	AstType_StmtVarDecl,
+	AstType_StmtAssign,
+	AstType_StmtBlock,
+	AstType_StmtReturn,
+	AstType_StmtExpr,
+	AstType_StmtIf,
+	AstType_StmtWhile,
 	
 	AstType_COUNT,
 };
 
+typedef u32 IR_AstFlags;
+enum {
+	// Set by the checker on subtrees that can be evaluated at compile time
+	AstFlag_Constant = 1 << 0,
+};
+
 struct IR_Ast {
 	IR_AstType type;
+	IR_AstFlags flags;
+	// Set by the checker, TypeID_Invalid for statements and poisoned nodes
+	TypeID expr_type;
+	// Where a constant subtree is in VM_ConstexprCache, its structural hash unless that collided
+	u64 constexpr_key;
 	
 	union {
 		IR_AstIntLiteral int_lit;
 		IR_AstFloatLiteral float_lit;
 		IR_AstExprUnary unary;
 		IR_AstExprBinary binary;
+		IR_AstExprIdent ident;
+		IR_AstExprFunc func;
+		IR_AstExprCall call;
 		
 		IR_AstStmtPrint print;
+		IR_AstStmtVarDecl var_decl;
+		IR_AstStmtAssign assign;
+		IR_AstStmtBlock block;
+		IR_AstStmtReturn return_stmt;
+		IR_AstStmtExpr expr_stmt;
+		IR_AstStmtIf if_stmt;
+		IR_AstStmtWhile while_stmt;
 	};
 };
 
@@ -33,7 +33,10 @@ static void OS_MemoryCommit(void* memory, u64 size) {
 #ifdef PLATFORM_WIN
     VirtualAlloc(memory, size, MEM_COMMIT, PAGE_READWRITE);
 #elif defined(PLATFORM_LINUX)
-    mprotect(memory, size, PROT_READ | PROT_WRITE);
+	// mprotect wants a page aligned address, VirtualAlloc rounds it down for us
+	uintptr_t page_mask = (uintptr_t) sysconf(_SC_PAGESIZE) - 1;
+	uintptr_t base = (uintptr_t)memory & ~page_mask;
+    mprotect((void*)base, size + ((uintptr_t)memory - base), PROT_READ | PROT_WRITE);
 #endif
 }
 
@@ -45,6 +48,18 @@ static void OS_MemoryDecommit(void* memory, u64 size) {
 #endif
 }
 
+void* M_Reserve(u64 size) {
+	return OS_MemoryReserve(size);
+}
+
+void M_Release(void* memory, u64 size) {
+	OS_MemoryRelease(memory, size);
+}
+
+void M_Commit(void* memory, u64 size) {
+	OS_MemoryCommit(memory, size);
+}
+
 #define DEFAULT_ALIGNMENT sizeof(void*)
 
 b8 is_power_of_two(uintptr_t x) {
@@ -96,8 +111,9 @@ void* arena_alloc(M_Arena* arena, u64 size) {
         }
     }
     
-    memory = arena + sizeof(M_Arena) + arena->alloc_position;
+    memory = ((u8*)arena) + sizeof(M_Arena) + arena->alloc_position;
     arena->alloc_position += size;
+    arena->alloc_count++;
     return memory;
 }
 
@@ -135,6 +151,7 @@ M_Arena* arena_make() {
     arena->max = M_ARENA_MAX;
     arena->alloc_position = 0;
     arena->commit_position = 0;
+    arena->alloc_count = 0;
     arena->static_size = false;
 	return arena;
 }
@@ -145,6 +162,7 @@ M_Arena* arena_make_sized(u64 max) {
 	arena->max = max;
     arena->alloc_position = 0;
     arena->commit_position = 0;
+    arena->alloc_count = 0;
     arena->static_size = false;
 	return arena;
 }
@@ -259,6 +277,7 @@ void* pool_alloc(M_Pool* pool) {
 		}
 		void* commit_ptr = ((u8*)pool) + sizeof(M_Pool) + pool->commit_position;
 		OS_MemoryCommit(commit_ptr, M_POOL_COMMIT_CHUNK * pool->element_size);
+		pool->commit_position += M_POOL_COMMIT_CHUNK * pool->element_size;
 		pool_dealloc_range(pool, commit_ptr, M_POOL_COMMIT_CHUNK);
 		
 		return pool_alloc(pool);
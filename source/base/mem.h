@@ -6,12 +6,20 @@
 #include <stdlib.h>
 #include "defines.h"
 
+//~ Virtual Memory
+
+// Reserved address space has nothing behind it, commit a range before touching it
+void* M_Reserve(u64 size);
+void  M_Release(void* memory, u64 size);
+void  M_Commit(void* memory, u64 size);
+
 //~ Arena (Linear Allocator)
 
 typedef struct M_Arena {
     u64 max;
     u64 alloc_position;
     u64 commit_position;
+    u64 alloc_count;
     b8 static_size;
 	// u8* memory starts from this point
 } M_Arena;
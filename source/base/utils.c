@@ -1,7 +1,22 @@
 #include "utils.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+
+#ifdef PLATFORM_WIN
+#include <windows.h>
+#elif defined(PLATFORM_LINUX)
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 //~ Time
 
@@ -42,7 +57,179 @@ U_DateTime U_DateTimeFromDenseTime(U_DenseTime densetime) {
     return result;
 }
 
-//~ Time
+u64 U_GetTimeNs(void) {
+#ifdef PLATFORM_WIN
+    static LARGE_INTEGER frequency = {0};
+    if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (u64)((counter.QuadPart * 1000000000ull) / frequency.QuadPart);
+#elif defined(PLATFORM_LINUX)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+#endif
+}
+
+//~ Threads
+
+typedef struct U_ThreadEntry {
+    U_ThreadProc* proc;
+    void* arg;
+} U_ThreadEntry;
+
+#ifdef PLATFORM_WIN
+static DWORD WINAPI U_ThreadTrampoline(LPVOID param) {
+#elif defined(PLATFORM_LINUX)
+static void* U_ThreadTrampoline(void* param) {
+#endif
+    U_ThreadEntry entry = *(U_ThreadEntry*) param;
+    free(param);
+    entry.proc(entry.arg);
+    return 0;
+}
+
+b8 U_ThreadStart(U_Thread* thread, U_ThreadProc* proc, void* arg) {
+    U_ThreadEntry* entry = malloc(sizeof(U_ThreadEntry));
+    entry->proc = proc;
+    entry->arg = arg;
+#ifdef PLATFORM_WIN
+    HANDLE handle = CreateThread(0, 0, U_ThreadTrampoline, entry, 0, 0);
+    if (!handle) {
+        free(entry);
+        return false;
+    }
+    thread->handle = (u64)(uintptr_t) handle;
+#elif defined(PLATFORM_LINUX)
+    pthread_t handle;
+    if (pthread_create(&handle, 0, U_ThreadTrampoline, entry) != 0) {
+        free(entry);
+        return false;
+    }
+    thread->handle = (u64) handle;
+#endif
+    return true;
+}
+
+void U_ThreadJoin(U_Thread* thread) {
+#ifdef PLATFORM_WIN
+    WaitForSingleObject((HANDLE)(uintptr_t) thread->handle, INFINITE);
+    CloseHandle((HANDLE)(uintptr_t) thread->handle);
+#elif defined(PLATFORM_LINUX)
+    pthread_join((pthread_t) thread->handle, 0);
+#endif
+}
+
+b8 U_ThreadStartDetached(U_ThreadProc* proc, void* arg) {
+    U_Thread thread;
+    if (!U_ThreadStart(&thread, proc, arg)) return false;
+#ifdef PLATFORM_WIN
+    CloseHandle((HANDLE)(uintptr_t) thread.handle);
+#elif defined(PLATFORM_LINUX)
+    pthread_detach((pthread_t) thread.handle);
+#endif
+    return true;
+}
+
+void U_ThreadYield(void) {
+#ifdef PLATFORM_WIN
+    SwitchToThread();
+#elif defined(PLATFORM_LINUX)
+    sched_yield();
+#endif
+}
+
+u32 U_GetCoreCount(void) {
+#ifdef PLATFORM_WIN
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+#elif defined(PLATFORM_LINUX)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (u32) count : 1;
+#endif
+}
+
+//~ Files
+
+b8 U_MapFile(const char* path, U_MappedFile* file) {
+    *file = (U_MappedFile) {0};
+#ifdef PLATFORM_WIN
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+    
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+        CloseHandle(handle);
+        return false;
+    }
+    
+    HANDLE mapping = CreateFileMappingA(handle, 0, PAGE_READONLY, 0, 0, 0);
+    void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : 0;
+    if (!data) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(handle);
+        return false;
+    }
+    
+    file->data = data;
+    file->size = (u64) size.QuadPart;
+    file->file_handle = handle;
+    file->mapping_handle = mapping;
+#elif defined(PLATFORM_LINUX)
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return false;
+    
+    struct stat info;
+    if (fstat(fd, &info) == -1 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    
+    // The mapping keeps its own reference, the descriptor is not needed past this
+    void* data = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    
+    file->data = data;
+    file->size = (u64) info.st_size;
+#endif
+    return true;
+}
+
+void U_UnmapFile(U_MappedFile* file) {
+    if (!file->data) return;
+#ifdef PLATFORM_WIN
+    UnmapViewOfFile(file->data);
+    CloseHandle(file->mapping_handle);
+    CloseHandle(file->file_handle);
+#elif defined(PLATFORM_LINUX)
+    munmap(file->data, file->size);
+#endif
+    *file = (U_MappedFile) {0};
+}
+
+//~ Dynamic libraries
+
+b8 U_LoadLibrary(const char* path, U_Library* library) {
+#ifdef PLATFORM_WIN
+    library->handle = path ? (void*) LoadLibraryA(path) : (void*) GetModuleHandleA(nullptr);
+#elif defined(PLATFORM_LINUX)
+    // RTLD_GLOBAL so libraries loaded later can use its symbols too
+    library->handle = dlopen(path, RTLD_NOW | RTLD_GLOBAL);
+#endif
+    return library->handle != nullptr;
+}
+
+void* U_GetSymbol(U_Library* library, const char* name) {
+#ifdef PLATFORM_WIN
+    return (void*) GetProcAddress((HMODULE) library->handle, name);
+#elif defined(PLATFORM_LINUX)
+    return dlsym(library->handle, name);
+#endif
+}
+
+//~ Filepaths
 
 string U_FixFilepath(M_Arena* arena, string filepath) {
     M_Scratch scratch = scratch_get(&arena, 1);
@@ -24,6 +24,75 @@ typedef struct U_DateTime {
 U_DenseTime U_DenseTimeFromDateTime(U_DateTime* datetime);
 U_DateTime  U_DateTimeFromDenseTime(U_DenseTime densetime);
 
+// Monotonic, only meaningful as a difference
+u64 U_GetTimeNs(void);
+
+//~ Atomics
+
+// Acquire loads, release stores and full-barrier read-modify-writes.
+// That's all the tiering and worker code needs
+#if defined(COMPILER_CL)
+#  include <intrin.h>
+#  define U_AtomicLoadU32(p)      _InterlockedOr((volatile long*)(p), 0)
+#  define U_AtomicStoreU32(p, v)  _InterlockedExchange((volatile long*)(p), (long)(v))
+#  define U_AtomicAddU32(p, v)    ((u32)_InterlockedExchangeAdd((volatile long*)(p), (long)(v)) + (u32)(v))
+#  define U_AtomicCasU32(p, expected, desired) \
+(_InterlockedCompareExchange((volatile long*)(p), (long)(desired), (long)(expected)) == (long)(expected))
+#  define U_AtomicLoadPtr(p)      _InterlockedCompareExchangePointer((void* volatile*)(p), 0, 0)
+#  define U_AtomicStorePtr(p, v)  _InterlockedExchangePointer((void* volatile*)(p), (void*)(v))
+#else
+#  define U_AtomicLoadU32(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#  define U_AtomicStoreU32(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#  define U_AtomicAddU32(p, v)    __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#  define U_AtomicCasU32(p, expected, desired) \
+__extension__({ u32 _e = (expected); __atomic_compare_exchange_n((p), &_e, (desired), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); })
+#  define U_AtomicLoadPtr(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#  define U_AtomicStorePtr(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+//~ Threads
+
+typedef void U_ThreadProc(void* arg);
+
+// pthread_t or HANDLE
+typedef struct U_Thread {
+    u64 handle;
+} U_Thread;
+
+// Fire and forget, callers track completion themselves
+b8   U_ThreadStartDetached(U_ThreadProc* proc, void* arg);
+b8   U_ThreadStart(U_Thread* thread, U_ThreadProc* proc, void* arg);
+void U_ThreadJoin(U_Thread* thread);
+void U_ThreadYield(void);
+// Logical processors, at least 1
+u32  U_GetCoreCount(void);
+
+//~ Files
+
+// Read-only view of a whole file, pages are loaded lazily by the OS
+typedef struct U_MappedFile {
+    void* data;
+    u64 size;
+#ifdef PLATFORM_WIN
+    void* file_handle;
+    void* mapping_handle;
+#endif
+} U_MappedFile;
+
+b8   U_MapFile(const char* path, U_MappedFile* file);
+void U_UnmapFile(U_MappedFile* file);
+
+//~ Dynamic libraries
+
+// Libraries stay loaded for the rest of the process, there is no unload
+typedef struct U_Library {
+    void* handle;
+} U_Library;
+
+// A null path is the running executable, which on Linux also finds everything it links against
+b8    U_LoadLibrary(const char* path, U_Library* library);
+void* U_GetSymbol(U_Library* library, const char* name);
+
 //~ Filepaths
 
 string U_FixFilepath(M_Arena* arena, string filepath);
@@ -1,20 +1,50 @@
 #include "checker.h"
 
+#include <stdarg.h>
+
+#include "base/utils.h"
+
 //~ Type Cache
 
-DArray_Impl(Type);
+void TypeCache_Init(TypeCache* cache, M_Arena* arena) {
+	cache->arena = arena;
+	cache->cap = DoubleCapacity(TypeID_COUNT);
+	cache->elems = arena_alloc_array(arena, Type, cache->cap);
+	// The basic types are put in their slots by TypeCache_RegisterWithID
+	cache->len = TypeID_COUNT;
+}
 
-void TypeCache_Init(TypeCache* cache) {
-	darray_reserve(Type, cache, TypeID_COUNT);
+// Field by field, padding and unused parameter slots hold garbage
+static b8 TypeCache_Equal(Type* a, Type* b) {
+	if (a->kind != b->kind) return false;
+	switch (a->kind) {
+		case TypeKind_Regular: return a->regular == b->regular;
+		case TypeKind_Function: {
+			if (a->function.return_type != b->function.return_type) return false;
+			if (a->function.param_count != b->function.param_count) return false;
+			for (u32 i = 0; i < a->function.param_count; i++) {
+				if (a->function.params[i] != b->function.params[i]) return false;
+			}
+		} return true;
+	}
+	return true;
 }
 
 TypeID TypeCache_Register(TypeCache* cache, Type type) {
 	IteratePtr(cache, i) {
-		if (memcmp(&cache->elems[i], &type, sizeof(Type)) == 0) {
+		if (TypeCache_Equal(&cache->elems[i], &type)) {
+			cache->hits++;
 			return i;
 		}
 	}
-	darray_add(Type, cache, type);
+	cache->misses++;
+	if (cache->len + 1 > cache->cap) {
+		Type* prev = cache->elems;
+		cache->cap = DoubleCapacity(cache->cap);
+		cache->elems = arena_alloc_array(cache->arena, Type, cache->cap);
+		MemoryCopy(cache->elems, prev, cache->len * sizeof(Type));
+	}
+	cache->elems[cache->len++] = type;
 	return cache->len - 1;
 }
 
@@ -28,8 +58,208 @@ Type* TypeCache_Get(TypeCache* cache, TypeID id) {
 	return &cache->elems[id];
 }
 
-void TypeCache_Free(TypeCache* cache) {
-	darray_free(Type, cache);
+static string TypeCache_GetName(TypeCache* cache, TypeID id) {
+	Type* type = TypeCache_Get(cache, id);
+	switch (type->kind) {
+		case TypeKind_Regular: {
+			switch (type->regular) {
+				case RegularTypeKind_Integer: return str_lit("int");
+				case RegularTypeKind_Void: return str_lit("void");
+			}
+		} break;
+		
+		case TypeKind_Function: {
+			string name = str_lit("func(");
+			for (u32 i = 0; i < type->function.param_count; i++) {
+				if (i) name = str_cat(cache->arena, name, str_lit(", "));
+				name = str_cat(cache->arena, name, TypeCache_GetName(cache, type->function.params[i]));
+			}
+			name = str_cat(cache->arena, name, str_lit(") -> "));
+			return str_cat(cache->arena, name, TypeCache_GetName(cache, type->function.return_type));
+		}
+	}
+	return str_lit("<invalid>");
+}
+
+//~ Arena Helpers
+
+static void* C_ArenaGrow(M_Arena* arena, void* prev, u64 elem_size, u32 len, u32 new_cap) {
+	void* ret = arena_alloc_zero(arena, elem_size * new_cap);
+	if (prev) MemoryCopy(ret, prev, elem_size * len);
+	return ret;
+}
+
+//~ Identifier Interning
+
+#define C_INTERNER_INITIAL_CAP 256
+
+void C_InternerInit(C_Interner* interner, M_Arena* arena) {
+	interner->arena = arena;
+	interner->cap = C_INTERNER_INITIAL_CAP;
+	interner->len = 0;
+	interner->slots = arena_alloc_zero(arena, sizeof(C_InternSlot) * interner->cap);
+	interner->names_cap = C_INTERNER_INITIAL_CAP;
+	interner->names = arena_alloc_zero(arena, sizeof(string) * interner->names_cap);
+}
+
+static void C_InternerRehash(C_Interner* interner) {
+	u32 new_cap = interner->cap * 2;
+	C_InternSlot* slots = arena_alloc_zero(interner->arena, sizeof(C_InternSlot) * new_cap);
+	for (u32 i = 0; i < interner->cap; i++) {
+		C_InternSlot slot = interner->slots[i];
+		if (!slot.id) continue;
+		u32 k = slot.hash & (new_cap - 1);
+		while (slots[k].id) k = (k + 1) & (new_cap - 1);
+		slots[k] = slot;
+	}
+	interner->cap = new_cap;
+	interner->slots = slots;
+}
+
+C_IdentID C_Intern(C_Interner* interner, string name) {
+	u32 hash = str_hash(name);
+	u32 mask = interner->cap - 1;
+	u32 k = hash & mask;
+	while (interner->slots[k].id) {
+		C_InternSlot slot = interner->slots[k];
+		if (slot.hash == hash && str_eq(interner->names[slot.id], name)) return slot.id;
+		k = (k + 1) & mask;
+	}
+	
+	C_IdentID id = ++interner->len;
+	if (id >= interner->names_cap) {
+		u32 new_cap = interner->names_cap * 2;
+		interner->names = C_ArenaGrow(interner->arena, interner->names, sizeof(string), id, new_cap);
+		interner->names_cap = new_cap;
+	}
+	interner->names[id] = str_copy(interner->arena, name);
+	interner->slots[k] = (C_InternSlot) { .hash = hash, .id = id };
+	
+	// Keep the load factor under 1/2 so probe sequences stay short
+	if (interner->len * 2 > interner->cap) C_InternerRehash(interner);
+	return id;
+}
+
+string C_GetIdentName(C_Interner* interner, C_IdentID id) {
+	return interner->names[id];
+}
+
+//~ Symbol Table
+
+#define C_SYMBOLS_INITIAL_CAP 64
+
+void C_SymbolTableInit(C_SymbolTable* table, M_Arena* arena) {
+	table->arena = arena;
+	
+	table->symbol_cap = C_SYMBOLS_INITIAL_CAP;
+	table->symbols = arena_alloc_zero(arena, sizeof(C_Symbol) * table->symbol_cap);
+	table->symbol_count = 1; // Slot 0 is the null symbol
+	
+	table->binding_cap = C_SYMBOLS_INITIAL_CAP;
+	table->bindings = arena_alloc_zero(arena, sizeof(C_SymbolID) * table->binding_cap);
+	
+	table->scope_cap = C_SYMBOLS_INITIAL_CAP;
+	table->scope_generations = arena_alloc_zero(arena, sizeof(u32) * table->scope_cap);
+	// Depth 0 is the global scope
+	table->depth = 0;
+	table->scope_generations[0] = 1;
+	table->next_generation = 2;
+}
+
+void C_PushScope(C_SymbolTable* table) {
+	table->depth++;
+	if (table->depth >= table->scope_cap) {
+		u32 new_cap = table->scope_cap * 2;
+		table->scope_generations = C_ArenaGrow(table->arena, table->scope_generations, sizeof(u32), table->scope_cap, new_cap);
+		table->scope_cap = new_cap;
+	}
+	table->scope_generations[table->depth] = table->next_generation++;
+}
+
+void C_PopScope(C_SymbolTable* table) {
+	table->depth--;
+}
+
+static inline b8 C_SymbolIsLive(C_SymbolTable* table, C_Symbol* symbol) {
+	return symbol->depth <= table->depth && table->scope_generations[symbol->depth] == symbol->generation;
+}
+
+C_SymbolID C_ResolveSymbol(C_SymbolTable* table, C_IdentID ident) {
+	if (ident >= table->binding_cap) return 0;
+	
+	C_SymbolID id = table->bindings[ident];
+	while (id && !C_SymbolIsLive(table, &table->symbols[id])) {
+		id = table->symbols[id].shadowed;
+	}
+	table->bindings[ident] = id;
+	return id;
+}
+
+C_SymbolID C_DeclareSymbol(C_SymbolTable* table, C_IdentID ident, TypeID type, L_Token decl) {
+	if (ident >= table->binding_cap) {
+		u32 new_cap = table->binding_cap;
+		while (ident >= new_cap) new_cap *= 2;
+		table->bindings = C_ArenaGrow(table->arena, table->bindings, sizeof(C_SymbolID), table->binding_cap, new_cap);
+		table->binding_cap = new_cap;
+	}
+	
+	C_SymbolID shadowed = C_ResolveSymbol(table, ident);
+	if (shadowed && table->symbols[shadowed].depth == table->depth) {
+		// Redeclaration in the same scope
+		return 0;
+	}
+	
+	if (table->symbol_count >= table->symbol_cap) {
+		u32 new_cap = table->symbol_cap * 2;
+		table->symbols = C_ArenaGrow(table->arena, table->symbols, sizeof(C_Symbol), table->symbol_count, new_cap);
+		table->symbol_cap = new_cap;
+	}
+	
+	C_SymbolID id = table->symbol_count++;
+	table->symbols[id] = (C_Symbol) {
+		.ident = ident,
+		.type = type,
+		.decl = decl,
+		.shadowed = shadowed,
+		.depth = table->depth,
+		.generation = table->scope_generations[table->depth],
+	};
+	table->bindings[ident] = id;
+	return id;
+}
+
+C_Symbol* C_GetSymbol(C_SymbolTable* table, C_SymbolID id) {
+	return &table->symbols[id];
+}
+
+//~ Diagnostics
+
+static void C_Report(C_Checker* checker, L_Token at, const char* error, ...) {
+	C_Diagnostic* diagnostic = arena_alloc_zero(checker->arena, sizeof(C_Diagnostic));
+	diagnostic->line = at.line;
+	diagnostic->column = at.column;
+	
+	va_list va;
+	va_start(va, error);
+	char buffer[1024];
+	vsnprintf(buffer, sizeof(buffer), error, va);
+	va_end(va);
+	diagnostic->message = str_copy(checker->arena, (string) { .str = (u8*) buffer, .size = strlen(buffer) });
+	
+	if (checker->diagnostics.last) checker->diagnostics.last->next = diagnostic;
+	else checker->diagnostics.first = diagnostic;
+	checker->diagnostics.last = diagnostic;
+	checker->diagnostics.count++;
+	
+	checker->errored = true;
+}
+
+static void C_PrintDiagnostics(C_Checker* checker) {
+	for (C_Diagnostic* it = checker->diagnostics.first; it; it = it->next) {
+		printf("Checker error (%u:%u): %.*s\n", it->line, it->column, str_expand(it->message));
+	}
+	if (checker->diagnostics.count)
+		printf("%u checker error(s)\n", checker->diagnostics.count);
 }
 
 //~ Type Check
@@ -59,67 +289,471 @@ static TypeID C_GetTypeAssociatedTriple(TypeTriple* bindings, TypeID a, TypeID b
 
 //~ Checker
 
-static TypeID C_CheckUnaryOp(TypeID operand, L_TokenType op) {
-	TypeID ret = 0;
-	if (op == TokenType_Plus || op == TokenType_Minus) {
+static TypeID C_CheckUnaryOp(C_Checker* checker, TypeID operand, L_Token op) {
+	// Poisoned operand, the error is already reported
+	if (operand == TypeID_Invalid) return TypeID_Invalid;
+	
+	TypeID ret = TypeID_Invalid;
+	if (op.type == TokenType_Plus || op.type == TokenType_Minus) {
 		ret = C_GetTypeAssociatedPair(unary_operator_table_plusminus, operand);
-	} else {
-		// TODO(voxel): Error
-		ret = TypeID_Invalid;
+		checker->stats.operator_lookups++;
+	}
+	
+	if (ret == TypeID_Invalid) {
+		C_Report(checker, op, "Unary operator %.*s is not defined for type %.*s",
+				 str_expand(L_GetTypeName(op.type)),
+				 str_expand(TypeCache_GetName(&checker->type_cache, operand)));
 	}
 	return ret;
 }
 
-static TypeID C_CheckBinaryOp(TypeID a, TypeID b, L_TokenType op) {
-	TypeID ret = 0;
-	if (op == TokenType_Plus || op == TokenType_Minus) {
+static TypeID C_CheckBinaryOp(C_Checker* checker, TypeID a, TypeID b, L_Token op) {
+	// Poisoned operands, the error is already reported
+	if (a == TypeID_Invalid || b == TypeID_Invalid) return TypeID_Invalid;
+	
+	TypeID ret = TypeID_Invalid;
+	if (op.type == TokenType_Plus || op.type == TokenType_Minus) {
 		ret = C_GetTypeAssociatedTriple(binary_operator_table_plusminus, a, b);
-	} else if (op == TokenType_Star || op == TokenType_Slash) {
+		checker->stats.operator_lookups++;
+	} else if (op.type == TokenType_Star || op.type == TokenType_Slash || op.type == TokenType_Percent) {
 		ret = C_GetTypeAssociatedTriple(binary_operator_table_stardivmod, a, b);
-	} else {
-		// TODO(voxel): Error
-		ret = TypeID_Invalid;
+		checker->stats.operator_lookups++;
+	} else if (op.type == TokenType_Less || op.type == TokenType_Greater || op.type == TokenType_LessEqual ||
+			   op.type == TokenType_GreaterEqual || op.type == TokenType_EqualEqual || op.type == TokenType_BangEqual) {
+		ret = C_GetTypeAssociatedTriple(binary_operator_table_comparison, a, b);
+		checker->stats.operator_lookups++;
+	}
+	
+	if (ret == TypeID_Invalid) {
+		C_Report(checker, op, "Binary operator %.*s is not defined for types %.*s and %.*s",
+				 str_expand(L_GetTypeName(op.type)),
+				 str_expand(TypeCache_GetName(&checker->type_cache, a)),
+				 str_expand(TypeCache_GetName(&checker->type_cache, b)));
 	}
 	return ret;
 }
 
-static TypeID C_CheckAst(IR_Ast* ast) {
+static TypeID C_CheckAst(C_Checker* checker, IR_Ast* ast);
+
+static b8 C_IsFunction(C_Checker* checker, TypeID type) {
+	return TypeCache_Get(&checker->type_cache, type)->kind == TypeKind_Function;
+}
+
+// Functions see their own parameters and locals and other functions, nothing else
+static b8 C_CheckCapture(C_Checker* checker, L_Token name, C_SymbolID symbol) {
+	C_Symbol* resolved = C_GetSymbol(&checker->symbols, symbol);
+	if (checker->function_type == TypeID_Invalid || resolved->depth >= checker->function_depth) return true;
+	if (C_IsFunction(checker, resolved->type)) return true;
+	C_Report(checker, name, "Functions can't use %.*s, it is a local of the enclosing scope", str_expand(name.lexeme));
+	return false;
+}
+
+static TypeID C_RegisterTypeName(C_Checker* checker, L_Token name) {
+	if (name.type == TokenType_Int) return TypeID_Integer;
+	// An empty token is a type the parser already reported
+	if (name.type != TokenType_Error) C_Report(checker, name, "Unknown type %.*s", str_expand(name.lexeme));
+	return TypeID_Invalid;
+}
+
+// Conservative, a loop never counts even when its condition is constant
+b8 C_EndsWithReturn(IR_Ast* ast) {
+	if (!ast) return false;
+	if (ast->type == AstType_StmtReturn) return true;
+	if (ast->type == AstType_StmtBlock && ast->block.count)
+		return C_EndsWithReturn(ast->block.statements[ast->block.count - 1]);
+	if (ast->type == AstType_StmtIf)
+		return C_EndsWithReturn(ast->if_stmt.then_body) && C_EndsWithReturn(ast->if_stmt.else_body);
+	return false;
+}
+
+static void C_CheckCondition(C_Checker* checker, L_Token token, IR_Ast* condition) {
+	TypeID type = C_CheckAst(checker, condition);
+	if (type != TypeID_Invalid && type != TypeID_Integer) {
+		C_Report(checker, token, "Condition of %.*s has to be an int, got %.*s", str_expand(token.lexeme),
+				 str_expand(TypeCache_GetName(&checker->type_cache, type)));
+	}
+}
+
+static TypeID C_CheckFuncSignature(C_Checker* checker, IR_Ast* ast) {
+	Type type;
+	MemoryZeroStruct(&type, Type);
+	type.kind = TypeKind_Function;
+	type.function.param_count = ast->func.param_count;
+	type.function.return_type = ast->func.return_type.type == TokenType_Error
+		? TypeID_Void : C_RegisterTypeName(checker, ast->func.return_type);
+	for (u32 i = 0; i < ast->func.param_count; i++) {
+		type.function.params[i] = C_RegisterTypeName(checker, ast->func.param_types[i]);
+	}
+	return TypeCache_Register(&checker->type_cache, type);
+}
+
+static void C_CheckFuncBody(C_Checker* checker, IR_Ast* ast, TypeID type, L_Token name) {
+	TypeID outer_type = checker->function_type;
+	u32 outer_depth = checker->function_depth;
+	C_PushScope(&checker->symbols);
+	checker->function_type = type;
+	checker->function_depth = checker->symbols.depth;
+	
+	ast->func.param_symbols = arena_alloc_zero(checker->arena, sizeof(u32) * ast->func.param_count);
+	FunctionType* signature = &TypeCache_Get(&checker->type_cache, type)->function;
+	for (u32 i = 0; i < ast->func.param_count; i++) {
+		L_Token param = ast->func.param_names[i];
+		C_IdentID ident = C_Intern(&checker->interner, param.lexeme);
+		C_SymbolID symbol = C_DeclareSymbol(&checker->symbols, ident, signature->params[i], param);
+		if (!symbol) {
+			C_Report(checker, param, "Duplicate parameter %.*s", str_expand(param.lexeme));
+			symbol = C_ResolveSymbol(&checker->symbols, ident);
+		}
+		ast->func.param_symbols[i] = symbol;
+	}
+	
+	C_CheckAst(checker, ast->func.body);
+	// Signature lookups can grow the type cache, don't hold on to signature past the body
+	if (TypeCache_Get(&checker->type_cache, type)->function.return_type != TypeID_Void && !C_EndsWithReturn(ast->func.body))
+		C_Report(checker, name, "%.*s has to end with a return", str_expand(name.lexeme));
+	
+	C_PopScope(&checker->symbols);
+	checker->function_type = outer_type;
+	checker->function_depth = outer_depth;
+}
+
+static TypeID C_CheckNode(C_Checker* checker, IR_Ast* ast) {
 	switch (ast->type) {
 		case AstType_IntLiteral: {
+			ast->flags |= AstFlag_Constant;
 			return TypeID_Integer;
 		} break;
 		
 		case AstType_FloatLiteral: {
-			// TODO(voxel): 
+			C_Report(checker, ast->float_lit.token, "Float literals are not supported yet");
 			return TypeID_Invalid;
 		} break;
 		
 		case AstType_ExprUnary: {
-			TypeID operand_type = C_CheckAst(ast->unary.operand);
-			return C_CheckUnaryOp(operand_type, ast->unary.operator.type);
+			TypeID operand_type = C_CheckAst(checker, ast->unary.operand);
+			TypeID ret = C_CheckUnaryOp(checker, operand_type, ast->unary.operator);
+			if (ret != TypeID_Invalid && (ast->unary.operand->flags & AstFlag_Constant))
+				ast->flags |= AstFlag_Constant;
+			return ret;
 		} break;
 		
 		case AstType_ExprBinary: {
-			TypeID a_type = C_CheckAst(ast->binary.a);
-			TypeID b_type = C_CheckAst(ast->binary.b);
-			return C_CheckBinaryOp(a_type, b_type, ast->binary.operator.type);
+			TypeID a_type = C_CheckAst(checker, ast->binary.a);
+			TypeID b_type = C_CheckAst(checker, ast->binary.b);
+			TypeID ret = C_CheckBinaryOp(checker, a_type, b_type, ast->binary.operator);
+			if (ret != TypeID_Invalid &&
+				(ast->binary.a->flags & AstFlag_Constant) && (ast->binary.b->flags & AstFlag_Constant))
+				ast->flags |= AstFlag_Constant;
+			return ret;
+		} break;
+		
+		case AstType_ExprIdent: {
+			C_IdentID ident = C_Intern(&checker->interner, ast->ident.name.lexeme);
+			C_SymbolID symbol = C_ResolveSymbol(&checker->symbols, ident);
+			if (!symbol) {
+				C_Report(checker, ast->ident.name, "Undeclared identifier %.*s", str_expand(ast->ident.name.lexeme));
+				return TypeID_Invalid;
+			}
+			ast->ident.symbol = symbol;
+			if (!C_CheckCapture(checker, ast->ident.name, symbol)) return TypeID_Invalid;
+			
+			TypeID type = C_GetSymbol(&checker->symbols, symbol)->type;
+			if (C_IsFunction(checker, type)) {
+				C_Report(checker, ast->ident.name, "Function %.*s can only be called", str_expand(ast->ident.name.lexeme));
+				return TypeID_Invalid;
+			}
+			return type;
+		} break;
+		
+		case AstType_ExprFunc: {
+			C_Report(checker, ast->func.token, "Function literals can only be the value of a declaration");
+			return TypeID_Invalid;
+		} break;
+		
+		case AstType_ExprCall: {
+			TypeID arg_types[TYPE_MAX_PARAMS] = {0};
+			b8 parse_failed = false;
+			for (u32 i = 0; i < ast->call.arg_count; i++) {
+				if (!ast->call.args[i]) parse_failed = true;
+				TypeID arg_type = C_CheckAst(checker, ast->call.args[i]);
+				if (i < TYPE_MAX_PARAMS) arg_types[i] = arg_type;
+			}
+			
+			L_Token name = ast->call.name;
+			C_IdentID ident = C_Intern(&checker->interner, name.lexeme);
+			C_SymbolID symbol = C_ResolveSymbol(&checker->symbols, ident);
+			if (!symbol) {
+				C_Report(checker, name, "Undeclared identifier %.*s", str_expand(name.lexeme));
+				return TypeID_Invalid;
+			}
+			ast->call.symbol = symbol;
+			
+			TypeID callee_type = C_GetSymbol(&checker->symbols, symbol)->type;
+			if (callee_type == TypeID_Invalid) return TypeID_Invalid;
+			if (!C_IsFunction(checker, callee_type)) {
+				C_Report(checker, name, "%.*s is not a function", str_expand(name.lexeme));
+				return TypeID_Invalid;
+			}
+			
+			// The parser already reported the argument, the count can't be trusted
+			if (parse_failed) return TypeID_Invalid;
+			
+			FunctionType* signature = &TypeCache_Get(&checker->type_cache, callee_type)->function;
+			if (ast->call.arg_count != signature->param_count) {
+				C_Report(checker, name, "%.*s takes %u argument(s) but got %u", str_expand(name.lexeme),
+						 signature->param_count, ast->call.arg_count);
+				return signature->return_type;
+			}
+			for (u32 i = 0; i < ast->call.arg_count; i++) {
+				if (arg_types[i] == TypeID_Invalid || arg_types[i] == signature->params[i]) continue;
+				C_Report(checker, name, "Argument %u of %.*s has to be %.*s but got %.*s", i + 1, str_expand(name.lexeme),
+						 str_expand(TypeCache_GetName(&checker->type_cache, signature->params[i])),
+						 str_expand(TypeCache_GetName(&checker->type_cache, arg_types[i])));
+			}
+			return signature->return_type;
+		} break;
+		
+		case AstType_StmtPrint: {
+			TypeID type = C_CheckAst(checker, ast->print.value);
+			if (type == TypeID_Void) C_Report(checker, ast->print.token, "Cannot print a value of type void");
+		} break;
+		
+		case AstType_StmtReturn: {
+			TypeID type = ast->return_stmt.value ? C_CheckAst(checker, ast->return_stmt.value) : TypeID_Void;
+			if (checker->function_type == TypeID_Invalid) {
+				C_Report(checker, ast->return_stmt.token, "Return outside of a function");
+				break;
+			}
+			
+			TypeID expected = TypeCache_Get(&checker->type_cache, checker->function_type)->function.return_type;
+			if (type != TypeID_Invalid && expected != TypeID_Invalid && type != expected) {
+				C_Report(checker, ast->return_stmt.token, "Cannot return a value of type %.*s from a function returning %.*s",
+						 str_expand(TypeCache_GetName(&checker->type_cache, type)),
+						 str_expand(TypeCache_GetName(&checker->type_cache, expected)));
+			}
 		} break;
 		
-		case AstType_StmtPrint: return C_CheckAst(ast->print.value);
+		case AstType_StmtExpr: {
+			C_CheckAst(checker, ast->expr_stmt.expr);
+		} break;
+		
+		// Declarations directly in a branch or loop body still get their own scope
+		case AstType_StmtIf: {
+			C_CheckCondition(checker, ast->if_stmt.token, ast->if_stmt.condition);
+			C_PushScope(&checker->symbols);
+			C_CheckAst(checker, ast->if_stmt.then_body);
+			C_PopScope(&checker->symbols);
+			if (ast->if_stmt.else_body) {
+				C_PushScope(&checker->symbols);
+				C_CheckAst(checker, ast->if_stmt.else_body);
+				C_PopScope(&checker->symbols);
+			}
+		} break;
+		
+		case AstType_StmtWhile: {
+			C_CheckCondition(checker, ast->while_stmt.token, ast->while_stmt.condition);
+			C_PushScope(&checker->symbols);
+			C_CheckAst(checker, ast->while_stmt.body);
+			C_PopScope(&checker->symbols);
+		} break;
+		
+		case AstType_StmtVarDecl: {
+			IR_Ast* value = ast->var_decl.value;
+			if (value && value->type == AstType_ExprFunc && ast->var_decl.type.type == TokenType_Error) {
+				// Declared before the body is checked so the function can call itself
+				TypeID type = C_CheckFuncSignature(checker, value);
+				value->expr_type = type;
+				C_IdentID ident = C_Intern(&checker->interner, ast->var_decl.name.lexeme);
+				C_SymbolID symbol = C_DeclareSymbol(&checker->symbols, ident, type, ast->var_decl.name);
+				if (!symbol) {
+					C_SymbolID prev = C_ResolveSymbol(&checker->symbols, ident);
+					L_Token prev_decl = C_GetSymbol(&checker->symbols, prev)->decl;
+					C_Report(checker, ast->var_decl.name, "Redeclaration of %.*s, previously declared at %u:%u",
+							 str_expand(ast->var_decl.name.lexeme), prev_decl.line, prev_decl.column);
+					symbol = prev;
+				}
+				ast->var_decl.symbol = symbol;
+				if (value->func.body) {
+					C_CheckFuncBody(checker, value, type, ast->var_decl.name);
+				} else if (value->func.param_count > TYPE_MAX_NATIVE_PARAMS) {
+					C_Report(checker, ast->var_decl.name, "Native functions can't have more than %d parameters",
+							 TYPE_MAX_NATIVE_PARAMS);
+				}
+				break;
+			}
+			
+			TypeID type = TypeID_Invalid;
+			if (ast->var_decl.type.type == TokenType_Int) {
+				type = TypeCache_Register(&checker->type_cache, (Type) {
+											  .kind = TypeKind_Regular,
+											  .regular = RegularTypeKind_Integer
+										  });
+			}
+			
+			if (ast->var_decl.value) {
+				TypeID value_type = C_CheckAst(checker, ast->var_decl.value);
+				if (ast->var_decl.type.type == TokenType_Error) {
+					type = value_type;
+				} else if (value_type != TypeID_Invalid && value_type != type) {
+					C_Report(checker, ast->var_decl.name, "Cannot initialize %.*s of type %.*s with a value of type %.*s",
+							 str_expand(ast->var_decl.name.lexeme),
+							 str_expand(TypeCache_GetName(&checker->type_cache, type)),
+							 str_expand(TypeCache_GetName(&checker->type_cache, value_type)));
+				}
+			}
+			
+			if (type == TypeID_Void) {
+				C_Report(checker, ast->var_decl.name, "Cannot declare %.*s with a value of type void", str_expand(ast->var_decl.name.lexeme));
+				type = TypeID_Invalid;
+			}
+			
+			// Declared even when poisoned so uses don't report again
+			C_IdentID ident = C_Intern(&checker->interner, ast->var_decl.name.lexeme);
+			C_SymbolID symbol = C_DeclareSymbol(&checker->symbols, ident, type, ast->var_decl.name);
+			if (!symbol) {
+				C_SymbolID prev = C_ResolveSymbol(&checker->symbols, ident);
+				L_Token prev_decl = C_GetSymbol(&checker->symbols, prev)->decl;
+				C_Report(checker, ast->var_decl.name, "Redeclaration of %.*s, previously declared at %u:%u",
+						 str_expand(ast->var_decl.name.lexeme), prev_decl.line, prev_decl.column);
+				symbol = prev;
+			}
+			ast->var_decl.symbol = symbol;
+		} break;
+		
+		case AstType_StmtAssign: {
+			TypeID value_type = C_CheckAst(checker, ast->assign.value);
+			C_IdentID ident = C_Intern(&checker->interner, ast->assign.name.lexeme);
+			C_SymbolID symbol = C_ResolveSymbol(&checker->symbols, ident);
+			if (!symbol) {
+				C_Report(checker, ast->assign.name, "Undeclared identifier %.*s", str_expand(ast->assign.name.lexeme));
+				break;
+			}
+			ast->assign.symbol = symbol;
+			if (!C_CheckCapture(checker, ast->assign.name, symbol)) break;
+			
+			TypeID type = C_GetSymbol(&checker->symbols, symbol)->type;
+			if (C_IsFunction(checker, type)) {
+				C_Report(checker, ast->assign.name, "Cannot assign to function %.*s", str_expand(ast->assign.name.lexeme));
+				break;
+			}
+			if (type != TypeID_Invalid && value_type != TypeID_Invalid && type != value_type) {
+				C_Report(checker, ast->assign.name, "Cannot assign a value of type %.*s to %.*s of type %.*s",
+						 str_expand(TypeCache_GetName(&checker->type_cache, value_type)),
+						 str_expand(ast->assign.name.lexeme),
+						 str_expand(TypeCache_GetName(&checker->type_cache, type)));
+			}
+		} break;
+		
+		case AstType_StmtBlock: {
+			if (ast->block.scoped) C_PushScope(&checker->symbols);
+			for (u32 i = 0; i < ast->block.count; i++) {
+				C_CheckAst(checker, ast->block.statements[i]);
+			}
+			if (ast->block.scoped) C_PopScope(&checker->symbols);
+		} break;
 	}
 	return TypeID_Invalid;
 }
 
+static TypeID C_CheckAst(C_Checker* checker, IR_Ast* ast) {
+	// The parser already reported whatever produced a null node
+	if (!ast) return TypeID_Invalid;
+	if (!checker->collect_stats) return ast->expr_type = C_CheckNode(checker, ast);
+	
+	C_CheckerStats* stats = &checker->stats;
+	u64 outer_child_ns = stats->child_ns;
+	stats->child_ns = 0;
+	
+	u64 start = U_GetTimeNs();
+	TypeID ret = C_CheckNode(checker, ast);
+	u64 elapsed = U_GetTimeNs() - start;
+	
+	stats->node_visits[ast->type]++;
+	stats->node_total_ns[ast->type] += elapsed;
+	stats->node_self_ns[ast->type] += elapsed - stats->child_ns;
+	stats->child_ns = outer_child_ns + elapsed;
+	return ast->expr_type = ret;
+}
+
+//~ Allocation Stats
+
+static void C_BeginPhase(C_Checker* checker, C_Phase phase) {
+	checker->alloc_stats[phase].alloc_count = checker->arena->alloc_count;
+	checker->alloc_stats[phase].alloc_bytes = checker->arena->alloc_position;
+}
+
+static void C_EndPhase(C_Checker* checker, C_Phase phase) {
+	checker->alloc_stats[phase].alloc_count = checker->arena->alloc_count - checker->alloc_stats[phase].alloc_count;
+	checker->alloc_stats[phase].alloc_bytes = checker->arena->alloc_position - checker->alloc_stats[phase].alloc_bytes;
+}
+
+void C_PrintAllocStats(C_Checker* checker) {
+	static const char* phase_names[Phase_COUNT] = {
+		[Phase_Init] = "init",
+		[Phase_Check] = "check",
+	};
+	
+	printf("Checker allocations (arena, no per-element malloc/free):\n");
+	for (u32 i = 0; i < Phase_COUNT; i++) {
+		printf("  %-8s %8llu allocs %10llu bytes\n", phase_names[i],
+			   checker->alloc_stats[i].alloc_count, checker->alloc_stats[i].alloc_bytes);
+	}
+}
+
+//~ Stats
+
+void C_PrintStats(C_Checker* checker) {
+	static const char* ast_type_names[AstType_COUNT] = {
+		[AstType_IntLiteral] = "IntLiteral",
+		[AstType_FloatLiteral] = "FloatLiteral",
+		[AstType_ExprUnary] = "ExprUnary",
+		[AstType_ExprBinary] = "ExprBinary",
+		[AstType_ExprIdent] = "ExprIdent",
+		[AstType_ExprFunc] = "ExprFunc",
+		[AstType_ExprCall] = "ExprCall",
+		[AstType_StmtPrint] = "StmtPrint",
+		[AstType_StmtVarDecl] = "StmtVarDecl",
+		[AstType_StmtAssign] = "StmtAssign",
+		[AstType_StmtBlock] = "StmtBlock",
+		[AstType_StmtReturn] = "StmtReturn",
+		[AstType_StmtExpr] = "StmtExpr",
+		[AstType_StmtIf] = "StmtIf",
+		[AstType_StmtWhile] = "StmtWhile",
+	};
+	
+	C_CheckerStats* stats = &checker->stats;
+	printf("Checker stats:\n");
+	printf("  %-14s %10s %14s %14s\n", "node", "visits", "total ns", "self ns");
+	for (u32 i = 0; i < AstType_COUNT; i++) {
+		if (!stats->node_visits[i]) continue;
+		printf("  %-14s %10llu %14llu %14llu\n", ast_type_names[i],
+			   stats->node_visits[i], stats->node_total_ns[i], stats->node_self_ns[i]);
+	}
+	printf("  operator table lookups: %llu\n", stats->operator_lookups);
+	printf("  type cache: %llu hits, %llu misses\n", checker->type_cache.hits, checker->type_cache.misses);
+}
+
+//~ Lifecycle
+
 b8 C_Check(C_Checker* checker) {
-	C_CheckAst(checker->ast);
+	C_BeginPhase(checker, Phase_Check);
+	// Always walks the whole tree, every error ends up in checker->diagnostics
+	C_CheckAst(checker, checker->ast);
+	C_EndPhase(checker, Phase_Check);
+	
+	C_PrintDiagnostics(checker);
 	return !checker->errored;
 }
 
 void C_Init(C_Checker* checker, IR_Ast* ast) {
 	MemoryZeroStruct(checker, C_Checker);
 	checker->ast = ast;
+	checker->arena = arena_make();
 	
-	TypeCache_Init(&checker->type_cache);
+	C_BeginPhase(checker, Phase_Init);
+	TypeCache_Init(&checker->type_cache, checker->arena);
+	C_InternerInit(&checker->interner, checker->arena);
+	C_SymbolTableInit(&checker->symbols, checker->arena);
 	
 	// NOTE(voxel): Register basic types so compiletime tables can be supah quick
 	// NOTE(voxel): TypeCache_Init reserves the amount of space required
@@ -132,9 +766,13 @@ void C_Init(C_Checker* checker, IR_Ast* ast) {
 								 .kind = TypeKind_Regular,
 								 .regular = RegularTypeKind_Integer
 							 }, TypeID_Integer);
-	
+	TypeCache_RegisterWithID(&checker->type_cache, (Type) {
+								 .kind = TypeKind_Regular,
+								 .regular = RegularTypeKind_Void
+							 }, TypeID_Void);
+	C_EndPhase(checker, Phase_Init);
 }
 
 void C_Free(C_Checker* checker) {
-	TypeCache_Free(&checker->type_cache);
+	arena_free(checker->arena);
 }
\ No newline at end of file
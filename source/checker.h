@@ -6,45 +6,173 @@
 #include "ast_nodes.h"
 #include "types.h"
 #include "base/ds.h"
+#include "base/mem.h"
+#include "base/str.h"
 
 //~ Type Cache
 
-DArray_Prototype(Type);
-
-#if 0
-typedef struct TypeCache TypeCache;
-#endif
-typedef darray(Type) TypeCache;
-
 // TODO(voxel): Switch to hashset
-//typedef struct TypeCache {
-//u32 len;
-//u32 cap;
-//Type* elems;
-//} TypeCache;
+// Lives in the checker arena, growing leaves the old block behind
+// which is fine since it all goes away with the arena
+typedef struct TypeCache {
+	M_Arena* arena;
+	u32 len;
+	u32 cap;
+	Type* elems;
+	
+	u64 hits;
+	u64 misses;
+} TypeCache;
 
-void TypeCache_Init(TypeCache* cache);
+void TypeCache_Init(TypeCache* cache, M_Arena* arena);
 TypeID TypeCache_Register(TypeCache* cache, Type type);
 Type* TypeCache_Get(TypeCache* cache, TypeID id);
-void TypeCache_Free(TypeCache* cache);
 
+// TypeID_Invalid is also the poison type: the error is already reported, consumers just propagate it
 enum {
 	TypeID_Invalid = 0,
 	TypeID_Integer,
+	TypeID_Void,
 	TypeID_COUNT,
 };
 
+//~ Identifier Interning
+
+// 0 is never handed out, so zeroed memory means "no identifier"
+typedef u32 C_IdentID;
+
+typedef struct C_InternSlot {
+	u32 hash;
+	C_IdentID id;
+} C_InternSlot;
+
+// Open addressing, linear probing. cap is always a power of two
+typedef struct C_Interner {
+	M_Arena* arena;
+	u32 cap;
+	u32 len;
+	C_InternSlot* slots;
+	
+	u32 names_cap;
+	string* names;
+} C_Interner;
+
+void C_InternerInit(C_Interner* interner, M_Arena* arena);
+C_IdentID C_Intern(C_Interner* interner, string name);
+string C_GetIdentName(C_Interner* interner, C_IdentID id);
+
+//~ Symbol Table
+
+// 0 is never handed out, so zeroed memory means "no symbol"
+typedef u32 C_SymbolID;
+
+typedef struct C_Symbol {
+	C_IdentID ident;
+	TypeID type;
+	L_Token decl;
+	
+	// The binding of the same identifier this one shadows
+	C_SymbolID shadowed;
+	u32 depth;
+	u32 generation;
+} C_Symbol;
+
+// bindings maps an identifier to its innermost declaration. Popping a scope only drops the depth,
+// stale bindings are skipped by their scope generation on lookup
+typedef struct C_SymbolTable {
+	M_Arena* arena;
+	
+	u32 symbol_count;
+	u32 symbol_cap;
+	C_Symbol* symbols;
+	
+	u32 binding_cap;
+	C_SymbolID* bindings;
+	
+	u32 depth;
+	u32 scope_cap;
+	u32* scope_generations;
+	u32 next_generation;
+} C_SymbolTable;
+
+void C_SymbolTableInit(C_SymbolTable* table, M_Arena* arena);
+void C_PushScope(C_SymbolTable* table);
+void C_PopScope(C_SymbolTable* table);
+C_SymbolID C_DeclareSymbol(C_SymbolTable* table, C_IdentID ident, TypeID type, L_Token decl);
+C_SymbolID C_ResolveSymbol(C_SymbolTable* table, C_IdentID ident);
+C_Symbol* C_GetSymbol(C_SymbolTable* table, C_SymbolID id);
+
+//~ Diagnostics
+
+typedef struct C_Diagnostic C_Diagnostic;
+struct C_Diagnostic {
+	C_Diagnostic* next;
+	u32 line, column;
+	string message;
+};
+
+typedef struct C_DiagnosticList {
+	C_Diagnostic* first;
+	C_Diagnostic* last;
+	u32 count;
+} C_DiagnosticList;
+
 //~ Checker
 
+typedef u32 C_Phase;
+enum {
+	Phase_Init,
+	Phase_Check,
+	
+	Phase_COUNT,
+};
+
+typedef struct C_AllocStats {
+	u64 alloc_count;
+	u64 alloc_bytes;
+} C_AllocStats;
+
+// Only collected when C_Checker.collect_stats is set
+// total_ns includes the children of a node, self_ns doesn't
+typedef struct C_CheckerStats {
+	u64 node_visits[AstType_COUNT];
+	u64 node_total_ns[AstType_COUNT];
+	u64 node_self_ns[AstType_COUNT];
+	u64 child_ns;
+	
+	u64 operator_lookups;
+} C_CheckerStats;
+
+// Everything the checker owns is allocated from checker->arena
 typedef struct C_Checker {
 	IR_Ast* ast;
 	b8 errored;
 	
+	M_Arena* arena;
+	C_DiagnosticList diagnostics;
+	C_AllocStats alloc_stats[Phase_COUNT];
+	
+	b8 collect_stats;
+	C_CheckerStats stats;
+	
 	TypeCache type_cache;
+	C_Interner interner;
+	C_SymbolTable symbols;
+	
+	// Function whose body is being checked, TypeID_Invalid at the top level. Anything declared
+	// below function_depth belongs to the enclosing code and can't be captured
+	TypeID function_type;
+	u32 function_depth;
 } C_Checker;
 
 void C_Init(C_Checker* checker, IR_Ast* ast);
 b8 C_Check(C_Checker* checker);
 void C_Free(C_Checker* checker);
 
+// No path through the statement falls off its end, the rule for functions with a result
+b8 C_EndsWithReturn(IR_Ast* ast);
+
+void C_PrintAllocStats(C_Checker* checker);
+void C_PrintStats(C_Checker* checker);
+
 #endif //CHECKER_H
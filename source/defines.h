@@ -40,6 +40,8 @@ typedef void (*void_func_ptr)(void);
 
 #define null 0
 #define u32_max 4294967295
+#define u64_max 18446744073709551615ull
+#define i32_min (-2147483647 - 1)
 
 #ifndef __cplusplus
 #define nullptr (void*)0
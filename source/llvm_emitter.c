@@ -1,10 +1,16 @@
 #include "llvm_emitter.h"
+#include <errno.h>
+
+#include "checker.h"
+#include "base/log.h"
 
 #include "llvm-c/Analysis.h"
 #include "llvm-c/Target.h"
 #include "llvm-c/TargetMachine.h"
 #include "llvm-c/Error.h"
 
+DArray_Impl(LLVMValueRef);
+
 //~ Helpers
 
 static void LLVM_Report_LLVMHandler(const char* reason) { fprintf(stderr, "LLVM Error %s", reason); }
@@ -27,16 +33,129 @@ static LLVMValueRef LLVM_EmitBinary(LLVM_Emitter* emitter, L_TokenType op, LLVMV
 		case TokenType_Plus: return LLVMBuildAdd(emitter->builder, a, b, "");
 		case TokenType_Minus: return LLVMBuildSub(emitter->builder, a, b, "");
 		case TokenType_Star: return LLVMBuildMul(emitter->builder, a, b, "");
-		case TokenType_Slash: return LLVMBuildUDiv(emitter->builder, a, b, "");
-		case TokenType_Percent: return LLVMBuildURem(emitter->builder, a, b, "");
+		case TokenType_Slash: return LLVMBuildSDiv(emitter->builder, a, b, "");
+		case TokenType_Percent: return LLVMBuildSRem(emitter->builder, a, b, "");
+	}
+	
+	LLVMIntPredicate predicate = LLVMIntEQ;
+	switch (op) {
+		case TokenType_Less: predicate = LLVMIntSLT; break;
+		case TokenType_Greater: predicate = LLVMIntSGT; break;
+		case TokenType_LessEqual: predicate = LLVMIntSLE; break;
+		case TokenType_GreaterEqual: predicate = LLVMIntSGE; break;
+		case TokenType_EqualEqual: predicate = LLVMIntEQ; break;
+		case TokenType_BangEqual: predicate = LLVMIntNE; break;
+		
+		default: unreachable;
+	}
+	// Comparisons are ints in the language
+	LLVMValueRef result = LLVMBuildICmp(emitter->builder, predicate, a, b, "");
+	return LLVMBuildZExt(emitter->builder, result, emitter->int_32_type, "");
+}
+
+static LLVMValueRef LLVM_EmitCondition(LLVM_Emitter* emitter, IR_Ast* condition) {
+	LLVMValueRef value = LLVM_Emit(emitter, condition);
+	return LLVMBuildICmp(emitter->builder, LLVMIntNE, value, LLVMConstInt(emitter->int_32_type, 0, false), "");
+}
+
+// Locals go in the entry block, so a declaration inside a loop doesn't grow the stack every iteration
+static LLVMValueRef LLVM_BuildLocal(LLVM_Emitter* emitter) {
+	LLVMBasicBlockRef entry = LLVMGetEntryBasicBlock(LLVMGetBasicBlockParent(LLVMGetInsertBlock(emitter->builder)));
+	LLVMBuilderRef builder = LLVMCreateBuilderInContext(emitter->context);
+	LLVMValueRef first = LLVMGetFirstInstruction(entry);
+	if (first) LLVMPositionBuilderBefore(builder, first);
+	else LLVMPositionBuilderAtEnd(builder, entry);
+	LLVMValueRef slot = LLVMBuildAlloca(builder, emitter->int_32_type, "");
+	LLVMDisposeBuilder(builder);
+	return slot;
+}
+
+static LLVMBasicBlockRef LLVM_AppendBlock(LLVM_Emitter* emitter, const char* name) {
+	LLVMValueRef function = LLVMGetBasicBlockParent(LLVMGetInsertBlock(emitter->builder));
+	return LLVMAppendBasicBlockInContext(emitter->context, function, name);
+}
+
+// Falls through to target unless the block already ended in a return
+static void LLVM_BranchIfOpen(LLVM_Emitter* emitter, LLVMBasicBlockRef target) {
+	if (!LLVMGetBasicBlockTerminator(LLVMGetInsertBlock(emitter->builder)))
+		LLVMBuildBr(emitter->builder, target);
+}
+
+
+static LLVMValueRef LLVM_EmitConstexpr(LLVM_Emitter* emitter, VM_RuntimeValue value) {
+	switch (value.type) {
+		case RuntimeValueType_Integer: return LLVMConstInt(emitter->int_32_type, (u32) value.as_int, true);
 		
 		default: unreachable;
 	}
 	return (LLVMValueRef) {0};
 }
 
+static void LLVM_SetSymbolValue(LLVM_Emitter* emitter, u32 symbol, LLVMValueRef value) {
+	while (emitter->locals.len <= symbol)
+		darray_add(LLVMValueRef, &emitter->locals, nullptr);
+	emitter->locals.elems[symbol] = value;
+}
+
+// Every function, nested ones included, is an internal LLVM function emitted on the spot
+static void LLVM_EmitFunction(LLVM_Emitter* emitter, L_Token name, u32 symbol, IR_Ast* ast) {
+	LLVMTypeRef params[TYPE_MAX_PARAMS];
+	for (u32 i = 0; i < ast->func.param_count; i++) params[i] = emitter->int_32_type;
+	b8 returns_value = ast->func.return_type.type != TokenType_Error;
+	LLVMTypeRef return_type = returns_value ? emitter->int_32_type : LLVMVoidTypeInContext(emitter->context);
+	LLVMTypeRef type = LLVMFunctionType(return_type, params, ast->func.param_count, false);
+	
+	char function_name[256];
+	snprintf(function_name, sizeof(function_name), "%.*s", str_expand(name.lexeme));
+	if (!ast->func.body) {
+		// #native, an external declaration under the exact name for the linker to resolve
+		LLVMValueRef native = LLVMGetNamedFunction(emitter->module, function_name);
+		if (!native || LLVMGlobalGetValueType(native) != type) native = LLVMAddFunction(emitter->module, function_name, type);
+		LLVM_SetSymbolValue(emitter, symbol, native);
+		return;
+	}
+	
+	// LLVM renames it if the name is taken, main for example
+	LLVMValueRef function = LLVMAddFunction(emitter->module, function_name, type);
+	LLVMSetLinkage(function, LLVMInternalLinkage);
+	LLVM_SetSymbolValue(emitter, symbol, function);
+	
+	LLVMBasicBlockRef outer = LLVMGetInsertBlock(emitter->builder);
+	LLVMPositionBuilderAtEnd(emitter->builder, LLVMAppendBasicBlockInContext(emitter->context, function, "entry"));
+	for (u32 i = 0; i < ast->func.param_count; i++) {
+		LLVMValueRef slot = LLVMBuildAlloca(emitter->builder, emitter->int_32_type, "");
+		LLVMBuildStore(emitter->builder, LLVMGetParam(function, i), slot);
+		LLVM_SetSymbolValue(emitter, ast->func.param_symbols[i], slot);
+	}
+	
+	LLVM_Emit(emitter, ast->func.body);
+	// The checker makes sure functions with a result end with a return, if one is
+	// still open here it's the join block after an if whose branches both returned
+	if (!LLVMGetBasicBlockTerminator(LLVMGetInsertBlock(emitter->builder))) {
+		if (returns_value) LLVMBuildUnreachable(emitter->builder);
+		else LLVMBuildRetVoid(emitter->builder);
+	}
+	LLVMPositionBuilderAtEnd(emitter->builder, outer);
+}
+
+static LLVMValueRef LLVM_EmitCall(LLVM_Emitter* emitter, IR_Ast* ast) {
+	LLVMValueRef args[TYPE_MAX_PARAMS];
+	for (u32 i = 0; i < ast->call.arg_count; i++) {
+		args[i] = LLVM_Emit(emitter, ast->call.args[i]);
+	}
+	LLVMValueRef function = emitter->locals.elems[ast->call.symbol];
+	// A native might write to stdout itself, what we printed has to be out first
+	if (LLVMGetLinkage(function) != LLVMInternalLinkage)
+		LLVMBuildCall2(emitter->builder, emitter->flush_type, emitter->flush_function, nullptr, 0, "");
+	return LLVMBuildCall2(emitter->builder, LLVMGlobalGetValueType(function), function, args, ast->call.arg_count, "");
+}
 
 LLVMValueRef LLVM_Emit(LLVM_Emitter* emitter, IR_Ast* ast) {
+	VM_RuntimeValue constexpr_value;
+	if (emitter->constexprs && VM_GetConstexpr(emitter->constexprs, ast, &constexpr_value)) {
+		return LLVM_EmitConstexpr(emitter, constexpr_value);
+	}
+	
 	switch (ast->type) {
 		case AstType_IntLiteral: {
 			return LLVMConstInt(emitter->int_32_type, ast->int_lit.value, false);
@@ -58,22 +177,282 @@ LLVMValueRef LLVM_Emit(LLVM_Emitter* emitter, IR_Ast* ast) {
 		} break;
 		
 		case AstType_StmtPrint: {
-			// NOTE(voxel): Very Hardcoded ATM
+			LLVMValueRef value = LLVM_Emit(emitter, ast->print.value);
+			return LLVMBuildCall2(emitter->builder, emitter->print_type, emitter->print_function, &value, 1, "");
+		} break;
+		
+		case AstType_ExprIdent: {
+			LLVMValueRef slot = emitter->locals.elems[ast->ident.symbol];
+			return LLVMBuildLoad2(emitter->builder, emitter->int_32_type, slot, "");
+		} break;
+		
+		case AstType_ExprCall: {
+			return LLVM_EmitCall(emitter, ast);
+		} break;
+		
+		case AstType_StmtVarDecl: {
+			if (ast->var_decl.value && ast->var_decl.value->type == AstType_ExprFunc) {
+				LLVM_EmitFunction(emitter, ast->var_decl.name, ast->var_decl.symbol, ast->var_decl.value);
+				break;
+			}
 			
-			LLVMValueRef args[2] = {
-				LLVMBuildPointerCast(emitter->builder, // cast [14 x i8] type to int8 pointer
-									 LLVMBuildGlobalString(emitter->builder, "%d", ""),
-									 emitter->int_8_type_ptr, ""),
-				LLVM_Emit(emitter, ast->print.value),
-			};
+			AssertTrue(!ast->var_decl.value || ast->var_decl.value->expr_type == TypeID_Integer, "Only int variables get a stack slot");
+			LLVMValueRef slot = LLVM_BuildLocal(emitter);
+			LLVM_SetSymbolValue(emitter, ast->var_decl.symbol, slot);
 			
-			return LLVMBuildCall2(emitter->builder, emitter->printf_type, emitter->printf_object, args, 2, "");
+			LLVMValueRef value = ast->var_decl.value
+				? LLVM_Emit(emitter, ast->var_decl.value)
+				: LLVMConstInt(emitter->int_32_type, 0, false);
+			LLVMBuildStore(emitter->builder, value, slot);
+		} break;
+		
+		case AstType_StmtAssign: {
+			LLVMValueRef value = LLVM_Emit(emitter, ast->assign.value);
+			LLVMBuildStore(emitter->builder, value, emitter->locals.elems[ast->assign.symbol]);
+		} break;
+		
+		case AstType_StmtBlock: {
+			for (u32 i = 0; i < ast->block.count; i++) {
+				// Whatever follows a return is dead and would have no block to go in
+				if (LLVMGetBasicBlockTerminator(LLVMGetInsertBlock(emitter->builder))) break;
+				LLVM_Emit(emitter, ast->block.statements[i]);
+			}
+		} break;
+		
+		case AstType_StmtReturn: {
+			if (!ast->return_stmt.value) {
+				LLVMBuildRetVoid(emitter->builder);
+				break;
+			}
+			
+			LLVMValueRef value = LLVM_Emit(emitter, ast->return_stmt.value);
+			// Same guarantee as Opcode_TailCall, as far as LLVM can give it
+			if (ast->return_stmt.value->type == AstType_ExprCall) LLVMSetTailCall(value, true);
+			if (LLVMGetTypeKind(LLVMTypeOf(value)) == LLVMVoidTypeKind) LLVMBuildRetVoid(emitter->builder);
+			else LLVMBuildRet(emitter->builder, value);
+		} break;
+		
+		case AstType_StmtExpr: {
+			LLVM_Emit(emitter, ast->expr_stmt.expr);
+		} break;
+		
+		case AstType_StmtIf: {
+			LLVMValueRef condition = LLVM_EmitCondition(emitter, ast->if_stmt.condition);
+			LLVMBasicBlockRef then_block = LLVM_AppendBlock(emitter, "then");
+			LLVMBasicBlockRef else_block = ast->if_stmt.else_body ? LLVM_AppendBlock(emitter, "else") : nullptr;
+			LLVMBasicBlockRef end_block = LLVM_AppendBlock(emitter, "endif");
+			LLVMBuildCondBr(emitter->builder, condition, then_block, else_block ? else_block : end_block);
+			
+			LLVMPositionBuilderAtEnd(emitter->builder, then_block);
+			LLVM_Emit(emitter, ast->if_stmt.then_body);
+			LLVM_BranchIfOpen(emitter, end_block);
+			if (else_block) {
+				LLVMPositionBuilderAtEnd(emitter->builder, else_block);
+				LLVM_Emit(emitter, ast->if_stmt.else_body);
+				LLVM_BranchIfOpen(emitter, end_block);
+			}
+			LLVMPositionBuilderAtEnd(emitter->builder, end_block);
+		} break;
+		
+		case AstType_StmtWhile: {
+			LLVMBasicBlockRef condition_block = LLVM_AppendBlock(emitter, "while");
+			LLVMBasicBlockRef body_block = LLVM_AppendBlock(emitter, "body");
+			LLVMBasicBlockRef end_block = LLVM_AppendBlock(emitter, "endwhile");
+			LLVMBuildBr(emitter->builder, condition_block);
+			
+			LLVMPositionBuilderAtEnd(emitter->builder, condition_block);
+			LLVMValueRef condition = LLVM_EmitCondition(emitter, ast->while_stmt.condition);
+			LLVMBuildCondBr(emitter->builder, condition, body_block, end_block);
+			
+			LLVMPositionBuilderAtEnd(emitter->builder, body_block);
+			LLVM_Emit(emitter, ast->while_stmt.body);
+			LLVM_BranchIfOpen(emitter, condition_block);
+			LLVMPositionBuilderAtEnd(emitter->builder, end_block);
 		} break;
 	}
 	
 	return (LLVMValueRef) {0};
 }
 
+//~ Runtime
+
+// Prints are formatted into rift_output, written out when it fills up and before main returns
+#define LLVM_OUTPUT_BUFFER_SIZE 65536
+// Digits of i32_min plus the sign
+#define LLVM_MAX_I32_CHARS 11
+
+static LLVMValueRef LLVM_ConstI64(LLVM_Emitter* emitter, u64 value) {
+	return LLVMConstInt(emitter->int_64_type, value, false);
+}
+
+static LLVMValueRef LLVM_EmitRuntimeFlush(LLVM_Emitter* emitter, LLVMValueRef buffer, LLVMValueRef length) {
+	LLVMBuilderRef builder = emitter->builder;
+	LLVMTypeRef void_type = LLVMVoidTypeInContext(emitter->context);
+	
+#ifdef PLATFORM_WIN
+	LLVMTypeRef write_params[] = { emitter->int_32_type, emitter->int_8_type_ptr, emitter->int_32_type };
+	LLVMTypeRef write_type = LLVMFunctionType(emitter->int_32_type, write_params, 3, false);
+	LLVMValueRef write_function = LLVMAddFunction(emitter->module, "_write", write_type);
+#else
+	LLVMTypeRef write_params[] = { emitter->int_32_type, emitter->int_8_type_ptr, emitter->int_64_type };
+	LLVMTypeRef write_type = LLVMFunctionType(emitter->int_64_type, write_params, 3, false);
+	LLVMValueRef write_function = LLVMAddFunction(emitter->module, "write", write_type);
+#endif
+	
+	LLVMTypeRef errno_type = LLVMFunctionType(emitter->int_8_type_ptr, nullptr, 0, false);
+#ifdef PLATFORM_WIN
+	LLVMValueRef errno_function = LLVMAddFunction(emitter->module, "_errno", errno_type);
+#else
+	LLVMValueRef errno_function = LLVMAddFunction(emitter->module, "__errno_location", errno_type);
+#endif
+	
+	emitter->flush_type = LLVMFunctionType(void_type, nullptr, 0, false);
+	LLVMValueRef function = LLVMAddFunction(emitter->module, "rift_flush", emitter->flush_type);
+	LLVMSetLinkage(function, LLVMInternalLinkage);
+	LLVMBasicBlockRef entry = LLVMAppendBasicBlockInContext(emitter->context, function, "entry");
+	LLVMBasicBlockRef loop = LLVMAppendBasicBlockInContext(emitter->context, function, "loop");
+	LLVMBasicBlockRef write = LLVMAppendBasicBlockInContext(emitter->context, function, "write");
+	LLVMBasicBlockRef failed = LLVMAppendBasicBlockInContext(emitter->context, function, "failed");
+	LLVMBasicBlockRef done = LLVMAppendBasicBlockInContext(emitter->context, function, "done");
+	
+	LLVMPositionBuilderAtEnd(builder, entry);
+	LLVMValueRef len = LLVMBuildLoad2(builder, emitter->int_64_type, length, "len");
+	LLVMValueRef data = LLVMBuildPointerCast(builder, buffer, emitter->int_8_type_ptr, "");
+	LLVMBuildBr(builder, loop);
+	
+	// Keeps writing until the whole buffer is out, write can stop short on pipes
+	LLVMPositionBuilderAtEnd(builder, loop);
+	LLVMValueRef offset = LLVMBuildPhi(builder, emitter->int_64_type, "offset");
+	LLVMValueRef left = LLVMBuildICmp(builder, LLVMIntULT, offset, len, "");
+	LLVMBuildCondBr(builder, left, write, done);
+	
+	LLVMPositionBuilderAtEnd(builder, write);
+	LLVMValueRef count = LLVMBuildSub(builder, len, offset, "count");
+	LLVMValueRef source = LLVMBuildInBoundsGEP2(builder, emitter->int_8_type, data, &offset, 1, "");
+#ifdef PLATFORM_WIN
+	count = LLVMBuildTrunc(builder, count, emitter->int_32_type, "");
+#endif
+	LLVMValueRef args[] = { LLVMConstInt(emitter->int_32_type, 1, false), source, count };
+	LLVMValueRef written = LLVMBuildCall2(builder, write_type, write_function, args, 3, "written");
+#ifdef PLATFORM_WIN
+	written = LLVMBuildSExt(builder, written, emitter->int_64_type, "");
+#endif
+	LLVMValueRef next_offset = LLVMBuildAdd(builder, offset, written, "");
+	LLVMValueRef progressed = LLVMBuildICmp(builder, LLVMIntSGT, written, LLVM_ConstI64(emitter, 0), "");
+	LLVMBuildCondBr(builder, progressed, loop, failed);
+	
+	// An interrupted write is retried, any other error drops what is left
+	LLVMPositionBuilderAtEnd(builder, failed);
+	LLVMValueRef error_location = LLVMBuildCall2(builder, errno_type, errno_function, nullptr, 0, "");
+	error_location = LLVMBuildPointerCast(builder, error_location, LLVMPointerType(emitter->int_32_type, 0), "");
+	LLVMValueRef error = LLVMBuildLoad2(builder, emitter->int_32_type, error_location, "errno");
+	LLVMValueRef interrupted = LLVMBuildICmp(builder, LLVMIntEQ, error, LLVMConstInt(emitter->int_32_type, EINTR, false), "");
+	LLVMValueRef retry = LLVMBuildAnd(builder, interrupted,
+									  LLVMBuildICmp(builder, LLVMIntSLT, written, LLVM_ConstI64(emitter, 0), ""), "");
+	LLVMBuildCondBr(builder, retry, loop, done);
+	
+	LLVMValueRef incoming_offsets[] = { LLVM_ConstI64(emitter, 0), next_offset, offset };
+	LLVMBasicBlockRef incoming_blocks[] = { entry, write, failed };
+	LLVMAddIncoming(offset, incoming_offsets, incoming_blocks, 3);
+	
+	LLVMPositionBuilderAtEnd(builder, done);
+	LLVMBuildStore(builder, LLVM_ConstI64(emitter, 0), length);
+	LLVMBuildRetVoid(builder);
+	return function;
+}
+
+// void rift_print_i32(i32), the same text the old printf("%d") produced
+static LLVMValueRef LLVM_EmitRuntimePrint(LLVM_Emitter* emitter, LLVMValueRef buffer, LLVMValueRef length) {
+	LLVMBuilderRef builder = emitter->builder;
+	LLVMContextRef context = emitter->context;
+	
+	emitter->print_type = LLVMFunctionType(LLVMVoidTypeInContext(context), &emitter->int_32_type, 1, false);
+	LLVMValueRef print = LLVMAddFunction(emitter->module, "rift_print_i32", emitter->print_type);
+	LLVMSetLinkage(print, LLVMInternalLinkage);
+	
+	LLVMBasicBlockRef entry = LLVMAppendBasicBlockInContext(context, print, "entry");
+	LLVMBasicBlockRef make_room = LLVMAppendBasicBlockInContext(context, print, "flush");
+	LLVMBasicBlockRef convert = LLVMAppendBasicBlockInContext(context, print, "convert");
+	LLVMBasicBlockRef digits = LLVMAppendBasicBlockInContext(context, print, "digits");
+	LLVMBasicBlockRef append = LLVMAppendBasicBlockInContext(context, print, "append");
+	
+	// Make room for the longest number first
+	LLVMPositionBuilderAtEnd(builder, entry);
+	LLVMTypeRef text_type = LLVMArrayType(emitter->int_8_type, LLVM_MAX_I32_CHARS);
+	LLVMValueRef text = LLVMBuildAlloca(builder, text_type, "text");
+	LLVMValueRef len = LLVMBuildLoad2(builder, emitter->int_64_type, length, "len");
+	LLVMValueRef full = LLVMBuildICmp(builder, LLVMIntUGT, len,
+									  LLVM_ConstI64(emitter, LLVM_OUTPUT_BUFFER_SIZE - LLVM_MAX_I32_CHARS), "full");
+	LLVMBuildCondBr(builder, full, make_room, convert);
+	
+	LLVMPositionBuilderAtEnd(builder, make_room);
+	LLVMBuildCall2(builder, emitter->flush_type, emitter->flush_function, nullptr, 0, "");
+	LLVMBuildBr(builder, convert);
+	
+	// Magnitude in i64 so i32_min doesn't overflow
+	LLVMPositionBuilderAtEnd(builder, convert);
+	LLVMValueRef value = LLVMBuildSExt(builder, LLVMGetParam(print, 0), emitter->int_64_type, "");
+	LLVMValueRef negative = LLVMBuildICmp(builder, LLVMIntSLT, value, LLVM_ConstI64(emitter, 0), "negative");
+	LLVMValueRef magnitude = LLVMBuildSelect(builder, negative, LLVMBuildNeg(builder, value, ""), value, "magnitude");
+	LLVMBuildBr(builder, digits);
+	
+	// Digits go into text back to front
+	LLVMPositionBuilderAtEnd(builder, digits);
+	LLVMValueRef position = LLVMBuildPhi(builder, emitter->int_64_type, "position");
+	LLVMValueRef remaining = LLVMBuildPhi(builder, emitter->int_64_type, "remaining");
+	LLVMValueRef ten = LLVM_ConstI64(emitter, 10);
+	LLVMValueRef next_position = LLVMBuildSub(builder, position, LLVM_ConstI64(emitter, 1), "");
+	LLVMValueRef digit = LLVMBuildURem(builder, remaining, ten, "");
+	LLVMValueRef next_remaining = LLVMBuildUDiv(builder, remaining, ten, "");
+	LLVMValueRef character = LLVMBuildAdd(builder, LLVMBuildTrunc(builder, digit, emitter->int_8_type, ""),
+										  LLVMConstInt(emitter->int_8_type, '0', false), "");
+	LLVMValueRef indices[] = { LLVM_ConstI64(emitter, 0), next_position };
+	LLVMBuildStore(builder, character, LLVMBuildInBoundsGEP2(builder, text_type, text, indices, 2, ""));
+	LLVMValueRef more = LLVMBuildICmp(builder, LLVMIntNE, next_remaining, LLVM_ConstI64(emitter, 0), "");
+	LLVMBuildCondBr(builder, more, digits, append);
+	
+	LLVMValueRef start_position = LLVM_ConstI64(emitter, LLVM_MAX_I32_CHARS);
+	LLVMBasicBlockRef incoming_blocks[] = { convert, digits };
+	LLVMValueRef incoming_positions[] = { start_position, next_position };
+	LLVMValueRef incoming_remaining[] = { magnitude, next_remaining };
+	LLVMAddIncoming(position, incoming_positions, incoming_blocks, 2);
+	LLVMAddIncoming(remaining, incoming_remaining, incoming_blocks, 2);
+	
+	// At most 10 digits, so there is always a byte left in front for the sign
+	LLVMPositionBuilderAtEnd(builder, append);
+	LLVMValueRef sign_position = LLVMBuildSub(builder, next_position, LLVM_ConstI64(emitter, 1), "");
+	indices[1] = sign_position;
+	LLVMBuildStore(builder, LLVMConstInt(emitter->int_8_type, '-', false),
+				   LLVMBuildInBoundsGEP2(builder, text_type, text, indices, 2, ""));
+	LLVMValueRef first = LLVMBuildSelect(builder, negative, sign_position, next_position, "first");
+	LLVMValueRef count = LLVMBuildSub(builder, start_position, first, "count");
+	
+	LLVMValueRef offset = LLVMBuildLoad2(builder, emitter->int_64_type, length, "offset");
+	LLVMTypeRef buffer_type = LLVMArrayType(emitter->int_8_type, LLVM_OUTPUT_BUFFER_SIZE);
+	LLVMValueRef destination_indices[] = { LLVM_ConstI64(emitter, 0), offset };
+	LLVMValueRef destination = LLVMBuildInBoundsGEP2(builder, buffer_type, buffer, destination_indices, 2, "");
+	indices[1] = first;
+	LLVMValueRef source = LLVMBuildInBoundsGEP2(builder, text_type, text, indices, 2, "");
+	LLVMBuildMemCpy(builder, destination, 1, source, 1, count);
+	LLVMBuildStore(builder, LLVMBuildAdd(builder, offset, count, ""), length);
+	LLVMBuildRetVoid(builder);
+	return print;
+}
+
+static void LLVM_EmitRuntime(LLVM_Emitter* emitter) {
+	LLVMTypeRef buffer_type = LLVMArrayType(emitter->int_8_type, LLVM_OUTPUT_BUFFER_SIZE);
+	LLVMValueRef buffer = LLVMAddGlobal(emitter->module, buffer_type, "rift_output");
+	LLVMSetLinkage(buffer, LLVMInternalLinkage);
+	LLVMSetInitializer(buffer, LLVMConstNull(buffer_type));
+	
+	LLVMValueRef length = LLVMAddGlobal(emitter->module, emitter->int_64_type, "rift_output_length");
+	LLVMSetLinkage(length, LLVMInternalLinkage);
+	LLVMSetInitializer(length, LLVM_ConstI64(emitter, 0));
+	
+	emitter->flush_function = LLVM_EmitRuntimeFlush(emitter, buffer, length);
+	emitter->print_function = LLVM_EmitRuntimePrint(emitter, buffer, length);
+}
+
 //~ Init/Free
 
 #define INITIALIZE_TARGET(X) do { \
@@ -85,8 +464,9 @@ LLVMInitialize ## X ## Disassembler(); \
 LLVMInitialize ## X ## TargetMC(); \
 } while(0)
 
-void LLVM_Init(LLVM_Emitter* emitter) {
+void LLVM_Init(LLVM_Emitter* emitter, VM_ConstexprCache* constexprs) {
 	MemoryZeroStruct(emitter, LLVM_Emitter);
+	emitter->constexprs = constexprs;
 	
 	INITIALIZE_TARGET(X86);
 	
@@ -111,10 +491,9 @@ void LLVM_Init(LLVM_Emitter* emitter) {
 	emitter->int_8_type = LLVMInt8TypeInContext(emitter->context);
 	emitter->int_8_type_ptr = LLVMPointerType(emitter->int_8_type, 0);
 	emitter->int_32_type = LLVMInt32TypeInContext(emitter->context);
+	emitter->int_64_type = LLVMInt64TypeInContext(emitter->context);
 	
-	LLVMTypeRef printf_params[] = { emitter->int_8_type_ptr };
-	emitter->printf_type = LLVMFunctionType(emitter->int_32_type, printf_params, 1, true);
-	emitter->printf_object = LLVMAddFunction(emitter->module, "printf", emitter->printf_type);
+	LLVM_EmitRuntime(emitter);
 	
 	LLVMTypeRef main_function_type = LLVMFunctionType(emitter->int_32_type, nullptr, 0, false);
 	LLVMValueRef main_function = LLVMAddFunction(emitter->module, "main", main_function_type);
@@ -124,6 +503,7 @@ void LLVM_Init(LLVM_Emitter* emitter) {
 }
 
 void LLVM_Free(LLVM_Emitter* emitter) {
+	LLVMBuildCall2(emitter->builder, emitter->flush_type, emitter->flush_function, nullptr, 0, "");
 	LLVMBuildRet(emitter->builder, LLVMConstInt(emitter->int_32_type, 0, false));
 	
 	char* error = nullptr;
@@ -137,6 +517,8 @@ void LLVM_Free(LLVM_Emitter* emitter) {
 		LLVMDisposeErrorMessage(error);
 	}
 	
+	darray_free(LLVMValueRef, &emitter->locals);
+	
 	LLVMDisposeBuilder(emitter->builder);
 	LLVMDisposeModule(emitter->module);
 	LLVMContextDispose(emitter->context);
@@ -4,8 +4,11 @@
 #define LLVM_EMITTER_H
 
 #include "ast_nodes.h"
+#include "vm.h"
 #include "llvm-c/Core.h"
 
+DArray_Prototype(LLVMValueRef);
+
 #if 0
 typedef struct LLVMModuleRef LLVMModuleRef;
 typedef struct LLVMTypeRef LLVMTypeRef;
@@ -27,13 +30,23 @@ typedef struct LLVM_Emitter {
 	LLVMTypeRef int_8_type_ptr;
 	LLVMTypeRef int_32_type;
 	
-	LLVMTypeRef printf_type;
-	LLVMValueRef printf_object;
+	LLVMTypeRef int_64_type;
+	
+	// Runtime emitted into every module, see LLVM_EmitRuntime
+	LLVMTypeRef print_type;
+	LLVMValueRef print_function;
+	LLVMTypeRef flush_type;
+	LLVMValueRef flush_function;
+	
+	VM_ConstexprCache* constexprs;
+	
+	// Stack slots of variables and functions, indexed by the checker's C_SymbolID
+	darray(LLVMValueRef) locals;
 } LLVM_Emitter;
 
 LLVMValueRef LLVM_Emit(LLVM_Emitter* emitter, IR_Ast* ast);
 
-void LLVM_Init(LLVM_Emitter* emitter);
+void LLVM_Init(LLVM_Emitter* emitter, VM_ConstexprCache* constexprs);
 void LLVM_Free(LLVM_Emitter* emitter);
 
 #endif //LLVM_EMITTER_H
@@ -0,0 +1,642 @@
+#include "llvm_jit.h"
+
+#include <stdio.h>
+
+#include "llvm-c/Core.h"
+#include "llvm-c/Error.h"
+#include "llvm-c/Target.h"
+#include "llvm-c/LLJIT.h"
+#include "llvm-c/Transforms/InstCombine.h"
+#include "llvm-c/Transforms/Scalar.h"
+#include "llvm-c/Transforms/Utils.h"
+
+// One JIT for the process, created by whichever thread tiers up first
+typedef u32 LLVM_JitState;
+enum {
+	JitState_None,
+	JitState_Creating,
+	JitState_Ready,
+	JitState_Failed,
+};
+
+static LLVM_JitState llvm_jit_state;
+static LLVMOrcLLJITRef llvm_jit;
+static u32 llvm_jit_in_flight;
+static u32 llvm_jit_chunk_counter;
+static u32 llvm_jit_codegen_busy;
+
+static void LLVM_JitReportError(LLVMErrorRef error) {
+	char* message = LLVMGetErrorMessage(error);
+	fprintf(stderr, "JIT Error: %s\n", message);
+	LLVMDisposeErrorMessage(message);
+}
+
+static b8 LLVM_JitEnsureCreated(void) {
+	if (U_AtomicCasU32(&llvm_jit_state, JitState_None, JitState_Creating)) {
+		LLVMInitializeNativeTarget();
+		LLVMInitializeNativeAsmPrinter();
+		
+		LLVMErrorRef error = LLVMOrcCreateLLJIT(&llvm_jit, LLVMOrcCreateLLJITBuilder());
+		if (error) {
+			LLVM_JitReportError(error);
+			U_AtomicStoreU32(&llvm_jit_state, JitState_Failed);
+		} else {
+			U_AtomicStoreU32(&llvm_jit_state, JitState_Ready);
+		}
+	}
+	
+	LLVM_JitState state;
+	while ((state = U_AtomicLoadU32(&llvm_jit_state)) == JitState_Creating) U_ThreadYield();
+	return state == JitState_Ready;
+}
+
+//~ Bytecode to IR
+
+// Entry points the generated code calls. Their addresses are baked in as
+// constants, so nothing has to be exported from the executable
+static void LLVM_JitPrintInt(VM_Context* ctx, i32 value) {
+	VM_ContextPrint(ctx, (VM_RuntimeValue) { .type = RuntimeValueType_Integer, .as_int = value });
+}
+
+static void LLVM_JitFlush(VM_Context* ctx) {
+	VM_ContextFlush(ctx);
+}
+
+static void LLVM_JitDivisionError(VM_Context* ctx, i32 divisor) {
+	snprintf(ctx->error, sizeof(ctx->error), "%s", VM_DivisionError(divisor));
+}
+
+// Traces loop, so their registers live in stack slots that mem2reg turns back into SSA
+// values. A slot is created on the register's first use and loaded from the VM frame
+typedef struct LLVM_JitTraceFrame {
+	LLVMValueRef registers; // The VM_RuntimeValue* the recording was called with, as i32*
+	LLVMBuilderRef entry; // Appends to the entry block, which runs once per call
+	LLVMValueRef slots[VM_MAX_REGISTERS];
+	b8 checked[VM_MAX_REGISTERS]; // Read before being written, the entry checks it holds an int
+	b8 written[VM_MAX_REGISTERS]; // Stored back to the frame on the way out
+	
+	u32 ip; // Of the instruction being translated
+	LLVMBasicBlockRef exit;
+	LLVMValueRef exit_ip; // Phi of the ips the guards leave at
+} LLVM_JitTraceFrame;
+
+typedef struct LLVM_JitTranslator {
+	LLVMContextRef context;
+	LLVMBuilderRef builder;
+	LLVMTypeRef int_32_type;
+	LLVMTypeRef ctx_type;
+	LLVMTypeRef print_type;
+	LLVMValueRef print_function;
+	LLVMTypeRef flush_type;
+	LLVMValueRef flush_function;
+	LLVMTypeRef division_error_type;
+	LLVMValueRef division_error_function;
+	LLVMTypeRef int_ptr_type; // Pointer sized, for baking in addresses
+	LLVMValueRef ctx; // The VM_Context the native code was called with
+	
+	// Chunks are straight-line code, so a register is just its latest SSA value
+	LLVMValueRef registers[VM_MAX_REGISTERS];
+	VM_RuntimeValueType register_types[VM_MAX_REGISTERS];
+	
+	// Only set while translating a trace, its registers are all ints
+	LLVM_JitTraceFrame* frame;
+} LLVM_JitTranslator;
+
+// Field 0 (type) or 1 (as_int) of a register in the VM frame of a trace
+static LLVMValueRef LLVM_JitFrameField(LLVM_JitTranslator* t, LLVMBuilderRef builder, u32 reg, u32 field) {
+	LLVMValueRef index = LLVMConstInt(t->int_32_type, reg * 2 + field, false);
+	return LLVMBuildGEP2(builder, t->int_32_type, t->frame->registers, &index, 1, "");
+}
+
+static LLVMValueRef LLVM_JitTraceSlot(LLVM_JitTranslator* t, u32 reg, b8 reading) {
+	LLVM_JitTraceFrame* frame = t->frame;
+	if (!frame->slots[reg]) {
+		frame->slots[reg] = LLVMBuildAlloca(frame->entry, t->int_32_type, "");
+		LLVMValueRef value = LLVMBuildLoad2(frame->entry, t->int_32_type, LLVM_JitFrameField(t, frame->entry, reg, 1), "");
+		LLVMBuildStore(frame->entry, value, frame->slots[reg]);
+		frame->checked[reg] = reading;
+	}
+	return frame->slots[reg];
+}
+
+static LLVMValueRef LLVM_JitIntRegister(LLVM_JitTranslator* t, u32 reg) {
+	if (t->frame) return LLVMBuildLoad2(t->builder, t->int_32_type, LLVM_JitTraceSlot(t, reg, true), "");
+	return t->register_types[reg] == RuntimeValueType_Integer ? t->registers[reg] : nullptr;
+}
+
+static void LLVM_JitSetInt(LLVM_JitTranslator* t, u32 reg, LLVMValueRef value) {
+	if (t->frame) {
+		LLVMBuildStore(t->builder, value, LLVM_JitTraceSlot(t, reg, false));
+		t->frame->written[reg] = true;
+		return;
+	}
+	t->registers[reg] = value;
+	t->register_types[reg] = RuntimeValueType_Integer;
+}
+
+// Leaves the trace for the interpreter at ip unless ok holds
+static void LLVM_JitTraceGuard(LLVM_JitTranslator* t, LLVMValueRef ok, u32 ip) {
+	LLVMBasicBlockRef here = LLVMGetInsertBlock(t->builder);
+	LLVMBasicBlockRef next = LLVMAppendBasicBlockInContext(t->context, LLVMGetBasicBlockParent(here), "");
+	LLVMBuildCondBr(t->builder, ok, next, t->frame->exit);
+	LLVMValueRef resume = LLVMConstInt(t->int_32_type, ip, false);
+	LLVMAddIncoming(t->frame->exit_ip, &resume, &here, 1);
+	LLVMPositionBuilderAtEnd(t->builder, next);
+}
+
+static void LLVM_JitStoreResult(LLVM_JitTranslator* t, LLVMValueRef result_ptr, VM_RuntimeValueType type, LLVMValueRef value) {
+	// VM_RuntimeValue is { u32 type; i32 as_int; }
+	LLVMValueRef type_index = LLVMConstInt(t->int_32_type, 0, false);
+	LLVMValueRef value_index = LLVMConstInt(t->int_32_type, 1, false);
+	LLVMValueRef type_slot = LLVMBuildGEP2(t->builder, t->int_32_type, result_ptr, &type_index, 1, "");
+	LLVMValueRef value_slot = LLVMBuildGEP2(t->builder, t->int_32_type, result_ptr, &value_index, 1, "");
+	LLVMBuildStore(t->builder, LLVMConstInt(t->int_32_type, type, false), type_slot);
+	LLVMBuildStore(t->builder, value, value_slot);
+}
+
+static void LLVM_JitBuildPrint(LLVM_JitTranslator* t, LLVMValueRef value) {
+	LLVMValueRef args[] = { t->ctx, value };
+	LLVMBuildCall2(t->builder, t->print_type, t->print_function, args, 2, "");
+}
+
+static LLVMValueRef LLVM_JitAddress(LLVM_JitTranslator* t, void* address, LLVMTypeRef function_type) {
+	return LLVMConstIntToPtr(LLVMConstInt(t->int_ptr_type, (u64)(uintptr_t) address, false),
+							 LLVMPointerType(function_type, 0));
+}
+
+// The binding is already resolved, so a native is a direct call to its address
+static b8 LLVM_JitBuildCallNative(LLVM_JitTranslator* t, IR_Chunk* chunk, u32 window, u32 index) {
+	VM_Native* native = &chunk->natives.elems[index];
+	void* address = chunk->native_bindings[index].address;
+	if (!address) return false;
+	
+	LLVMTypeRef params[TYPE_MAX_NATIVE_PARAMS];
+	LLVMValueRef args[TYPE_MAX_NATIVE_PARAMS];
+	for (u32 k = 0; k < native->param_count; k++) {
+		if (!(args[k] = LLVM_JitIntRegister(t, window + k))) return false;
+		params[k] = t->int_32_type;
+	}
+	
+	LLVMValueRef ctx_arg[] = { t->ctx };
+	LLVMBuildCall2(t->builder, t->flush_type, t->flush_function, ctx_arg, 1, "");
+	LLVMTypeRef return_type = native->has_result ? t->int_32_type : LLVMVoidTypeInContext(t->context);
+	LLVMTypeRef type = LLVMFunctionType(return_type, params, native->param_count, false);
+	LLVMValueRef result = LLVMBuildCall2(t->builder, type, LLVM_JitAddress(t, address, type), args, native->param_count, "");
+	LLVM_JitSetInt(t, window, native->has_result ? result : LLVMConstInt(t->int_32_type, 0, false));
+	return true;
+}
+
+// Chunks are straight-line, so where the interpreter would stop with an error the
+// native code stops too. Whatever it printed before is in the output either way
+static void LLVM_JitChunkGuard(LLVM_JitTranslator* t, LLVMValueRef ok, LLVMValueRef divisor) {
+	LLVMBasicBlockRef here = LLVMGetInsertBlock(t->builder);
+	LLVMValueRef function = LLVMGetBasicBlockParent(here);
+	LLVMBasicBlockRef fail = LLVMAppendBasicBlockInContext(t->context, function, "");
+	LLVMBasicBlockRef next = LLVMAppendBasicBlockInContext(t->context, function, "");
+	LLVMBuildCondBr(t->builder, ok, next, fail);
+	
+	LLVMPositionBuilderAtEnd(t->builder, fail);
+	LLVMValueRef args[] = { t->ctx, divisor };
+	LLVMBuildCall2(t->builder, t->division_error_type, t->division_error_function, args, 2, "");
+	LLVMBuildRet(t->builder, LLVMConstInt(t->int_32_type, RunStatus_Error, false));
+	LLVMPositionBuilderAtEnd(t->builder, next);
+}
+
+// Integer x op y, null for operators the VM doesn't have. Trapping division never reaches sdiv or srem
+static LLVMValueRef LLVM_JitBuildBinary(LLVM_JitTranslator* t, L_TokenType op, LLVMValueRef x, LLVMValueRef y) {
+	if (op == TokenType_Slash || op == TokenType_Percent) {
+		LLVMValueRef nonzero = LLVMBuildICmp(t->builder, LLVMIntNE, y, LLVMConstInt(t->int_32_type, 0, false), "");
+		LLVMValueRef min = LLVMBuildICmp(t->builder, LLVMIntEQ, x, LLVMConstInt(t->int_32_type, (u32) i32_min, true), "");
+		LLVMValueRef minus_one = LLVMBuildICmp(t->builder, LLVMIntEQ, y, LLVMConstInt(t->int_32_type, (u64) -1, true), "");
+		LLVMValueRef overflow = LLVMBuildAnd(t->builder, min, minus_one, "");
+		LLVMValueRef ok = LLVMBuildAnd(t->builder, nonzero, LLVMBuildNot(t->builder, overflow, ""), "");
+		if (t->frame) LLVM_JitTraceGuard(t, ok, t->frame->ip);
+		else LLVM_JitChunkGuard(t, ok, y);
+	}
+	
+	LLVMIntPredicate predicate;
+	switch (op) {
+		case TokenType_Plus: return LLVMBuildAdd(t->builder, x, y, "");
+		case TokenType_Minus: return LLVMBuildSub(t->builder, x, y, "");
+		case TokenType_Star: return LLVMBuildMul(t->builder, x, y, "");
+		case TokenType_Slash: return LLVMBuildSDiv(t->builder, x, y, "");
+		case TokenType_Percent: return LLVMBuildSRem(t->builder, x, y, "");
+		case TokenType_Less: predicate = LLVMIntSLT; break;
+		case TokenType_Greater: predicate = LLVMIntSGT; break;
+		case TokenType_LessEqual: predicate = LLVMIntSLE; break;
+		case TokenType_GreaterEqual: predicate = LLVMIntSGE; break;
+		case TokenType_EqualEqual: predicate = LLVMIntEQ; break;
+		case TokenType_BangEqual: predicate = LLVMIntNE; break;
+		default: return nullptr;
+	}
+	return LLVMBuildZExt(t->builder, LLVMBuildICmp(t->builder, predicate, x, y, ""), t->int_32_type, "");
+}
+
+// Operator of a typed binary op, TokenType_Error for everything else
+static L_TokenType LLVM_JitTypedOperator(VM_Opcode op) {
+	switch (op) {
+		case Opcode_AddI32: case Opcode_AddPrintI32: return TokenType_Plus;
+		case Opcode_SubI32: return TokenType_Minus;
+		case Opcode_MulI32: return TokenType_Star;
+		case Opcode_DivI32: return TokenType_Slash;
+		case Opcode_ModI32: return TokenType_Percent;
+		case Opcode_LtI32: return TokenType_Less;
+		case Opcode_LeI32: return TokenType_LessEqual;
+		case Opcode_EqI32: return TokenType_EqualEqual;
+		case Opcode_NeI32: return TokenType_BangEqual;
+	}
+	return TokenType_Error;
+}
+
+// Everything that doesn't change control flow, shared by chunks and traces. Steps *ip
+// over the operand word if there is one. Returns false for anything the JIT doesn't handle
+static b8 LLVM_JitTranslateOp(LLVM_JitTranslator* t, IR_Chunk* chunk, u32* ip) {
+	u32* code = chunk->code.elems;
+	u32 word = code[*ip];
+	u32 a = VM_DecodeA(word), b = VM_DecodeB(word), c = VM_DecodeC(word);
+	LLVMValueRef x, y;
+	
+	switch (VM_DecodeOp(word)) {
+		case Opcode_Nop: break;
+		
+		case Opcode_LoadConst:
+		case Opcode_LoadConstWide: {
+			u32 index = VM_DecodeOp(word) == Opcode_LoadConst ? VM_DecodeBx(word) : code[++*ip];
+			VM_RuntimeValue value = chunk->constants.elems[index];
+			if (value.type != RuntimeValueType_Integer) return false;
+			LLVM_JitSetInt(t, a, LLVMConstInt(t->int_32_type, (u32) value.as_int, true));
+		} break;
+		
+		case Opcode_LoadSmallInt: {
+			LLVM_JitSetInt(t, a, LLVMConstInt(t->int_32_type, (u32) VM_DecodeSBx(word), true));
+		} break;
+		
+		case Opcode_Move: {
+			if (t->frame) {
+				LLVM_JitSetInt(t, a, LLVM_JitIntRegister(t, b));
+			} else {
+				t->registers[a] = t->registers[b];
+				t->register_types[a] = t->register_types[b];
+			}
+		} break;
+		
+		// Register types are known (chunks) or checked on entry (traces), so generic
+		// and quickened ops need no guard
+		case Opcode_UnaryOp: {
+			if (!(x = LLVM_JitIntRegister(t, b))) return false;
+			L_TokenType op = (L_TokenType) code[++*ip];
+			if (op == TokenType_Minus) x = LLVMBuildNeg(t->builder, x, "");
+			else if (op != TokenType_Plus) return false;
+			LLVM_JitSetInt(t, a, x);
+		} break;
+		
+		case Opcode_BinaryOp:
+		case Opcode_AddI32Quick:
+		case Opcode_SubI32Quick:
+		case Opcode_MulI32Quick:
+		case Opcode_DivI32Quick:
+		case Opcode_ModI32Quick: {
+			if (!(x = LLVM_JitIntRegister(t, b)) || !(y = LLVM_JitIntRegister(t, c))) return false;
+			LLVMValueRef r = LLVM_JitBuildBinary(t, VM_QuickenToken(code[++*ip]), x, y);
+			if (!r) return false;
+			LLVM_JitSetInt(t, a, r);
+		} break;
+		
+		case Opcode_AddI32:
+		case Opcode_SubI32:
+		case Opcode_MulI32:
+		case Opcode_DivI32:
+		case Opcode_ModI32:
+		case Opcode_LtI32:
+		case Opcode_LeI32:
+		case Opcode_EqI32:
+		case Opcode_NeI32:
+		case Opcode_AddPrintI32: {
+			if (!(x = LLVM_JitIntRegister(t, b)) || !(y = LLVM_JitIntRegister(t, c))) return false;
+			LLVMValueRef r = LLVM_JitBuildBinary(t, LLVM_JitTypedOperator(VM_DecodeOp(word)), x, y);
+			LLVM_JitSetInt(t, a, r);
+			if (VM_DecodeOp(word) == Opcode_AddPrintI32)
+				LLVM_JitBuildPrint(t, r);
+		} break;
+		
+		case Opcode_NegI32: {
+			if (!(x = LLVM_JitIntRegister(t, b))) return false;
+			LLVM_JitSetInt(t, a, LLVMBuildNeg(t->builder, x, ""));
+		} break;
+		
+		case Opcode_AddI32K: {
+			if (!(x = LLVM_JitIntRegister(t, b))) return false;
+			LLVM_JitSetInt(t, a, LLVMBuildAdd(t->builder, x, LLVMConstInt(t->int_32_type, (u32)(i8) c, true), ""));
+		} break;
+		
+		case Opcode_MulAddI32: {
+			LLVMValueRef addend;
+			if (!(x = LLVM_JitIntRegister(t, b)) || !(y = LLVM_JitIntRegister(t, c))) return false;
+			if (!(addend = LLVM_JitIntRegister(t, code[++*ip]))) return false;
+			LLVMValueRef product = LLVMBuildMul(t->builder, x, y, "");
+			LLVM_JitSetInt(t, a, LLVMBuildAdd(t->builder, addend, product, ""));
+		} break;
+		
+		case Opcode_Print: {
+			if (!(x = LLVM_JitIntRegister(t, a))) return false;
+			LLVM_JitBuildPrint(t, x);
+		} break;
+		
+		case Opcode_CallNative: {
+			if (!LLVM_JitBuildCallNative(t, chunk, a, VM_DecodeBx(word))) return false;
+		} break;
+		
+		default: return false;
+	}
+	return true;
+}
+
+// Chunks only compile while they are straight-line code, loops get traced instead
+static b8 LLVM_JitTranslate(LLVM_JitTranslator* t, IR_Chunk* chunk, LLVMValueRef result_ptr) {
+	u32* code = chunk->code.elems;
+	
+	for (u32 i = 0; i < chunk->code.len; i++) {
+		u32 word = code[i];
+		LLVMValueRef x;
+		
+		switch (VM_DecodeOp(word)) {
+			case Opcode_Return: {
+				if (!(x = LLVM_JitIntRegister(t, VM_DecodeA(word)))) return false;
+				LLVM_JitStoreResult(t, result_ptr, RuntimeValueType_Integer, x);
+				LLVMBuildRet(t->builder, LLVMConstInt(t->int_32_type, RunStatus_Done, false));
+			} return true;
+			
+			case Opcode_Halt: {
+				LLVM_JitStoreResult(t, result_ptr, RuntimeValueType_Invalid, LLVMConstInt(t->int_32_type, 0, false));
+				LLVMBuildRet(t->builder, LLVMConstInt(t->int_32_type, RunStatus_Done, false));
+			} return true;
+			
+			default: {
+				if (!LLVM_JitTranslateOp(t, chunk, &i)) return false;
+			} break;
+		}
+	}
+	return false;
+}
+
+// The recorded path becomes one block that branches back to itself. Every branch turns
+// into a guard that leaves where the interpreter would have gone the other way
+static b8 LLVM_JitTranslateTrace(LLVM_JitTranslator* t, IR_Chunk* chunk, VM_Trace* recording, LLVMBasicBlockRef body) {
+	u32* code = chunk->code.elems;
+	
+	for (u32 s = 0; s < recording->step_count; s++) {
+		VM_TraceStep* step = &recording->steps[s];
+		u32 i = step->ip;
+		u32 word = code[i];
+		t->frame->ip = i;
+		
+		switch (VM_DecodeOp(word)) {
+			case Opcode_Jump: break;
+			
+			case Opcode_JumpIfFalse: {
+				u32 target = code[i + 1];
+				if (target == i + 2) break;
+				b8 taken = step->next == target;
+				LLVMValueRef x = LLVM_JitIntRegister(t, VM_DecodeA(word));
+				LLVMValueRef ok = LLVMBuildICmp(t->builder, taken ? LLVMIntEQ : LLVMIntNE, x,
+												LLVMConstInt(t->int_32_type, 0, false), "");
+				LLVM_JitTraceGuard(t, ok, taken ? i + 2 : target);
+			} break;
+			
+			default: {
+				if (!LLVM_JitTranslateOp(t, chunk, &i)) return false;
+			} break;
+		}
+	}
+	LLVMBuildBr(t->builder, body);
+	return true;
+}
+
+//~ Compilation
+
+// A context per compile, contexts can't be shared between threads
+static LLVMModuleRef LLVM_JitBeginModule(LLVM_JitTranslator* t, LLVMOrcThreadSafeContextRef ts_context, const char* name) {
+	t->context = LLVMOrcThreadSafeContextGetContext(ts_context);
+	t->builder = LLVMCreateBuilderInContext(t->context);
+	t->int_32_type = LLVMInt32TypeInContext(t->context);
+	t->int_ptr_type = LLVMIntTypeInContext(t->context, sizeof(void*) * 8);
+	// The context is opaque to the generated code
+	t->ctx_type = LLVMPointerType(LLVMInt8TypeInContext(t->context), 0);
+	
+	LLVMTypeRef print_params[] = { t->ctx_type, t->int_32_type };
+	t->print_type = LLVMFunctionType(LLVMVoidTypeInContext(t->context), print_params, 2, false);
+	t->print_function = LLVM_JitAddress(t, (void*) &LLVM_JitPrintInt, t->print_type);
+	t->flush_type = LLVMFunctionType(LLVMVoidTypeInContext(t->context), &t->ctx_type, 1, false);
+	t->flush_function = LLVM_JitAddress(t, (void*) &LLVM_JitFlush, t->flush_type);
+	t->division_error_type = LLVMFunctionType(LLVMVoidTypeInContext(t->context), print_params, 2, false);
+	t->division_error_function = LLVM_JitAddress(t, (void*) &LLVM_JitDivisionError, t->division_error_type);
+	return LLVMModuleCreateWithNameInContext(name, t->context);
+}
+
+// Hands the module to the JIT and looks up name in it, 0 if that failed
+static LLVMOrcExecutorAddress LLVM_JitFinishModule(LLVMModuleRef module, LLVMOrcThreadSafeContextRef ts_context, const char* name) {
+	// The JIT owns the module from here on
+	LLVMOrcThreadSafeModuleRef ts_module = LLVMOrcCreateNewThreadSafeModule(module, ts_context);
+	LLVMOrcDisposeThreadSafeContext(ts_context);
+	
+	LLVMErrorRef error = LLVMOrcLLJITAddLLVMIRModule(llvm_jit, LLVMOrcLLJITGetMainJITDylib(llvm_jit), ts_module);
+	if (error) {
+		LLVM_JitReportError(error);
+		LLVMOrcDisposeThreadSafeModule(ts_module);
+		return 0;
+	}
+	
+	// LLJIT's one TargetMachine doesn't survive two compiles at once, so lookups take turns
+	while (!U_AtomicCasU32(&llvm_jit_codegen_busy, 0, 1)) U_ThreadYield();
+	LLVMOrcExecutorAddress address = 0;
+	error = LLVMOrcLLJITLookup(llvm_jit, &address, name);
+	U_AtomicStoreU32(&llvm_jit_codegen_busy, 0);
+	if (error) {
+		LLVM_JitReportError(error);
+		return 0;
+	}
+	return address;
+}
+
+static VM_NativeChunk* LLVM_JitCompile(IR_Chunk* chunk) {
+	char name[32];
+	snprintf(name, sizeof(name), "rift_chunk_%u", U_AtomicAddU32(&llvm_jit_chunk_counter, 1));
+	
+	LLVMOrcThreadSafeContextRef ts_context = LLVMOrcCreateNewThreadSafeContext();
+	LLVM_JitTranslator translator = {0};
+	LLVMModuleRef module = LLVM_JitBeginModule(&translator, ts_context, name);
+	
+	// VM_RunStatus (VM_Context* ctx, VM_RuntimeValue* result)
+	LLVMTypeRef params[] = { translator.ctx_type, LLVMPointerType(translator.int_32_type, 0) };
+	LLVMTypeRef function_type = LLVMFunctionType(translator.int_32_type, params, 2, false);
+	LLVMValueRef function = LLVMAddFunction(module, name, function_type);
+	LLVMPositionBuilderAtEnd(translator.builder, LLVMAppendBasicBlockInContext(translator.context, function, "entry"));
+	translator.ctx = LLVMGetParam(function, 0);
+	
+	b8 translated = LLVM_JitTranslate(&translator, chunk, LLVMGetParam(function, 1));
+	LLVMDisposeBuilder(translator.builder);
+	if (!translated) {
+		LLVMDisposeModule(module);
+		LLVMOrcDisposeThreadSafeContext(ts_context);
+		return nullptr;
+	}
+	return (VM_NativeChunk*)(uintptr_t) LLVM_JitFinishModule(module, ts_context, name);
+}
+
+// The slots have to become SSA values for anything else to see through the loop.
+// LICM then hoists whatever the iteration recomputes from values it doesn't change
+static void LLVM_JitOptimizeTrace(LLVMModuleRef module) {
+	LLVMPassManagerRef passes = LLVMCreatePassManager();
+	LLVMAddPromoteMemoryToRegisterPass(passes);
+	LLVMAddInstructionCombiningPass(passes);
+	LLVMAddCFGSimplificationPass(passes);
+	LLVMAddLICMPass(passes);
+	LLVMAddGVNPass(passes);
+	LLVMAddCFGSimplificationPass(passes);
+	LLVMRunPassManager(passes, module);
+	LLVMDisposePassManager(passes);
+}
+
+static VM_NativeTrace* LLVM_JitCompileTrace(IR_Chunk* chunk, VM_Trace* recording) {
+	char name[32];
+	snprintf(name, sizeof(name), "rift_trace_%u", U_AtomicAddU32(&llvm_jit_chunk_counter, 1));
+	
+	LLVMOrcThreadSafeContextRef ts_context = LLVMOrcCreateNewThreadSafeContext();
+	LLVM_JitTranslator translator = {0};
+	LLVM_JitTranslator* t = &translator;
+	LLVMModuleRef module = LLVM_JitBeginModule(t, ts_context, name);
+	
+	// u32 (VM_Context* ctx, VM_RuntimeValue* registers)
+	LLVMTypeRef params[] = { t->ctx_type, LLVMPointerType(t->int_32_type, 0) };
+	LLVMTypeRef function_type = LLVMFunctionType(t->int_32_type, params, 2, false);
+	LLVMValueRef function = LLVMAddFunction(module, name, function_type);
+	t->ctx = LLVMGetParam(function, 0);
+	
+	LLVM_JitTraceFrame frame = {0};
+	frame.registers = LLVMGetParam(function, 1);
+	LLVMBasicBlockRef entry = LLVMAppendBasicBlockInContext(t->context, function, "entry");
+	LLVMBasicBlockRef body = LLVMAppendBasicBlockInContext(t->context, function, "loop");
+	frame.exit = LLVMAppendBasicBlockInContext(t->context, function, "exit");
+	frame.entry = LLVMCreateBuilderInContext(t->context);
+	LLVMPositionBuilderAtEnd(frame.entry, entry);
+	LLVMPositionBuilderAtEnd(t->builder, frame.exit);
+	frame.exit_ip = LLVMBuildPhi(t->builder, t->int_32_type, "");
+	t->frame = &frame;
+	
+	LLVMPositionBuilderAtEnd(t->builder, body);
+	b8 translated = LLVM_JitTranslateTrace(t, chunk, recording, body);
+	if (translated) {
+		LLVMValueRef integer = LLVMConstInt(t->int_32_type, RuntimeValueType_Integer, false);
+		
+		// Registers the interpreter reads after us, their types could have been anything before
+		LLVMPositionBuilderAtEnd(t->builder, frame.exit);
+		for (u32 reg = 0; reg < VM_MAX_REGISTERS; reg++) {
+			if (!frame.written[reg]) continue;
+			LLVMValueRef value = LLVMBuildLoad2(t->builder, t->int_32_type, frame.slots[reg], "");
+			LLVMBuildStore(t->builder, integer, LLVM_JitFrameField(t, t->builder, reg, 0));
+			LLVMBuildStore(t->builder, value, LLVM_JitFrameField(t, t->builder, reg, 1));
+		}
+		LLVMBuildRet(t->builder, frame.exit_ip);
+		
+		// The trace assumed ints wherever it read, anything else and the interpreter
+		// runs this iteration itself. Nothing was written back yet
+		LLVMValueRef ok = LLVMConstInt(LLVMInt1TypeInContext(t->context), 1, false);
+		for (u32 reg = 0; reg < VM_MAX_REGISTERS; reg++) {
+			if (!frame.checked[reg]) continue;
+			LLVMValueRef type = LLVMBuildLoad2(frame.entry, t->int_32_type, LLVM_JitFrameField(t, frame.entry, reg, 0), "");
+			ok = LLVMBuildAnd(frame.entry, ok, LLVMBuildICmp(frame.entry, LLVMIntEQ, type, integer, ""), "");
+		}
+		LLVMBasicBlockRef bail = LLVMAppendBasicBlockInContext(t->context, function, "bail");
+		LLVMBuildCondBr(frame.entry, ok, body, bail);
+		LLVMPositionBuilderAtEnd(t->builder, bail);
+		LLVMBuildRet(t->builder, LLVMConstInt(t->int_32_type, recording->header, false));
+	}
+	LLVMDisposeBuilder(frame.entry);
+	LLVMDisposeBuilder(t->builder);
+	
+	if (!translated) {
+		LLVMDisposeModule(module);
+		LLVMOrcDisposeThreadSafeContext(ts_context);
+		return nullptr;
+	}
+	LLVM_JitOptimizeTrace(module);
+	return (VM_NativeTrace*)(uintptr_t) LLVM_JitFinishModule(module, ts_context, name);
+}
+
+//~ Background compilation
+
+static void LLVM_JitCompileThread(void* arg) {
+	IR_Chunk* chunk = arg;
+	VM_NativeChunk* native = LLVM_JitCompile(chunk);
+	
+	if (native) {
+		U_AtomicStorePtr(&chunk->native, native);
+		U_AtomicStoreU32(&chunk->tier_state, TierState_Native);
+	} else {
+		U_AtomicStoreU32(&chunk->tier_state, TierState_Failed);
+	}
+	U_AtomicAddU32(&llvm_jit_in_flight, -1);
+}
+
+void LLVM_JitCompileAsync(IR_Chunk* chunk) {
+	if (!LLVM_JitEnsureCreated()) {
+		U_AtomicStoreU32(&chunk->tier_state, TierState_Failed);
+		return;
+	}
+	
+	U_AtomicAddU32(&llvm_jit_in_flight, 1);
+	if (!U_ThreadStartDetached(LLVM_JitCompileThread, chunk)) {
+		U_AtomicAddU32(&llvm_jit_in_flight, -1);
+		U_AtomicStoreU32(&chunk->tier_state, TierState_Failed);
+	}
+}
+
+typedef struct LLVM_JitTraceJob {
+	IR_Chunk* chunk;
+	VM_Loop* loop;
+	VM_Trace* recording;
+} LLVM_JitTraceJob;
+
+static void LLVM_JitCompileTraceThread(void* arg) {
+	LLVM_JitTraceJob* job = arg;
+	VM_NativeTrace* native = LLVM_JitCompileTrace(job->chunk, job->recording);
+	
+	if (native) {
+		U_AtomicStorePtr(&job->loop->native, native);
+		U_AtomicStoreU32(&job->loop->tier_state, TierState_Native);
+	} else {
+		U_AtomicStoreU32(&job->loop->tier_state, TierState_Failed);
+	}
+	free(job->recording);
+	free(job);
+	U_AtomicAddU32(&llvm_jit_in_flight, -1);
+}
+
+void LLVM_JitCompileTraceAsync(IR_Chunk* chunk, VM_Loop* loop, VM_Trace* recording) {
+	if (!LLVM_JitEnsureCreated()) {
+		free(recording);
+		U_AtomicStoreU32(&loop->tier_state, TierState_Failed);
+		return;
+	}
+	
+	LLVM_JitTraceJob* job = malloc(sizeof(LLVM_JitTraceJob));
+	*job = (LLVM_JitTraceJob) { chunk, loop, recording };
+	U_AtomicAddU32(&llvm_jit_in_flight, 1);
+	if (!U_ThreadStartDetached(LLVM_JitCompileTraceThread, job)) {
+		U_AtomicAddU32(&llvm_jit_in_flight, -1);
+		free(recording);
+		free(job);
+		U_AtomicStoreU32(&loop->tier_state, TierState_Failed);
+	}
+}
+
+void LLVM_JitShutdown(void) {
+	while (U_AtomicLoadU32(&llvm_jit_in_flight) != 0) U_ThreadYield();
+	
+	if (U_AtomicLoadU32(&llvm_jit_state) == JitState_Ready) {
+		LLVMErrorRef error = LLVMOrcDisposeLLJIT(llvm_jit);
+		if (error) LLVM_JitReportError(error);
+		llvm_jit = nullptr;
+		U_AtomicStoreU32(&llvm_jit_state, JitState_None);
+	}
+}
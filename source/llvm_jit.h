@@ -0,0 +1,19 @@
+/* date = October 19th 2026 3:10 pm */
+
+#ifndef LLVM_JIT_H
+#define LLVM_JIT_H
+
+#include "vm.h"
+
+// Called with chunk->tier_state at TierState_Compiling. Compiles on a background thread and
+// publishes chunk->native, or marks the chunk TierState_Failed
+void LLVM_JitCompileAsync(IR_Chunk* chunk);
+
+// Same for one loop, with loop->tier_state in TierState_Compiling. Compiles the recorded
+// iteration into a VM_NativeTrace and publishes loop->native. Takes ownership of the recording
+void LLVM_JitCompileTraceAsync(IR_Chunk* chunk, VM_Loop* loop, VM_Trace* recording);
+
+// Waits for compiles in flight and frees the JIT, native chunks are dead after this
+void LLVM_JitShutdown(void);
+
+#endif //LLVM_JIT_H
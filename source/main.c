@@ -8,6 +8,7 @@
 #include "checker.h"
 #include "vm.h"
 #include "llvm_emitter.h"
+#include "llvm_jit.h"
 
 static char* readFile(const char* path) {
     FILE* file = fopen(path, "rb");
@@ -24,15 +25,482 @@ static char* readFile(const char* path) {
     return buffer;
 }
 
+typedef struct Options {
+	const char* filename;
+	// "Rift run file.rf" interprets the program with the VM instead of emitting LLVM IR.
+	// "Rift run file.rbc" maps precompiled bytecode and runs it without any frontend work
+	b8 run;
+	// Writes the lowered program next to the source as .rbc instead of emitting LLVM IR
+	b8 emit_bytecode;
+	b8 stats_alloc;
+	b8 stats_checker;
+	b8 stats_vm;
+	b8 stats_vm_json;
+	// With run, executes the program BENCH_THREAD_RUNS times on 1, 2, 4.. cores instead
+	b8 bench_threads;
+	// With run, times BENCH_RUN_RUNS interpreted runs of the program instead of running it once
+	b8 bench_run;
+	// With run, interleaves BENCH_RESUME_SCRIPTS continuations of the program with a few fuel budgets
+	b8 bench_resume;
+	// Checks the program BENCH_CHECKER_RUNS times instead of emitting anything
+	b8 bench_checker;
+	// With run, collects the heap at every suspension of HEAP_CHECK_SCRIPTS continuations and checks what survived
+	b8 bench_heap;
+	// --native-lib=path, searched for #native functions after the executable
+	const char* native_libs[VM_MAX_NATIVE_LIBRARIES];
+	u32 native_lib_count;
+} Options;
+
+static b8 hasExtension(const char* path, const char* extension) {
+	const char* dot = strrchr(path, '.');
+	return dot && strcmp(dot, extension) == 0;
+}
+
+static void writeBytecode(IR_Chunk* chunk, const char* source_path) {
+	const char* dot = strrchr(source_path, '.');
+	size_t stem = dot ? (size_t)(dot - source_path) : strlen(source_path);
+	char* path = malloc(stem + sizeof(".rbc"));
+	memcpy(path, source_path, stem);
+	memcpy(path + stem, ".rbc", sizeof(".rbc"));
+	
+	if (!VM_WriteChunkFile(chunk, path)) printf("Could not write %s\n", path);
+	free(path);
+}
+
+// Returns false if the run stopped on a runtime error
+static b8 runChunk(VM_Context* ctx, IR_Chunk* chunk) {
+	VM_RuntimeValue result;
+	VM_RunStatus status = VM_RunExprChunk(ctx, chunk, &result);
+	// Whatever got printed before the error comes first
+	VM_ContextFlush(ctx);
+	if (status == RunStatus_Error) fprintf(stderr, "VM error: %s\n", ctx->error);
+	return status != RunStatus_Error;
+}
+
+static b8 runBytecode(VM_Context* ctx, const char* path) {
+	U_MappedFile file;
+	if (!U_MapFile(path, &file)) {
+		printf("Could not open %s\n", path);
+		return false;
+	}
+	
+	IR_Chunk chunk;
+	b8 ok = false;
+	if (VM_LoadChunkFile(&file, &chunk)) {
+		ok = runChunk(ctx, &chunk);
+		IR_ChunkFree(&chunk);
+	} else {
+		printf("%s is not a valid bytecode file for this version\n", path);
+	}
+	U_UnmapFile(&file);
+	return ok;
+}
+
+//~ Thread scaling benchmark
+
+#define BENCH_THREAD_RUNS 1000000
+
+typedef struct BenchWorker {
+	IR_Chunk* chunk;
+	u32 runs;
+	u64 printed;
+} BenchWorker;
+
+static void countOutput(void* user_data, VM_RuntimeValue value) {
+	(void) value;
+	(*(u64*) user_data)++;
+}
+
+static void benchWorker(void* arg) {
+	BenchWorker* worker = arg;
+	VM_Context ctx;
+	VM_ContextInit(&ctx);
+	ctx.output = countOutput;
+	ctx.output_data = &worker->printed;
+	VM_RuntimeValue result;
+	for (u32 i = 0; i < worker->runs; i++) VM_RunExprChunk(&ctx, worker->chunk, &result);
+	VM_ContextFree(&ctx);
+}
+
+static void benchThreads(IR_Chunk* chunk) {
+	// Measures the interpreter, native chunks would hide it
+	VM_SetTierUpThreshold(0);
+	
+	u32 cores = U_GetCoreCount();
+	U_Thread* threads = malloc(sizeof(U_Thread) * cores);
+	BenchWorker* workers = malloc(sizeof(BenchWorker) * cores);
+	f64 single = 0;
+	
+	printf("%d runs, %u cores\n%8s %10s %14s %8s\n", BENCH_THREAD_RUNS, cores, "Threads", "ms", "Runs/s", "Speedup");
+	for (u32 count = 1;; count *= 2) {
+		if (count > cores) count = cores;
+		
+		u64 start = U_GetTimeNs();
+		for (u32 t = 0; t < count; t++) {
+			workers[t] = (BenchWorker) { chunk, BENCH_THREAD_RUNS / count, 0 };
+			if (t == 0) workers[t].runs += BENCH_THREAD_RUNS % count;
+			U_ThreadStart(&threads[t], benchWorker, &workers[t]);
+		}
+		for (u32 t = 0; t < count; t++) U_ThreadJoin(&threads[t]);
+		f64 seconds = (U_GetTimeNs() - start) / 1e9;
+		
+		if (count == 1) single = seconds;
+		printf("%8u %10.2f %14.0f %7.2fx\n", count, seconds * 1e3, BENCH_THREAD_RUNS / seconds, single / seconds);
+		if (count == cores) break;
+	}
+	
+	free(workers);
+	free(threads);
+}
+
+//~ Interpreter benchmark
+
+#define BENCH_RUN_RUNS 2000
+
+static int compareTimes(const void* a, const void* b) {
+	u64 x = *(const u64*) a, y = *(const u64*) b;
+	return (x > y) - (x < y);
+}
+
+// Everything a run on ctx can grow
+static u64 contextFootprint(VM_Context* ctx) {
+	return (u64) ctx->stack.cap * sizeof(VM_RuntimeValue) + (u64) ctx->stack.frame_cap * sizeof(VM_CallFrame) +
+		ctx->scratch->commit_position;
+}
+
+static void benchRun(IR_Chunk* chunk) {
+	// Native chunks and traces would hide the interpreter
+	VM_SetTierUpThreshold(0);
+	VM_SetHotLoopThreshold(0);
+	
+	u64 printed = 0;
+	VM_Context ctx;
+	VM_ContextInit(&ctx);
+	ctx.output = countOutput;
+	ctx.output_data = &printed;
+	
+	// Resuming with one fuel at a time counts the instructions a run executes
+	VM_Continuation cont;
+	VM_ContinuationInit(&cont, chunk);
+	u64 instructions = 1;
+	while (VM_Resume(&ctx, &cont, 1) == RunStatus_Suspended) instructions++;
+	VM_ContinuationFree(&cont);
+	
+	if (cont.status == RunStatus_Error) {
+		printf("VM error: %s\n", ctx.error);
+	} else {
+		// The first run sizes the context, the timed ones shouldn't allocate at all
+		VM_RuntimeValue result;
+		VM_RunExprChunk(&ctx, chunk, &result);
+		u64 footprint = contextFootprint(&ctx);
+		
+		u64* times = malloc(sizeof(u64) * BENCH_RUN_RUNS);
+		for (u32 i = 0; i < BENCH_RUN_RUNS; i++) {
+			u64 start = U_GetTimeNs();
+			VM_RunExprChunk(&ctx, chunk, &result);
+			times[i] = U_GetTimeNs() - start;
+		}
+		// Best is the number to compare, the gap to the median shows how noisy the machine is
+		qsort(times, BENCH_RUN_RUNS, sizeof(u64), compareTimes);
+		u64 best = times[0];
+		u64 median = times[BENCH_RUN_RUNS / 2];
+		free(times);
+		
+		printf("chunk: %u instructions, %llu bytes of code, %u constants (%llu bytes)\n", chunk->code.len,
+			   (u64) chunk->code.len * sizeof(u32), chunk->constants.len, (u64) chunk->constants.len * sizeof(VM_RuntimeValue));
+		printf("%llu instructions executed per run\n", instructions);
+		printf("best of %d runs: %.1f us, %.2f ns per instruction (median %.1f us)\n", BENCH_RUN_RUNS, best / 1e3,
+			   (f64) best / instructions, median / 1e3);
+		printf("context grew %llu bytes after the first run\n", contextFootprint(&ctx) - footprint);
+	}
+	VM_ContextFree(&ctx);
+}
+
+//~ Resume benchmark
+
+#define BENCH_RESUME_SCRIPTS 200
+
+static void benchResume(IR_Chunk* chunk) {
+	u64 printed = 0;
+	VM_Context ctx;
+	VM_ContextInit(&ctx);
+	ctx.output = countOutput;
+	ctx.output_data = &printed;
+	
+	VM_Continuation* conts = malloc(sizeof(VM_Continuation) * BENCH_RESUME_SCRIPTS);
+	// u64_max runs every script to completion in one slice, the baseline for the others
+	static const u64 fuels[] = { u64_max, 100, 1 };
+	printf("%d scripts\n%10s %12s %10s %12s %10s\n", BENCH_RESUME_SCRIPTS, "Fuel", "Slices", "ms", "ns/slice", "Prints");
+	for (u32 f = 0; f < ArrayCount(fuels); f++) {
+		for (u32 s = 0; s < BENCH_RESUME_SCRIPTS; s++) VM_ContinuationInit(&conts[s], chunk);
+		printed = 0;
+		
+		// Round robin, like a scheduler handing each script a time slice
+		u64 slices = 0;
+		u64 start = U_GetTimeNs();
+		for (u32 running = BENCH_RESUME_SCRIPTS; running;) {
+			running = 0;
+			for (u32 s = 0; s < BENCH_RESUME_SCRIPTS; s++) {
+				if (conts[s].status != RunStatus_Suspended) continue;
+				slices++;
+				if (VM_Resume(&ctx, &conts[s], fuels[f]) == RunStatus_Suspended) running++;
+			}
+		}
+		u64 elapsed = U_GetTimeNs() - start;
+		
+		if (fuels[f] == u64_max) printf("%10s", "all");
+		else printf("%10llu", fuels[f]);
+		printf(" %12llu %10.2f %12.1f %10llu\n", slices, elapsed / 1e6, (f64) elapsed / slices, printed);
+		for (u32 s = 0; s < BENCH_RESUME_SCRIPTS; s++) VM_ContinuationFree(&conts[s]);
+	}
+	
+	free(conts);
+	VM_ContextFree(&ctx);
+}
+
+//~ Heap check
+
+#define HEAP_CHECK_SCRIPTS 2
+#define HEAP_CHECK_FUEL 7
+#define HEAP_CHECK_GARBAGE Kilobytes(4)
+
+static VM_RuntimeValue heapInt(i32 value) {
+	return (VM_RuntimeValue) { .type = RuntimeValueType_Integer, .as_int = value };
+}
+
+// Every register gets a fresh object holding its index, whatever was there before
+static void plantObjects(VM_Heap* heap, VM_Stack* stack) {
+	for (u32 r = 0; r < stack->cap; r++) {
+		u32 ref = VM_HeapAlloc(heap, ObjectKind_Values, sizeof(VM_RuntimeValue));
+		VM_HeapStore(heap, ref, 0, heapInt(r));
+		stack->values[r] = (VM_RuntimeValue) { .type = RuntimeValueType_Object, .as_ref = ref };
+	}
+}
+
+// Right after a collection everything reachable sits in the current old space
+static b8 inOldSpace(VM_Heap* heap, u32 ref) {
+	if (heap->old_space) return ref >= VM_OLD_SPACE_SIZE + VM_NURSERY_SIZE;
+	return ref && ref < VM_OLD_SPACE_SIZE;
+}
+
+static b8 checkRegister(VM_Heap* heap, VM_RuntimeValue value, u32 r, b8 live, u64* dropped) {
+	if (!live) {
+		*dropped += value.type == RuntimeValueType_Invalid;
+		return value.type == RuntimeValueType_Invalid;
+	}
+	if (value.type != RuntimeValueType_Object || !inOldSpace(heap, value.as_ref)) return false;
+	VM_Object* object = VM_HeapObject(heap, value.as_ref);
+	return object->kind == ObjectKind_Values && VM_ObjectValues(object)[0].as_int == (i32) r;
+}
+
+// Registers a suspended call still reads must hold their own object, moved or not, the rest must be dropped
+static b8 checkPlanted(VM_Heap* heap, VM_Stack* stack, u64* dropped) {
+	for (u32 f = 0; f < stack->frame_count; f++) {
+		VM_CallFrame* frame = &stack->frames[f];
+		u32 callee_base = f + 1 < stack->frame_count ? stack->frames[f + 1].caller_base : stack->base;
+		VM_StackMap* map = VM_FindStackMap(stack->chunk, frame->return_ip);
+		for (u32 r = frame->caller_base; r < callee_base; r++) {
+			u32 reg = r - frame->caller_base;
+			b8 live = !map || (map->live[reg / 32] >> (reg % 32) & 1);
+			if (!checkRegister(heap, stack->values[r], r, live, dropped)) return false;
+		}
+	}
+	for (u32 r = stack->base; r < stack->cap; r++) {
+		if (!checkRegister(heap, stack->values[r], r, true, dropped)) return false;
+	}
+	return true;
+}
+
+// The list holds count nodes, newest first, each with its index
+static b8 checkList(VM_Heap* heap, VM_RuntimeValue list, i32 count) {
+	VM_RuntimeValue next = VM_ObjectValues(VM_HeapObject(heap, list.as_ref))[0];
+	for (i32 n = count - 1; n >= 0; n--) {
+		if (next.type != RuntimeValueType_Object || !inOldSpace(heap, next.as_ref)) return false;
+		VM_RuntimeValue* values = VM_ObjectValues(VM_HeapObject(heap, next.as_ref));
+		if (values[0].as_int != n) return false;
+		next = values[1];
+	}
+	return next.type == RuntimeValueType_Invalid;
+}
+
+// Returns false if anything the collector should have kept is gone or wrong
+static b8 benchHeap(IR_Chunk* chunk) {
+	u64 printed = 0;
+	VM_Context ctx;
+	VM_ContextInit(&ctx);
+	ctx.output = countOutput;
+	ctx.output_data = &printed;
+	VM_Heap* heap = &ctx.heap;
+	
+	VM_Continuation conts[HEAP_CHECK_SCRIPTS];
+	VM_ContinuationInit(&conts[0], chunk);
+	VM_Resume(&ctx, &conts[0], u64_max);
+	u64 expected = printed * HEAP_CHECK_SCRIPTS;
+	VM_ContinuationFree(&conts[0]);
+	printed = 0;
+	
+	// Lives in the old generation and only ever points at the newest node, so minor collections
+	// find the rest of the list through the remembered set
+	VM_RuntimeValue list = { .type = RuntimeValueType_Object };
+	list.as_ref = VM_HeapAlloc(heap, ObjectKind_Values, VM_MAX_NURSERY_OBJECT + sizeof(VM_RuntimeValue));
+	VM_HeapPushRoot(heap, &list);
+	i32 nodes = 0;
+	
+	for (u32 s = 0; s < HEAP_CHECK_SCRIPTS; s++) VM_ContinuationInit(&conts[s], chunk);
+	VM_RuntimeValue* saved = 0;
+	u32 saved_cap = 0;
+	u64 slices = 0;
+	u64 dropped = 0;
+	b8 ok = true;
+	for (u32 running = HEAP_CHECK_SCRIPTS; running && ok;) {
+		running = 0;
+		for (u32 s = 0; s < HEAP_CHECK_SCRIPTS && ok; s++) {
+			if (conts[s].status != RunStatus_Suspended) continue;
+			slices++;
+			if (VM_Resume(&ctx, &conts[s], HEAP_CHECK_FUEL) != RunStatus_Suspended) continue;
+			running++;
+			
+			VM_RuntimeValue node = { .type = RuntimeValueType_Object };
+			node.as_ref = VM_HeapAlloc(heap, ObjectKind_Values, 2 * sizeof(VM_RuntimeValue));
+			VM_HeapStore(heap, node.as_ref, 0, heapInt(nodes++));
+			VM_HeapStore(heap, node.as_ref, 1, VM_ObjectValues(VM_HeapObject(heap, list.as_ref))[0]);
+			VM_HeapStore(heap, list.as_ref, 0, node);
+			VM_HeapAlloc(heap, ObjectKind_Bytes, HEAP_CHECK_GARBAGE);
+			
+			VM_Stack* stack = &conts[s].stack;
+			if (stack->cap > saved_cap) {
+				saved_cap = stack->cap;
+				saved = realloc(saved, sizeof(VM_RuntimeValue) * saved_cap);
+			}
+			memcpy(saved, stack->values, sizeof(VM_RuntimeValue) * stack->cap);
+			plantObjects(heap, stack);
+			VM_HeapCollect(heap, false);
+			ok = checkPlanted(heap, stack, &dropped) && checkList(heap, list, nodes);
+			VM_HeapCollect(heap, true);
+			u64 dropped_again = 0;
+			ok = ok && checkPlanted(heap, stack, &dropped_again);
+			memcpy(stack->values, saved, sizeof(VM_RuntimeValue) * stack->cap);
+			if (!ok) fprintf(stderr, "Heap check: lost a live object after slice %llu\n", slices);
+		}
+	}
+	for (u32 s = 0; s < HEAP_CHECK_SCRIPTS; s++) {
+		if (ok && conts[s].status != RunStatus_Done) {
+			fprintf(stderr, "Heap check: script %u stopped: %s\n", s, ctx.error);
+			ok = false;
+		}
+		VM_ContinuationFree(&conts[s]);
+	}
+	if (ok && printed != expected) {
+		fprintf(stderr, "Heap check: %llu prints instead of %llu\n", printed, expected);
+		ok = false;
+	}
+	
+	if (ok && !checkList(heap, list, nodes)) {
+		fprintf(stderr, "Heap check: the rooted list lost a node\n");
+		ok = false;
+	}
+	VM_HeapPopRoot(heap);
+	
+	VM_HeapStats* stats = &heap->stats;
+	printf("%llu slices, %llu dead registers dropped, %d list nodes\n", slices, dropped, nodes);
+	printf("%llu minor collections, max pause %.1f us\n", stats->minor_collections, stats->max_minor_pause_ns / 1e3);
+	printf("%llu major collections, max pause %.1f us\n", stats->major_collections, stats->max_major_pause_ns / 1e3);
+	printf("%s\n", ok ? "ok" : "FAILED");
+	
+	free(saved);
+	VM_ContextFree(&ctx);
+	return ok;
+}
+
+//~ Checker benchmark
+
+#define BENCH_CHECKER_RUNS 10000
+
+static void benchChecker(IR_Ast* ast) {
+	// One run with stats on to count identifiers, the timed runs go without
+	C_Checker checker;
+	C_Init(&checker, ast);
+	checker.collect_stats = true;
+	C_Check(&checker);
+	u64 idents = checker.stats.node_visits[AstType_ExprIdent];
+	C_Free(&checker);
+	
+	// Only C_Check is timed, making and freeing the arena isn't part of checking
+	u64 total = 0;
+	for (u32 i = 0; i < BENCH_CHECKER_RUNS; i++) {
+		C_Init(&checker, ast);
+		u64 start = U_GetTimeNs();
+		C_Check(&checker);
+		total += U_GetTimeNs() - start;
+		C_Free(&checker);
+	}
+	f64 ns = (f64) total / BENCH_CHECKER_RUNS;
+	
+	// Per identifier is the whole check spread over them, an upper bound on a resolve
+	printf("%d runs, %llu identifiers\n", BENCH_CHECKER_RUNS, idents);
+	printf("%.0f ns per check, %.2f ns per identifier\n", ns, idents ? ns / idents : 0);
+}
+
+static Options parseOptions(int argc, char **argv) {
+	Options options = {0};
+	int first = 1;
+	if (argc > 1 && strcmp(argv[1], "run") == 0) {
+		options.run = true;
+		first = 2;
+	}
+	
+	for (int i = first; i < argc; i++) {
+		if (strcmp(argv[i], "--stats=alloc") == 0) {
+			options.stats_alloc = true;
+		} else if (strcmp(argv[i], "--stats=checker") == 0) {
+			options.stats_checker = true;
+		} else if (strcmp(argv[i], "--stats=vm") == 0) {
+			options.stats_vm = true;
+		} else if (strcmp(argv[i], "--stats=vm-json") == 0) {
+			options.stats_vm_json = true;
+		} else if (strcmp(argv[i], "--bench=threads") == 0) {
+			options.bench_threads = true;
+		} else if (strcmp(argv[i], "--bench=run") == 0) {
+			options.bench_run = true;
+		} else if (strcmp(argv[i], "--bench=resume") == 0) {
+			options.bench_resume = true;
+		} else if (strcmp(argv[i], "--bench=heap") == 0) {
+			options.bench_heap = true;
+		} else if (strcmp(argv[i], "--bench=checker") == 0) {
+			options.bench_checker = true;
+		} else if (strcmp(argv[i], "--emit=rbc") == 0) {
+			options.emit_bytecode = true;
+		} else if (strncmp(argv[i], "--native-lib=", 13) == 0) {
+			if (options.native_lib_count < VM_MAX_NATIVE_LIBRARIES) options.native_libs[options.native_lib_count++] = argv[i] + 13;
+			else printf("Too many native libraries, ignoring %s\n", argv[i] + 13);
+		} else if (strncmp(argv[i], "--", 2) == 0) {
+			printf("Unknown option %s\n", argv[i]);
+		} else {
+			options.filename = argv[i];
+		}
+	}
+	return options;
+}
+
 int main(int argc, char **argv) {
     M_ScratchInit();
+    int exit_code = 0;
     
-    if (argc < 2) {
+	VM_Context vm_context;
+	VM_ContextInit(&vm_context);
+	
+	Options options = parseOptions(argc, argv);
+	for (u32 i = 0; i < options.native_lib_count; i++) {
+		if (!VM_AddNativeLibrary(options.native_libs[i])) printf("Could not load native library %s\n", options.native_libs[i]);
+	}
+    if (!options.filename) {
         printf("Did not recieve filename as first argument\n");
-    } else {
-        char* source = readFile(argv[1]);
+    } else if (options.run && hasExtension(options.filename, ".rbc")) {
+		if (!runBytecode(&vm_context, options.filename)) exit_code = 1;
+	} else {
+        char* source = readFile(options.filename);
         string source_str = { .str = (u8*) source, .size = strlen(source) };
-        string source_filename = { .str = (u8*) argv[1], .size = strlen(argv[1]) };
+        string source_filename = { .str = (u8*) options.filename, .size = strlen(options.filename) };
         
         L_Lexer lexer = {0};
         P_Parser parser = {0};
@@ -43,16 +511,40 @@ int main(int argc, char **argv) {
 		
 		C_Checker checker = {0};
 		C_Init(&checker, ast);
-		if (C_Check(&checker)) {
-			IR_Chunk chunk = VM_LowerConstexpr(ast);
-			VM_RunExprChunk(&chunk);
+		checker.collect_stats = options.stats_checker;
+		// Check even if parsing failed so all diagnostics show up in one run
+		b8 checked = C_Check(&checker) && !parser.errored;
+		if (checked && options.bench_checker) {
+			benchChecker(ast);
+		} else if (checked && (options.run || options.emit_bytecode)) {
+			IR_Chunk chunk;
+			if (VM_LowerProgram(ast, &chunk)) {
+				if (options.emit_bytecode) writeBytecode(&chunk, options.filename);
+				if (options.run && options.bench_threads) benchThreads(&chunk);
+				else if (options.run && options.bench_run) benchRun(&chunk);
+				else if (options.run && options.bench_resume) benchResume(&chunk);
+				else if (options.run && options.bench_heap) { if (!benchHeap(&chunk)) exit_code = 1; }
+				else if (options.run && !runChunk(&vm_context, &chunk)) exit_code = 1;
+				VM_ContextFlush(&vm_context);
+			} else {
+				exit_code = 1;
+			}
 			IR_ChunkFree(&chunk);
+		} else if (checked) {
+			VM_ConstexprCache constexprs = {0};
+			VM_ConstexprCacheInit(&constexprs);
+			VM_EvalConstexprs(&constexprs, ast);
 			
 			LLVM_Emitter emitter = {0};
-			LLVM_Init(&emitter);
+			LLVM_Init(&emitter, &constexprs);
 			LLVM_Emit(&emitter, ast);
 			LLVM_Free(&emitter);
+			
+			VM_ConstexprCacheFree(&constexprs);
 		}
+		if (checker.errored || parser.errored) exit_code = 1;
+		if (options.stats_alloc) C_PrintAllocStats(&checker);
+		if (options.stats_checker) C_PrintStats(&checker);
 		C_Free(&checker);
 		
 		P_Free(&parser);
@@ -60,5 +552,17 @@ int main(int argc, char **argv) {
 		free(source);
     }
     
+	if (options.stats_vm || options.stats_vm_json) {
+#ifdef VM_PROFILE
+		if (options.stats_vm) VM_ProfilePrint(stdout);
+		if (options.stats_vm_json) VM_ProfilePrintJson(stdout);
+#else
+		printf("VM stats need a build with VM_PROFILE defined (cmake -DRIFT_VM_PROFILE=ON)\n");
+#endif
+	}
+	
+	LLVM_JitShutdown();
+	VM_ContextFree(&vm_context);
     M_ScratchFree();
+    return exit_code;
 }
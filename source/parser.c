@@ -3,23 +3,40 @@
 #include <stdarg.h>
 
 #include "base/log.h"
+#include "base/ds.h"
+
+DArray_Impl(IR_AstRef);
 
 //~ Data
 
 u32 infix_expr_precs[] = {
     [TokenType_Star] = Prec_Factor,
     [TokenType_Slash] = Prec_Factor,
+    [TokenType_Percent] = Prec_Factor,
     
     [TokenType_Plus] = Prec_Term,
     [TokenType_Minus] = Prec_Term,
     
+    [TokenType_Less] = Prec_Comparison,
+    [TokenType_Greater] = Prec_Comparison,
+    [TokenType_LessEqual] = Prec_Comparison,
+    [TokenType_GreaterEqual] = Prec_Comparison,
+    
+    [TokenType_EqualEqual] = Prec_Equality,
+    [TokenType_BangEqual] = Prec_Equality,
+    
     [TokenType_TokenTypeCount] = Prec_Invalid,
 };
 
 //~ Error Handling
 
 static void ErrorHere(P_Parser* p, const char* error, ...) {
-	printf("Parser error: ");
+	p->errored = true;
+	// Only the first error until the next sync point is interesting
+	if (p->panic_mode) return;
+	p->panic_mode = true;
+	
+	printf("Parser error (%u:%u): ", p->curr.line, p->curr.column);
 	
 	va_list va;
 	va_start(va, error);
@@ -38,8 +55,10 @@ static void Advance(P_Parser* p) {
 }
 
 static void EatOrError(P_Parser* p, L_TokenType type) {
-	if (p->curr.type != type)
-		ErrorHere(p, "Expected token %.*s but got %.*s", str_expand(L_GetTypeName(type)), str_expand(L_GetTypeName(p->next.type)));
+	if (p->curr.type != type) {
+		ErrorHere(p, "Expected token %.*s but got %.*s", str_expand(L_GetTypeName(type)), str_expand(L_GetTypeName(p->curr.type)));
+		return;
+	}
 	
 	// Panic mode reset delimiters
 	if (type == TokenType_Semicolon ||
@@ -61,20 +80,24 @@ static b8 Match(P_Parser* p, L_TokenType type) {
 
 static IR_Ast* P_MakeIntLiteralNode(P_Parser* p, i32 value) {
 	IR_Ast* ret = pool_alloc(p->ast_node_pool);
+	MemoryZeroStruct(ret, IR_Ast);
 	ret->type = AstType_IntLiteral;
 	ret->int_lit.value = value;
 	return ret;
 }
 
-static IR_Ast* P_MakeFloatLiteralNode(P_Parser* p, f32 value) {
+static IR_Ast* P_MakeFloatLiteralNode(P_Parser* p, L_Token token, f32 value) {
 	IR_Ast* ret = pool_alloc(p->ast_node_pool);
+	MemoryZeroStruct(ret, IR_Ast);
 	ret->type = AstType_FloatLiteral;
+	ret->float_lit.token = token;
 	ret->float_lit.value = value;
 	return ret;
 }
 
 static IR_Ast* P_MakeExprUnaryNode(P_Parser* p, L_Token operator, IR_Ast* operand) {
 	IR_Ast* ret = pool_alloc(p->ast_node_pool);
+	MemoryZeroStruct(ret, IR_Ast);
 	ret->type = AstType_ExprUnary;
 	ret->unary.operator = operator;
 	ret->unary.operand = operand;
@@ -83,6 +106,7 @@ static IR_Ast* P_MakeExprUnaryNode(P_Parser* p, L_Token operator, IR_Ast* operan
 
 static IR_Ast* P_MakeExprBinaryNode(P_Parser* p, IR_Ast* a, L_Token operator, IR_Ast* b) {
 	IR_Ast* ret = pool_alloc(p->ast_node_pool);
+	MemoryZeroStruct(ret, IR_Ast);
 	ret->type = AstType_ExprBinary;
 	ret->binary.operator = operator;
 	ret->binary.a = a;
@@ -91,13 +115,102 @@ static IR_Ast* P_MakeExprBinaryNode(P_Parser* p, IR_Ast* a, L_Token operator, IR
 }
 
 
-static IR_Ast* P_MakeStmtPrintNode(P_Parser* p, IR_Ast* value) {
+static IR_Ast* P_MakeExprIdentNode(P_Parser* p, L_Token name) {
+	IR_Ast* ret = pool_alloc(p->ast_node_pool);
+	MemoryZeroStruct(ret, IR_Ast);
+	ret->type = AstType_ExprIdent;
+	ret->ident.name = name;
+	return ret;
+}
+
+static IR_Ast* P_MakeExprCallNode(P_Parser* p, L_Token name, darray(IR_AstRef)* args) {
+	IR_Ast* ret = pool_alloc(p->ast_node_pool);
+	MemoryZeroStruct(ret, IR_Ast);
+	ret->type = AstType_ExprCall;
+	ret->call.name = name;
+	ret->call.arg_count = args->len;
+	ret->call.args = arena_alloc_array(p->arena, IR_Ast*, args->len);
+	MemoryCopy(ret->call.args, args->elems, args->len * sizeof(IR_Ast*));
+	return ret;
+}
+
+static IR_Ast* P_MakeStmtPrintNode(P_Parser* p, L_Token token, IR_Ast* value) {
 	IR_Ast* ret = pool_alloc(p->ast_node_pool);
+	MemoryZeroStruct(ret, IR_Ast);
 	ret->type = AstType_StmtPrint;
+	ret->print.token = token;
 	ret->print.value = value;
 	return ret;
 }
 
+static IR_Ast* P_MakeStmtVarDeclNode(P_Parser* p, L_Token name, L_Token type, IR_Ast* value) {
+	IR_Ast* ret = pool_alloc(p->ast_node_pool);
+	MemoryZeroStruct(ret, IR_Ast);
+	ret->type = AstType_StmtVarDecl;
+	ret->var_decl.name = name;
+	ret->var_decl.type = type;
+	ret->var_decl.value = value;
+	return ret;
+}
+
+static IR_Ast* P_MakeStmtAssignNode(P_Parser* p, L_Token name, IR_Ast* value) {
+	IR_Ast* ret = pool_alloc(p->ast_node_pool);
+	MemoryZeroStruct(ret, IR_Ast);
+	ret->type = AstType_StmtAssign;
+	ret->assign.name = name;
+	ret->assign.value = value;
+	return ret;
+}
+
+static IR_Ast* P_MakeStmtReturnNode(P_Parser* p, L_Token token, IR_Ast* value) {
+	IR_Ast* ret = pool_alloc(p->ast_node_pool);
+	MemoryZeroStruct(ret, IR_Ast);
+	ret->type = AstType_StmtReturn;
+	ret->return_stmt.token = token;
+	ret->return_stmt.value = value;
+	return ret;
+}
+
+static IR_Ast* P_MakeStmtIfNode(P_Parser* p, L_Token token, IR_Ast* condition, IR_Ast* then_body, IR_Ast* else_body) {
+	IR_Ast* ret = pool_alloc(p->ast_node_pool);
+	MemoryZeroStruct(ret, IR_Ast);
+	ret->type = AstType_StmtIf;
+	ret->if_stmt.token = token;
+	ret->if_stmt.condition = condition;
+	ret->if_stmt.then_body = then_body;
+	ret->if_stmt.else_body = else_body;
+	return ret;
+}
+
+static IR_Ast* P_MakeStmtWhileNode(P_Parser* p, L_Token token, IR_Ast* condition, IR_Ast* body) {
+	IR_Ast* ret = pool_alloc(p->ast_node_pool);
+	MemoryZeroStruct(ret, IR_Ast);
+	ret->type = AstType_StmtWhile;
+	ret->while_stmt.token = token;
+	ret->while_stmt.condition = condition;
+	ret->while_stmt.body = body;
+	return ret;
+}
+
+static IR_Ast* P_MakeStmtExprNode(P_Parser* p, IR_Ast* expr) {
+	IR_Ast* ret = pool_alloc(p->ast_node_pool);
+	MemoryZeroStruct(ret, IR_Ast);
+	ret->type = AstType_StmtExpr;
+	ret->expr_stmt.expr = expr;
+	return ret;
+}
+
+static IR_Ast* P_MakeStmtBlockNode(P_Parser* p, darray(IR_AstRef)* statements, b8 scoped) {
+	IR_Ast* ret = pool_alloc(p->ast_node_pool);
+	MemoryZeroStruct(ret, IR_Ast);
+	ret->type = AstType_StmtBlock;
+	ret->block.count = statements->len;
+	ret->block.statements = arena_alloc_array(p->arena, IR_Ast*, statements->len);
+	MemoryCopy(ret->block.statements, statements->elems, statements->len * sizeof(IR_Ast*));
+	ret->block.scoped = scoped;
+	return ret;
+}
+
 //~ Parsing
 
 IR_Ast* P_ParseExpr(P_Parser* p, P_Precedence prec);
@@ -106,10 +219,74 @@ IR_Ast* P_ParsePrefixExpr(P_Parser* p);
 
 IR_Ast* P_ParsePrefixUnaryExpr(P_Parser* p) {
 	Advance(p);
-	L_Token operator = p->curr;
+	L_Token operator = p->prev;
 	return P_MakeExprUnaryNode(p, operator, P_ParsePrefixExpr(p));
 }
 
+// The name was just consumed, p->curr is the open parenthesis
+static IR_Ast* P_ParseCall(P_Parser* p, L_Token name) {
+	EatOrError(p, TokenType_OpenParenthesis);
+	darray(IR_AstRef) args = {0};
+	if (p->curr.type != TokenType_CloseParenthesis) {
+		do {
+			// A failed argument stays as a null slot, the checker poisons the call
+			darray_add(IR_AstRef, &args, P_ParseExpr(p, Prec_Invalid));
+		} while (Match(p, TokenType_Comma));
+	}
+	EatOrError(p, TokenType_CloseParenthesis);
+	IR_Ast* ret = P_MakeExprCallNode(p, name, &args);
+	darray_free(IR_AstRef, &args);
+	return ret;
+}
+
+// int is the only type that can be written out so far
+static L_Token P_ParseType(P_Parser* p) {
+	if (p->curr.type == TokenType_Int) {
+		Advance(p);
+		return p->prev;
+	}
+	ErrorHere(p, "Expected a type but got %.*s", str_expand(p->curr.lexeme));
+	return (L_Token) {0};
+}
+
+// func(a : int, b : int) -> int body
+static IR_Ast* P_ParseFunc(P_Parser* p) {
+	IR_Ast* ret = pool_alloc(p->ast_node_pool);
+	MemoryZeroStruct(ret, IR_Ast);
+	ret->type = AstType_ExprFunc;
+	ret->func.token = p->curr;
+	Advance(p);
+	
+	EatOrError(p, TokenType_OpenParenthesis);
+	L_Token names[TYPE_MAX_PARAMS];
+	L_Token types[TYPE_MAX_PARAMS];
+	u32 count = 0;
+	if (p->curr.type != TokenType_CloseParenthesis) {
+		do {
+			if (count == TYPE_MAX_PARAMS) {
+				ErrorHere(p, "Functions can't have more than %d parameters", TYPE_MAX_PARAMS);
+				break;
+			}
+			EatOrError(p, TokenType_Ident);
+			names[count] = p->prev;
+			EatOrError(p, TokenType_Colon);
+			types[count] = P_ParseType(p);
+			count++;
+		} while (Match(p, TokenType_Comma));
+	}
+	EatOrError(p, TokenType_CloseParenthesis);
+	
+	ret->func.param_count = count;
+	ret->func.param_names = arena_alloc_array(p->arena, L_Token, count);
+	ret->func.param_types = arena_alloc_array(p->arena, L_Token, count);
+	MemoryCopy(ret->func.param_names, names, count * sizeof(L_Token));
+	MemoryCopy(ret->func.param_types, types, count * sizeof(L_Token));
+	
+	if (Match(p, TokenType_ThinArrow)) ret->func.return_type = P_ParseType(p);
+	if (!Match(p, TokenType_Native)) ret->func.body = P_ParseStmt(p);
+	return ret;
+}
+
 IR_Ast* P_ParsePrefixExpr(P_Parser* p) {
 	switch (p->curr.type) {
 		case TokenType_IntLit: {
@@ -118,6 +295,23 @@ IR_Ast* P_ParsePrefixExpr(P_Parser* p) {
 			return P_MakeIntLiteralNode(p, val);
 		} break;
 		
+		case TokenType_FloatLit:
+		case TokenType_DoubleLit: {
+			Advance(p);
+			f32 val = (f32) atof((const char*)p->prev.lexeme.str);
+			return P_MakeFloatLiteralNode(p, p->prev, val);
+		} break;
+		
+		case TokenType_Ident: {
+			Advance(p);
+			if (p->curr.type == TokenType_OpenParenthesis) return P_ParseCall(p, p->prev);
+			return P_MakeExprIdentNode(p, p->prev);
+		} break;
+		
+		case TokenType_Func: {
+			return P_ParseFunc(p);
+		} break;
+		
 		case TokenType_Plus:
 		case TokenType_Minus: {
 			return P_ParsePrefixUnaryExpr(p);
@@ -144,7 +338,13 @@ IR_Ast* P_ParseInfixExpr(P_Parser* p, L_Token op, P_Precedence prec, IR_Ast* lef
         case TokenType_Minus:
         case TokenType_Star:
         case TokenType_Slash:
-        case TokenType_Percent: {
+        case TokenType_Percent:
+        case TokenType_Less:
+        case TokenType_Greater:
+        case TokenType_LessEqual:
+        case TokenType_GreaterEqual:
+        case TokenType_EqualEqual:
+        case TokenType_BangEqual: {
 			IR_Ast* right = P_ParseExpr(p, prec);
 			return P_MakeExprBinaryNode(p, left, op, right);
 		} break;
@@ -159,35 +359,138 @@ IR_Ast* P_ParseInfixExpr(P_Parser* p, L_Token op, P_Precedence prec, IR_Ast* lef
 IR_Ast* P_ParseExpr(P_Parser* p, P_Precedence prec) {
 	IR_Ast* lhs = P_ParsePrefixExpr(p);
 	
-	if (infix_expr_precs[p->curr.type] != Prec_Invalid) {
+	while (infix_expr_precs[p->curr.type] != Prec_Invalid &&
+		   infix_expr_precs[p->curr.type] >= prec) {
+		L_Token op = p->curr;
 		Advance(p);
-		L_Token op = p->prev;
-		while (true) {
-			if (infix_expr_precs[op.type] == Prec_Invalid) break;
-			
-			if (infix_expr_precs[op.type] >= prec) {
-				lhs = P_ParseInfixExpr(p, op, infix_expr_precs[op.type] + 1, lhs);
-				op = p->curr;
-				
-				if (infix_expr_precs[op.type] != Prec_Invalid) Advance(p);
-			} else break;
-		}
+		lhs = P_ParseInfixExpr(p, op, infix_expr_precs[op.type] + 1, lhs);
 	}
 	
 	return lhs;
 }
 
+static IR_Ast* P_ParseVarDecl(P_Parser* p) {
+	Advance(p);
+	L_Token name = p->prev;
+	EatOrError(p, TokenType_Colon);
+	
+	L_Token type = {0};
+	IR_Ast* value = nullptr;
+	if (Match(p, TokenType_Equal)) {
+		value = P_ParseExpr(p, Prec_Invalid);
+	} else {
+		type = P_ParseType(p);
+		if (Match(p, TokenType_Equal))
+			value = P_ParseExpr(p, Prec_Invalid);
+	}
+	// A function's body statement already ended the declaration
+	if (value && value->type == AstType_ExprFunc) Match(p, TokenType_Semicolon);
+	else EatOrError(p, TokenType_Semicolon);
+	return P_MakeStmtVarDeclNode(p, name, type, value);
+}
+
+static IR_Ast* P_ParseAssign(P_Parser* p) {
+	Advance(p);
+	L_Token name = p->prev;
+	EatOrError(p, TokenType_Equal);
+	IR_Ast* value = P_ParseExpr(p, Prec_Invalid);
+	EatOrError(p, TokenType_Semicolon);
+	return P_MakeStmtAssignNode(p, name, value);
+}
+
+// x++; is sugar for x = x + 1;
+static IR_Ast* P_ParseIncrement(P_Parser* p) {
+	Advance(p);
+	L_Token name = p->prev;
+	Advance(p);
+	L_Token op = p->prev;
+	b8 increment = op.type == TokenType_PlusPlus;
+	op.type = increment ? TokenType_Plus : TokenType_Minus;
+	op.lexeme = increment ? str_lit("+") : str_lit("-");
+	EatOrError(p, TokenType_Semicolon);
+	IR_Ast* value = P_MakeExprBinaryNode(p, P_MakeExprIdentNode(p, name), op, P_MakeIntLiteralNode(p, 1));
+	return P_MakeStmtAssignNode(p, name, value);
+}
+
+// Skip to the end of the broken statement so the next one parses cleanly
+static void P_Synchronize(P_Parser* p) {
+	while (p->curr.type != TokenType_Semicolon &&
+		   p->curr.type != TokenType_CloseBrace &&
+		   p->curr.type != TokenType_EOF) {
+		Advance(p);
+	}
+	Match(p, TokenType_Semicolon);
+	p->panic_mode = false;
+}
+
+static IR_Ast* P_ParseStatementList(P_Parser* p, L_TokenType terminator, b8 scoped) {
+	darray(IR_AstRef) statements = {0};
+	while (p->curr.type != terminator && p->curr.type != TokenType_EOF) {
+		IR_Ast* stmt = P_ParseStmt(p);
+		if (p->panic_mode) P_Synchronize(p);
+		if (stmt) darray_add(IR_AstRef, &statements, stmt);
+	}
+	IR_Ast* ret = P_MakeStmtBlockNode(p, &statements, scoped);
+	darray_free(IR_AstRef, &statements);
+	return ret;
+}
+
+IR_Ast* P_ParseBlock(P_Parser* p) {
+	EatOrError(p, TokenType_OpenBrace);
+	IR_Ast* ret = P_ParseStatementList(p, TokenType_CloseBrace, true);
+	EatOrError(p, TokenType_CloseBrace);
+	return ret;
+}
+
 IR_Ast* P_ParseStmt(P_Parser* p) {
 	if (Match(p, TokenType_Print)) {
-		return P_MakeStmtPrintNode(p, P_ParseExpr(p, Prec_Invalid));
+		L_Token token = p->prev;
+		IR_Ast* ret = P_MakeStmtPrintNode(p, token, P_ParseExpr(p, Prec_Invalid));
+		EatOrError(p, TokenType_Semicolon);
+		return ret;
+	}
+	
+	if (Match(p, TokenType_Return)) {
+		L_Token token = p->prev;
+		IR_Ast* value = p->curr.type == TokenType_Semicolon ? nullptr : P_ParseExpr(p, Prec_Invalid);
+		EatOrError(p, TokenType_Semicolon);
+		return P_MakeStmtReturnNode(p, token, value);
+	}
+	
+	if (Match(p, TokenType_If)) {
+		L_Token token = p->prev;
+		IR_Ast* condition = P_ParseExpr(p, Prec_Invalid);
+		IR_Ast* then_body = P_ParseStmt(p);
+		IR_Ast* else_body = Match(p, TokenType_Else) ? P_ParseStmt(p) : nullptr;
+		return P_MakeStmtIfNode(p, token, condition, then_body, else_body);
+	}
+	
+	if (Match(p, TokenType_While)) {
+		L_Token token = p->prev;
+		IR_Ast* condition = P_ParseExpr(p, Prec_Invalid);
+		return P_MakeStmtWhileNode(p, token, condition, P_ParseStmt(p));
+	}
+	
+	if (p->curr.type == TokenType_OpenBrace) return P_ParseBlock(p);
+	
+	if (p->curr.type == TokenType_Ident) {
+		if (p->next.type == TokenType_Colon) return P_ParseVarDecl(p);
+		if (p->next.type == TokenType_Equal) return P_ParseAssign(p);
+		if (p->next.type == TokenType_PlusPlus || p->next.type == TokenType_MinusMinus) return P_ParseIncrement(p);
+		if (p->next.type == TokenType_OpenParenthesis) {
+			IR_Ast* ret = P_MakeStmtExprNode(p, P_ParseExpr(p, Prec_Invalid));
+			EatOrError(p, TokenType_Semicolon);
+			return ret;
+		}
 	}
 	
 	ErrorHere(p, "Invalid Token for statement start");
+	Advance(p);
 	return 0;
 }
 
 IR_Ast* P_Parse(P_Parser* p) {
-	return P_ParseStmt(p);
+	return P_ParseStatementList(p, TokenType_EOF, false);
 }
 
 //~ Lifecycle
@@ -197,6 +500,7 @@ void P_Init(P_Parser* p, L_Lexer* lexer) {
 	
 	p->lexer = lexer;
 	p->ast_node_pool = pool_make(sizeof(IR_Ast));
+	p->arena = arena_make();
 	
 	Advance(p);
 	Advance(p);
@@ -204,4 +508,5 @@ void P_Init(P_Parser* p, L_Lexer* lexer) {
 
 void P_Free(P_Parser* p) {
 	pool_free(p->ast_node_pool);
+	arena_free(p->arena);
 }
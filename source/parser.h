@@ -12,6 +12,8 @@ typedef u32 P_Precedence;
 enum {
 	Prec_Invalid,
 	
+	Prec_Equality,
+	Prec_Comparison,
 	Prec_Term,
 	Prec_Factor,
 	
@@ -25,13 +27,16 @@ typedef struct P_Parser {
 	
 	L_Lexer* lexer;
 	M_Pool* ast_node_pool;
+	M_Arena* arena;
 	
 	b8 panic_mode;
+	b8 errored;
 } P_Parser;
 
 
 IR_Ast* P_ParseExpr(P_Parser* p, P_Precedence prec);
 IR_Ast* P_ParseStmt(P_Parser* p);
+IR_Ast* P_ParseBlock(P_Parser* p);
 IR_Ast* P_Parse(P_Parser* p);
 
 void P_Init(P_Parser* p, L_Lexer* lexer);
@@ -34,4 +34,11 @@ TypeTriple binary_operator_table_stardivmod[] = {
 	{ TypeID_Invalid, TypeID_Invalid, TypeID_Invalid },
 };
 
+// == != < > <= >=, there is no bool yet so the result is an int that is 0 or 1
+TypeTriple binary_operator_table_comparison[] = {
+	{ TypeID_Integer, TypeID_Integer, TypeID_Integer },
+	
+	{ TypeID_Invalid, TypeID_Invalid, TypeID_Invalid },
+};
+
 #endif //TABLES_H
@@ -6,11 +6,13 @@
 //~
 
 typedef struct Type Type;
+typedef u64 TypeID;
 
 typedef u32 TypeKind;
 enum {
 	TypeKind_Invalid,
 	TypeKind_Regular,
+	TypeKind_Function,
 	TypeKind_COUNT,
 };
 
@@ -18,17 +20,28 @@ typedef u32 RegularTypeKind;
 enum {
 	RegularTypeKind_Invalid,
 	RegularTypeKind_Integer,
+	RegularTypeKind_Void,
 	RegularTypeKind_COUNT,
 };
 
+// Parameters are stored inline, so a Type is still one flat value in the TypeCache
+#define TYPE_MAX_PARAMS 16
+// The VM calls #native functions through one prebuilt stub per arity
+#define TYPE_MAX_NATIVE_PARAMS 6
+
+typedef struct FunctionType {
+	TypeID return_type;
+	u32 param_count;
+	TypeID params[TYPE_MAX_PARAMS];
+} FunctionType;
+
 
 struct Type {
 	TypeKind kind;
 	union {
 		RegularTypeKind regular;
+		FunctionType function;
 	};
 };
 
-typedef u64 TypeID;
-
 #endif //TYPES_H
@@ -1,8 +1,20 @@
 #include "vm.h"
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "checker.h"
+#include "llvm_jit.h"
+#include "base/log.h"
 
 DArray_Impl(u8);
-Stack_Impl(VM_RuntimeValue);
+DArray_Impl(u32);
+DArray_Impl(VM_RuntimeValue);
+DArray_Impl(VM_Function);
+DArray_Impl(VM_Native);
+DArray_Impl(VM_StackMap);
+DArray_Impl(VM_RootSlot);
+DArray_Impl(VM_StackRef);
 
 
 // For completeness' sake
@@ -11,100 +23,1153 @@ IR_Chunk IR_ChunkAlloc(void) {
 	return chunk;
 }
 
-void IR_ChunkPushOp(IR_Chunk* chunk, u8 byte) {
-	darray_add(u8, chunk, byte);
+void IR_ChunkPushInstruction(IR_Chunk* chunk, u8 op, u8 a, u8 b, u8 c) {
+	darray_add(u32, &chunk->code, VM_Encode(op, a, b, c));
 }
 
 void IR_ChunkPushU32(IR_Chunk* chunk, u32 val) {
-	darray_add_all(u8, chunk, (u8*)&val, sizeof(u32));
+	darray_add(u32, &chunk->code, val);
 }
 
-void IR_ChunkPush(IR_Chunk* chunk, u8* bytes, u32 count) {
-	darray_add_all(u8, chunk, bytes, count);
+void IR_ChunkFree(IR_Chunk* chunk) {
+	// The compile threads still read the code
+	while (U_AtomicLoadU32(&chunk->tier_state) == TierState_Compiling) U_ThreadYield();
+	for (u32 i = 0; i < chunk->loop_count; i++) {
+		while (U_AtomicLoadU32(&chunk->loops[i].tier_state) == TierState_Compiling) U_ThreadYield();
+	}
+	free(chunk->native_bindings);
+	chunk->native_bindings = nullptr;
+	free(chunk->loops);
+	chunk->loops = nullptr;
+	// Everything else points into a mapped file
+	if (chunk->read_only) return;
+	darray_free(u32, &chunk->code);
+	darray_free(VM_RuntimeValue, &chunk->constants);
+	darray_free(VM_Function, &chunk->functions);
+	darray_free(VM_Native, &chunk->natives);
+	darray_free(VM_StackMap, &chunk->stack_maps);
+	darray_free(u8, &chunk->native_names);
 }
 
-void IR_ChunkFree(IR_Chunk* chunk) {
-	darray_free(u8, chunk);
+//~ Native functions
+
+// Slot 0 is the executable, opened on first use
+static U_Library vm_native_libraries[VM_MAX_NATIVE_LIBRARIES + 1];
+static u32 vm_native_library_count;
+
+b8 VM_AddNativeLibrary(const char* path) {
+	if (vm_native_library_count == VM_MAX_NATIVE_LIBRARIES) return false;
+	U_Library library;
+	if (!U_LoadLibrary(path, &library)) return false;
+	vm_native_libraries[1 + vm_native_library_count++] = library;
+	return true;
+}
+
+static void* VM_FindNative(const char* name) {
+	if (!vm_native_libraries[0].handle) U_LoadLibrary(nullptr, &vm_native_libraries[0]);
+	for (u32 i = 0; i <= vm_native_library_count; i++) {
+		if (!vm_native_libraries[i].handle) continue;
+		void* address = U_GetSymbol(&vm_native_libraries[i], name);
+		if (address) return address;
+	}
+	return nullptr;
+}
+
+// The C signature is fully known from the arity, so every stub is one direct call
+#define VM_NativeStubs(n, params, args) \
+static i32 VM_NativeStub##n(void* address, VM_RuntimeValue* a) { (void) a; return ((i32 (*) params) address) args; }\
+static i32 VM_NativeStubVoid##n(void* address, VM_RuntimeValue* a) { (void) a; ((void (*) params) address) args; return 0; }
+
+VM_NativeStubs(0, (void), ())
+VM_NativeStubs(1, (i32), (a[0].as_int))
+VM_NativeStubs(2, (i32, i32), (a[0].as_int, a[1].as_int))
+VM_NativeStubs(3, (i32, i32, i32), (a[0].as_int, a[1].as_int, a[2].as_int))
+VM_NativeStubs(4, (i32, i32, i32, i32), (a[0].as_int, a[1].as_int, a[2].as_int, a[3].as_int))
+VM_NativeStubs(5, (i32, i32, i32, i32, i32), (a[0].as_int, a[1].as_int, a[2].as_int, a[3].as_int, a[4].as_int))
+VM_NativeStubs(6, (i32, i32, i32, i32, i32, i32), (a[0].as_int, a[1].as_int, a[2].as_int, a[3].as_int, a[4].as_int, a[5].as_int))
+#undef VM_NativeStubs
+
+// [has_result][param_count]
+static VM_NativeStub* const vm_native_stubs[2][TYPE_MAX_NATIVE_PARAMS + 1] = {
+	{ VM_NativeStubVoid0, VM_NativeStubVoid1, VM_NativeStubVoid2, VM_NativeStubVoid3, VM_NativeStubVoid4, VM_NativeStubVoid5, VM_NativeStubVoid6 },
+	{ VM_NativeStub0, VM_NativeStub1, VM_NativeStub2, VM_NativeStub3, VM_NativeStub4, VM_NativeStub5, VM_NativeStub6 },
+};
+
+// Resolves every native of the chunk once, calls go straight through the binding after this
+static void VM_BindNatives(IR_Chunk* chunk) {
+	if (!chunk->natives.len) return;
+	chunk->native_bindings = calloc(chunk->natives.len, sizeof(VM_NativeBinding));
+	for (u32 i = 0; i < chunk->natives.len; i++) {
+		VM_Native* native = &chunk->natives.elems[i];
+		chunk->native_bindings[i].stub = vm_native_stubs[native->has_result != 0][native->param_count];
+		chunk->native_bindings[i].address = VM_FindNative((const char*) chunk->native_names.elems + native->name_offset);
+	}
 }
 
 //~ VM Helpers
 
-void VM_Lower(IR_Chunk* chunk, IR_Ast* ast) {
+// Opcode_COUNT means there is no specialized form, Opcode_Nop means nothing has to run.
+// Define VM_NO_SPECIALIZE to always emit the generic ops and leave typing to quickening
+static VM_Opcode VM_SpecializeUnaryOp(TypeID operand, L_TokenType op) {
+#ifdef VM_NO_SPECIALIZE
+	return Opcode_COUNT;
+#endif
+	if (operand == TypeID_Integer) {
+		switch (op) {
+			case TokenType_Plus: return Opcode_Nop;
+			case TokenType_Minus: return Opcode_NegI32;
+		}
+	}
+	return Opcode_COUNT;
+}
+
+static VM_Opcode VM_SpecializeBinaryOp(TypeID a, TypeID b, L_TokenType op) {
+#ifdef VM_NO_SPECIALIZE
+	return Opcode_COUNT;
+#endif
+	if (a == TypeID_Integer && b == TypeID_Integer) {
+		switch (op) {
+			case TokenType_Plus: return Opcode_AddI32;
+			case TokenType_Minus: return Opcode_SubI32;
+			case TokenType_Star: return Opcode_MulI32;
+			case TokenType_Slash: return Opcode_DivI32;
+			case TokenType_Percent: return Opcode_ModI32;
+			case TokenType_Less: return Opcode_LtI32;
+			case TokenType_LessEqual: return Opcode_LeI32;
+			case TokenType_EqualEqual: return Opcode_EqI32;
+			case TokenType_BangEqual: return Opcode_NeI32;
+		}
+	}
+	return Opcode_COUNT;
+}
+
+// Signed overflow is undefined in C, so + - * go through u32 and wrap like the JIT's LLVM adds do
+#define VM_WrapI32(a, op, b) ((i32)((u32)(a) op (u32)(b)))
+
+// x / 0 and i32_min / -1 have no result. C leaves both undefined and x86 faults on them,
+// so every division checks first and the run stops with an error instead
+static b8 VM_DivisionTraps(i32 a, i32 b) {
+	return b == 0 || (a == i32_min && b == -1);
+}
+
+const char* VM_DivisionError(i32 divisor) {
+	return divisor == 0 ? "division by zero" : "integer overflow in division";
+}
+
+// Which operand fields an opcode reads and writes, the peephole pass needs it for liveness
+enum {
+	VM_Use_WriteA = 1 << 0,
+	VM_Use_ReadA  = 1 << 1,
+	VM_Use_ReadB  = 1 << 2,
+	VM_Use_ReadC  = 1 << 3,
+	VM_Use_Extra  = 1 << 4, // Followed by one operand word
+	VM_Use_ReadX  = 1 << 5, // That word is a register index that gets read
+	VM_Use_Call   = 1 << 6, // Reads the arguments from A up and clobbers everything from A up
+	VM_Use_Native = 1 << 7, // Reads the arguments from A up, nothing else
+};
+
+static const u8 vm_operand_usage[Opcode_COUNT] = {
+	[Opcode_Nop]           = 0,
+	[Opcode_LoadConst]     = VM_Use_WriteA,
+	[Opcode_LoadConstWide] = VM_Use_WriteA | VM_Use_Extra,
+	[Opcode_LoadSmallInt]  = VM_Use_WriteA,
+	[Opcode_LoadInput]     = VM_Use_WriteA,
+	[Opcode_Move]          = VM_Use_WriteA | VM_Use_ReadB,
+	[Opcode_UnaryOp]       = VM_Use_WriteA | VM_Use_ReadB | VM_Use_Extra,
+	[Opcode_BinaryOp]      = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC | VM_Use_Extra,
+	[Opcode_Print]         = VM_Use_ReadA,
+	[Opcode_Return]        = VM_Use_ReadA,
+	[Opcode_Halt]          = 0,
+	[Opcode_Call]          = VM_Use_WriteA | VM_Use_Call,
+	[Opcode_TailCall]      = VM_Use_Call,
+	[Opcode_CallNative]    = VM_Use_WriteA | VM_Use_Native,
+	[Opcode_Jump]          = VM_Use_Extra,
+	[Opcode_JumpIfFalse]   = VM_Use_ReadA | VM_Use_Extra,
+	[Opcode_Loop]          = VM_Use_Extra,
+	[Opcode_AddI32]        = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC,
+	[Opcode_SubI32]        = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC,
+	[Opcode_MulI32]        = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC,
+	[Opcode_DivI32]        = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC,
+	[Opcode_ModI32]        = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC,
+	[Opcode_NegI32]        = VM_Use_WriteA | VM_Use_ReadB,
+	[Opcode_LtI32]         = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC,
+	[Opcode_LeI32]         = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC,
+	[Opcode_EqI32]         = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC,
+	[Opcode_NeI32]         = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC,
+	[Opcode_AddI32K]       = VM_Use_WriteA | VM_Use_ReadB,
+	[Opcode_MulAddI32]     = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC | VM_Use_Extra | VM_Use_ReadX,
+	[Opcode_AddPrintI32]   = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC,
+	[Opcode_AddI32Quick]   = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC | VM_Use_Extra,
+	[Opcode_SubI32Quick]   = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC | VM_Use_Extra,
+	[Opcode_MulI32Quick]   = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC | VM_Use_Extra,
+	[Opcode_DivI32Quick]   = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC | VM_Use_Extra,
+	[Opcode_ModI32Quick]   = VM_Use_WriteA | VM_Use_ReadB | VM_Use_ReadC | VM_Use_Extra,
+};
+
+//~ Lowering
+
+// Locals keep a register for their scope, temporaries go on top and are freed once consumed
+HashTable_Prototype(u64, u32);
+
+// Function bodies are lowered one at a time after the top level code, each with
+// registers starting over at 0. frame_size is the high water mark of the current one
+typedef struct VM_Lowerer {
+	IR_Chunk* chunk;
+	u32 next_register;
+	u32 frame_size;
+	darray(u8) symbol_registers; // C_SymbolID -> register
+	darray(u32) symbol_functions; // C_SymbolID -> index into chunk->functions, or chunk->natives | VM_NATIVE_INDEX
+	darray(IR_AstRef) function_asts; // Index into chunk->functions -> its AstType_ExprFunc
+	hash_table(u64, u32) constant_indices; // Packed constant -> index + 1 into chunk->constants
+	
+	IR_Ast* function; // Whose body is being lowered, null for the top level code
+	b8 out_of_registers;
+	IR_Ast* out_of_registers_in; // The first function that ran out, null for the top level code
+} VM_Lowerer;
+
+#define VM_ANY_REGISTER -1
+
+// Past VM_MAX_REGISTERS lowering carries on with the last register, so the marks that
+// release temporaries still line up and every function gets checked. The chunk is thrown away
+static u8 VM_AllocRegister(VM_Lowerer* lowerer) {
+	if (lowerer->next_register >= VM_MAX_REGISTERS) {
+		if (!lowerer->out_of_registers) lowerer->out_of_registers_in = lowerer->function;
+		lowerer->out_of_registers = true;
+		lowerer->next_register++;
+		return VM_MAX_REGISTERS - 1;
+	}
+	u8 ret = (u8) lowerer->next_register++;
+	if (lowerer->next_register > lowerer->frame_size)
+		lowerer->frame_size = lowerer->next_register;
+	return ret;
+}
+
+static void VM_ReportOutOfRegisters(VM_Lowerer* lowerer) {
+	IR_Ast* function = lowerer->out_of_registers_in;
+	if (function) {
+		printf("Lowering error (%u:%u): More than %u values are live at once in this function\n",
+			   function->func.token.line, function->func.token.column, VM_MAX_REGISTERS);
+	} else {
+		printf("Lowering error: More than %u values are live at once in the top level code\n", VM_MAX_REGISTERS);
+	}
+}
+
+static void VM_EmitInstruction(VM_Lowerer* lowerer, VM_Opcode op, u8 a, u8 b, u8 c) {
+	IR_ChunkPushInstruction(lowerer->chunk, (u8) op, a, b, c);
+}
+
+#define U64KeyIsNull(k) ((k) == 0)
+#define U64KeyIsEqual(a, b) ((a) == (b))
+#define U64HashKey(k) ((u32)((k) ^ ((k) >> 32)))
+#define U32IsNull(v) ((v) == 0)
+#define U32IsTombstone(v) ((v) == u32_max)
+
+HashTable_Impl(u64, u32, U64KeyIsNull, U64KeyIsEqual, U64HashKey, u32_max, U32IsNull, U32IsTombstone);
+
+// Decoded form of one instruction, only used while optimizing
+typedef struct VM_Instruction {
+	u8 op, a, b, c;
+	u32 extra; // Instruction index instead of offset for jumps
+	u8 dead; // VM_Use_Read* bits of registers that are not read again before being overwritten
+	b8 target; // Some jump lands here
+} VM_Instruction;
+
+DArray_Prototype(VM_Instruction);
+DArray_Impl(VM_Instruction);
+
+static u32 VM_AddConstant(VM_Lowerer* lowerer, VM_RuntimeValue value) {
+	// type is never 0 here so the packed key is never the empty key
+	u64 key = ((u64) value.type << 32) | (u32) value.as_int;
+	u32 index;
+	if (hash_table_get(u64, u32, &lowerer->constant_indices, key, &index))
+		return index - 1;
+	
+	index = lowerer->chunk->constants.len;
+	darray_add(VM_RuntimeValue, &lowerer->chunk->constants, value);
+	hash_table_set(u64, u32, &lowerer->constant_indices, key, index + 1);
+	return index;
+}
+
+static VM_Instruction VM_MakeLoad(VM_Lowerer* lowerer, u8 dst, VM_RuntimeValue value) {
+	if (value.type == RuntimeValueType_Integer && value.as_int >= -32768 && value.as_int <= 32767) {
+		u16 imm = (u16)(i16) value.as_int;
+		return (VM_Instruction) { .op = Opcode_LoadSmallInt, .a = dst, .b = imm & 0xFF, .c = imm >> 8 };
+	}
+	
+	u32 index = VM_AddConstant(lowerer, value);
+	if (index <= 0xFFFF)
+		return (VM_Instruction) { .op = Opcode_LoadConst, .a = dst, .b = index & 0xFF, .c = index >> 8 };
+	return (VM_Instruction) { .op = Opcode_LoadConstWide, .a = dst, .extra = index };
+}
+
+static void VM_EmitLoadValue(VM_Lowerer* lowerer, u8 dst, VM_RuntimeValue value) {
+	VM_Instruction load = VM_MakeLoad(lowerer, dst, value);
+	VM_EmitInstruction(lowerer, load.op, load.a, load.b, load.c);
+	if (load.op == Opcode_LoadConstWide) IR_ChunkPushU32(lowerer->chunk, load.extra);
+}
+
+// Emits a jump whose target isn't known yet, returns where VM_PatchJump writes it
+static u32 VM_EmitJump(VM_Lowerer* lowerer, VM_Opcode op, u8 a) {
+	VM_EmitInstruction(lowerer, op, a, 0, 0);
+	IR_ChunkPushU32(lowerer->chunk, 0);
+	return lowerer->chunk->code.len - 1;
+}
+
+// Points the jump at whatever gets emitted next
+static void VM_PatchJump(VM_Lowerer* lowerer, u32 at) {
+	lowerer->chunk->code.elems[at] = lowerer->chunk->code.len;
+}
+
+static u8 VM_TargetRegister(VM_Lowerer* lowerer, i32 target) {
+	return target == VM_ANY_REGISTER ? VM_AllocRegister(lowerer) : (u8) target;
+}
+
+static u8 VM_DeclareLocal(VM_Lowerer* lowerer, u32 symbol) {
+	u8 local = VM_AllocRegister(lowerer);
+	while (lowerer->symbol_registers.len <= symbol)
+		darray_add(u8, &lowerer->symbol_registers, 0);
+	lowerer->symbol_registers.elems[symbol] = local;
+	return local;
+}
+
+#define VM_NATIVE_INDEX 0x80000000u
+
+// The body is lowered later by VM_LowerFunction, calls only need the index.
+// Natives only need their name, that gets looked up once the chunk is done
+static void VM_DeclareFunction(VM_Lowerer* lowerer, u32 symbol, L_Token name, IR_Ast* ast) {
+	IR_Chunk* chunk = lowerer->chunk;
+	u32 index;
+	if (ast->func.body) {
+		index = chunk->functions.len;
+		AssertTrue(index <= 0xFFFF, "Ran out of VM function indices");
+		VM_Function function = { .param_count = ast->func.param_count };
+		darray_add(VM_Function, &chunk->functions, function);
+		darray_add(IR_AstRef, &lowerer->function_asts, ast);
+	} else {
+		AssertTrue(chunk->natives.len <= 0xFFFF, "Ran out of VM native indices");
+		VM_Native native = {
+			.name_offset = chunk->native_names.len,
+			.param_count = ast->func.param_count,
+			.has_result = ast->func.return_type.type != TokenType_Error,
+		};
+		index = chunk->natives.len | VM_NATIVE_INDEX;
+		darray_add(VM_Native, &chunk->natives, native);
+		darray_add_all(u8, &chunk->native_names, name.lexeme.str, (u32) name.lexeme.size);
+		do darray_add(u8, &chunk->native_names, 0); while (chunk->native_names.len % 4);
+	}
+	
+	while (lowerer->symbol_functions.len <= symbol)
+		darray_add(u32, &lowerer->symbol_functions, 0);
+	lowerer->symbol_functions.elems[symbol] = index;
+}
+
+static u8 VM_LowerExpr(VM_Lowerer* lowerer, IR_Ast* ast, i32 target);
+
+// Arguments are lowered straight into the callee's window on top of the
+// registers in use. The window always gets a register, it holds the result
+static u8 VM_LowerCallArgs(VM_Lowerer* lowerer, IR_Ast* ast) {
+	u8 window = VM_AllocRegister(lowerer);
+	for (u32 i = 1; i < ast->call.arg_count; i++) VM_AllocRegister(lowerer);
+	for (u32 i = 0; i < ast->call.arg_count; i++) {
+		VM_LowerExpr(lowerer, ast->call.args[i], window + i);
+	}
+	return window;
+}
+
+static b8 VM_IsNativeCall(VM_Lowerer* lowerer, IR_Ast* ast) {
+	return (lowerer->symbol_functions.elems[ast->call.symbol] & VM_NATIVE_INDEX) != 0;
+}
+
+// Calls to natives are always Opcode_CallNative, whatever op is
+static void VM_EmitCall(VM_Lowerer* lowerer, VM_Opcode op, u8 window, IR_Ast* ast) {
+	u32 index = lowerer->symbol_functions.elems[ast->call.symbol];
+	if (index & VM_NATIVE_INDEX) op = Opcode_CallNative;
+	index &= ~VM_NATIVE_INDEX;
+	VM_EmitInstruction(lowerer, op, window, index & 0xFF, index >> 8);
+}
+
+// Returns the register that holds the value, which is target unless it is VM_ANY_REGISTER
+static u8 VM_LowerExpr(VM_Lowerer* lowerer, IR_Ast* ast, i32 target) {
 	switch (ast->type) {
 		case AstType_IntLiteral: {
-			IR_ChunkPushOp(chunk, Opcode_Push);
+			u8 dst = VM_TargetRegister(lowerer, target);
 			VM_RuntimeValue value = {
 				.type = RuntimeValueType_Integer,
 				.as_int = ast->int_lit.value,
 			};
-			IR_ChunkPush(chunk, &value, sizeof(VM_RuntimeValue));
+			VM_EmitLoadValue(lowerer, dst, value);
+			return dst;
 		} break;
 		
-		case AstType_FloatLiteral: {
-			// TODO(voxel):
+		case AstType_ExprIdent: {
+			u8 local = lowerer->symbol_registers.elems[ast->ident.symbol];
+			if (target == VM_ANY_REGISTER) return local;
+			if (target != local) VM_EmitInstruction(lowerer, Opcode_Move, (u8) target, local, 0);
+			return (u8) target;
 		} break;
 		
 		case AstType_ExprUnary: {
-			VM_Lower(chunk, ast->unary.operand);
-			IR_ChunkPushOp(chunk, Opcode_UnaryOp);
-			IR_ChunkPushU32(chunk, ast->unary.operator.type);
+			u32 mark = lowerer->next_register;
+			u8 operand = VM_LowerExpr(lowerer, ast->unary.operand, VM_ANY_REGISTER);
+			VM_Opcode specialized = VM_SpecializeUnaryOp(ast->unary.operand->expr_type, ast->unary.operator.type);
+			
+			if (specialized == Opcode_Nop) {
+				if (target == VM_ANY_REGISTER || target == operand) return operand;
+				lowerer->next_register = mark;
+				VM_EmitInstruction(lowerer, Opcode_Move, (u8) target, operand, 0);
+				return (u8) target;
+			}
+			
+			lowerer->next_register = mark;
+			u8 dst = VM_TargetRegister(lowerer, target);
+			if (specialized != Opcode_COUNT) {
+				VM_EmitInstruction(lowerer, specialized, dst, operand, 0);
+			} else {
+				VM_EmitInstruction(lowerer, Opcode_UnaryOp, dst, operand, 0);
+				IR_ChunkPushU32(lowerer->chunk, ast->unary.operator.type);
+			}
+			return dst;
 		} break;
 		
 		case AstType_ExprBinary: {
-			VM_Lower(chunk, ast->binary.a);
-			VM_Lower(chunk, ast->binary.b);
-			IR_ChunkPushOp(chunk, Opcode_BinaryOp);
-			IR_ChunkPushU32(chunk, ast->binary.operator.type);
+			u32 mark = lowerer->next_register;
+			u8 a = VM_LowerExpr(lowerer, ast->binary.a, VM_ANY_REGISTER);
+			u8 b = VM_LowerExpr(lowerer, ast->binary.b, VM_ANY_REGISTER);
+			lowerer->next_register = mark;
+			
+			u8 dst = VM_TargetRegister(lowerer, target);
+			L_TokenType op = ast->binary.operator.type;
+			// a > b is b < a, the operands still get evaluated left to right
+			if (op == TokenType_Greater || op == TokenType_GreaterEqual) {
+				VM_Opcode swapped = VM_SpecializeBinaryOp(ast->binary.a->expr_type, ast->binary.b->expr_type,
+														  op == TokenType_Greater ? TokenType_Less : TokenType_LessEqual);
+				if (swapped != Opcode_COUNT) {
+					VM_EmitInstruction(lowerer, swapped, dst, b, a);
+					return dst;
+				}
+			}
+			
+			VM_Opcode specialized = VM_SpecializeBinaryOp(ast->binary.a->expr_type, ast->binary.b->expr_type, op);
+			if (specialized != Opcode_COUNT) {
+				VM_EmitInstruction(lowerer, specialized, dst, a, b);
+			} else {
+				VM_EmitInstruction(lowerer, Opcode_BinaryOp, dst, a, b);
+				IR_ChunkPushU32(lowerer->chunk, VM_QuickenOperand(op, 0));
+			}
+			return dst;
+		} break;
+		
+		case AstType_ExprCall: {
+			u32 mark = lowerer->next_register;
+			u8 window = VM_LowerCallArgs(lowerer, ast);
+			VM_EmitCall(lowerer, Opcode_Call, window, ast);
+			lowerer->next_register = mark;
+			
+			// window is mark, so the result stays where it is
+			if (target == VM_ANY_REGISTER) return VM_AllocRegister(lowerer);
+			VM_EmitInstruction(lowerer, Opcode_Move, (u8) target, window, 0);
+			return (u8) target;
 		} break;
 		
+		default: {
+			// TODO(voxel): Float literals
+		} break;
+	}
+	return 0;
+}
+
+static void VM_LowerStmt(VM_Lowerer* lowerer, IR_Ast* ast) {
+	switch (ast->type) {
 		case AstType_StmtPrint: {
-			VM_Lower(chunk, ast->print.value);
-			IR_ChunkPushOp(chunk, Opcode_Print);
+			u32 mark = lowerer->next_register;
+			u8 value = VM_LowerExpr(lowerer, ast->print.value, VM_ANY_REGISTER);
+			VM_EmitInstruction(lowerer, Opcode_Print, value, 0, 0);
+			lowerer->next_register = mark;
+		} break;
+		
+		case AstType_StmtVarDecl: {
+			if (ast->var_decl.value && ast->var_decl.value->type == AstType_ExprFunc) {
+				VM_DeclareFunction(lowerer, ast->var_decl.symbol, ast->var_decl.name, ast->var_decl.value);
+				break;
+			}
+			
+			u8 local = VM_DeclareLocal(lowerer, ast->var_decl.symbol);
+			if (ast->var_decl.value) {
+				VM_LowerExpr(lowerer, ast->var_decl.value, local);
+			} else {
+				VM_RuntimeValue zero = { .type = RuntimeValueType_Integer, .as_int = 0 };
+				VM_EmitLoadValue(lowerer, local, zero);
+			}
+		} break;
+		
+		case AstType_StmtAssign: {
+			u8 local = lowerer->symbol_registers.elems[ast->assign.symbol];
+			VM_LowerExpr(lowerer, ast->assign.value, local);
+		} break;
+		
+		case AstType_StmtBlock: {
+			u32 mark = lowerer->next_register;
+			for (u32 i = 0; i < ast->block.count; i++) {
+				VM_LowerStmt(lowerer, ast->block.statements[i]);
+			}
+			lowerer->next_register = mark;
+		} break;
+		
+		case AstType_StmtReturn: {
+			u32 mark = lowerer->next_register;
+			IR_Ast* value = ast->return_stmt.value;
+			if (!value) {
+				VM_EmitInstruction(lowerer, Opcode_Return, 0, 0, 0);
+			} else if (value->type == AstType_ExprCall && !VM_IsNativeCall(lowerer, value)) {
+				// Always a tail call, so recursion in tail position runs in constant stack
+				u8 window = VM_LowerCallArgs(lowerer, value);
+				VM_EmitCall(lowerer, Opcode_TailCall, window, value);
+			} else {
+				// R[0] is where the caller looks, and nothing reads the frame after this
+				VM_LowerExpr(lowerer, value, 0);
+				VM_EmitInstruction(lowerer, Opcode_Return, 0, 0, 0);
+			}
+			lowerer->next_register = mark;
+		} break;
+		
+		case AstType_StmtExpr: {
+			u32 mark = lowerer->next_register;
+			VM_LowerExpr(lowerer, ast->expr_stmt.expr, VM_ANY_REGISTER);
+			lowerer->next_register = mark;
+		} break;
+		
+		// Bodies get their own registers like blocks do, they are scopes in the checker too
+		case AstType_StmtIf: {
+			u32 mark = lowerer->next_register;
+			u8 condition = VM_LowerExpr(lowerer, ast->if_stmt.condition, VM_ANY_REGISTER);
+			lowerer->next_register = mark;
+			u32 to_else = VM_EmitJump(lowerer, Opcode_JumpIfFalse, condition);
+			VM_LowerStmt(lowerer, ast->if_stmt.then_body);
+			lowerer->next_register = mark;
+			if (!ast->if_stmt.else_body) {
+				VM_PatchJump(lowerer, to_else);
+				break;
+			}
+			
+			// A then branch that always returns has nothing to jump over the else.
+			// The jump would land past the end of the function if the else returns too
+			u32 to_end = C_EndsWithReturn(ast->if_stmt.then_body) ? 0 : VM_EmitJump(lowerer, Opcode_Jump, 0);
+			VM_PatchJump(lowerer, to_else);
+			VM_LowerStmt(lowerer, ast->if_stmt.else_body);
+			lowerer->next_register = mark;
+			if (to_end) VM_PatchJump(lowerer, to_end);
+		} break;
+		
+		case AstType_StmtWhile: {
+			u32 mark = lowerer->next_register;
+			u32 header = lowerer->chunk->code.len;
+			u8 condition = VM_LowerExpr(lowerer, ast->while_stmt.condition, VM_ANY_REGISTER);
+			lowerer->next_register = mark;
+			u32 to_exit = VM_EmitJump(lowerer, Opcode_JumpIfFalse, condition);
+			VM_LowerStmt(lowerer, ast->while_stmt.body);
+			lowerer->next_register = mark;
+			
+			u32 loop = lowerer->chunk->loop_count++;
+			AssertTrue(loop <= 0xFFFFFF, "Ran out of VM loop indices");
+			VM_EmitInstruction(lowerer, Opcode_Loop, loop & 0xFF, (loop >> 8) & 0xFF, loop >> 16);
+			IR_ChunkPushU32(lowerer->chunk, header);
+			VM_PatchJump(lowerer, to_exit);
 		} break;
 		
 		default: {} break;
 	}
 }
 
-IR_Chunk VM_LowerConstexpr(IR_Ast* ast) {
-	IR_Chunk chunk = IR_ChunkAlloc();
-	VM_Lower(&chunk, ast);
-	return chunk;
+//~ Peephole optimizer
+
+// Runs on each function right after lowering. Jump targets are instruction indices meanwhile,
+// and nothing is folded or fused across a jump or jump target
+
+static b8 VM_IsJump(VM_Opcode op) {
+	return op == Opcode_Jump || op == Opcode_JumpIfFalse || op == Opcode_Loop;
+}
+
+// The next instruction is only reached by jumping to it
+static b8 VM_EndsFlow(VM_Opcode op) {
+	switch (op) {
+		case Opcode_Jump:
+		case Opcode_Loop:
+		case Opcode_Return:
+		case Opcode_Halt:
+		case Opcode_TailCall: return true;
+	}
+	return false;
+}
+
+typedef struct VM_RegisterSet {
+	u64 bits[VM_MAX_REGISTERS / 64];
+} VM_RegisterSet;
+
+#define VM_SetHas(set, r)    (((set)->bits[(r) >> 6] >> ((r) & 63)) & 1)
+#define VM_SetAdd(set, r)    ((set)->bits[(r) >> 6] |= 1ull << ((r) & 63))
+#define VM_SetRemove(set, r) ((set)->bits[(r) >> 6] &= ~(1ull << ((r) & 63)))
+
+// Turns the registers live after ins into the ones live before it,
+// marking the operands nothing reads afterwards on the way
+static void VM_StepLiveness(IR_Chunk* chunk, VM_Instruction* ins, VM_RegisterSet* live) {
+	u8 usage = vm_operand_usage[ins->op];
+	
+	ins->dead = 0;
+	if ((usage & VM_Use_WriteA) && !VM_SetHas(live, ins->a)) ins->dead |= VM_Use_WriteA;
+	if ((usage & VM_Use_ReadA) && !VM_SetHas(live, ins->a)) ins->dead |= VM_Use_ReadA;
+	if ((usage & VM_Use_ReadB) && !VM_SetHas(live, ins->b)) ins->dead |= VM_Use_ReadB;
+	if ((usage & VM_Use_ReadC) && !VM_SetHas(live, ins->c)) ins->dead |= VM_Use_ReadC;
+	if ((usage & VM_Use_ReadX) && !VM_SetHas(live, ins->extra)) ins->dead |= VM_Use_ReadX;
+	
+	if (usage & VM_Use_WriteA) VM_SetRemove(live, ins->a);
+	if (usage & VM_Use_ReadA) VM_SetAdd(live, ins->a);
+	if (usage & VM_Use_ReadB) VM_SetAdd(live, ins->b);
+	if (usage & VM_Use_ReadC) VM_SetAdd(live, ins->c);
+	if (usage & VM_Use_ReadX) VM_SetAdd(live, ins->extra);
+	
+	if (usage & VM_Use_Call) {
+		// Nothing of this frame is read after a tail call
+		u32 args = chunk->functions.elems[ins->b | (ins->c << 8)].param_count;
+		for (u32 r = ins->op == Opcode_TailCall ? 0 : ins->a; r < VM_MAX_REGISTERS; r++) {
+			if (r >= ins->a && r < ins->a + args) VM_SetAdd(live, r);
+			else VM_SetRemove(live, r);
+		}
+	}
+	if (usage & VM_Use_Native) {
+		u32 args = chunk->natives.elems[ins->b | (ins->c << 8)].param_count;
+		for (u32 r = ins->a; r < ins->a + args; r++) VM_SetAdd(live, r);
+	}
+}
+
+// Backwards sweeps until the registers live into every instruction stop changing.
+// Without a loop everything flows backwards and the first sweep is the only one
+// Returns the registers live into each instruction, count + 1 of them, the caller frees it
+static VM_RegisterSet* VM_ComputeLiveness(IR_Chunk* chunk, VM_Instruction* code, u32 count) {
+	// live_in[count] is past the end, a jump there leaves the function with nothing live
+	VM_RegisterSet* live_in = calloc(count + 1, sizeof(VM_RegisterSet));
+	b8 has_loops = false;
+	for (u32 i = 0; i < count; i++) has_loops |= code[i].op == Opcode_Loop;
+	
+	b8 changed;
+	do {
+		changed = false;
+		for (u32 i = count; i-- > 0;) {
+			VM_Instruction* ins = &code[i];
+			VM_RegisterSet live = {0};
+			if (!VM_EndsFlow(ins->op)) live = live_in[i + 1];
+			if (VM_IsJump(ins->op)) {
+				for (u32 w = 0; w < ArrayCount(live.bits); w++) live.bits[w] |= live_in[ins->extra].bits[w];
+			}
+			
+			VM_StepLiveness(chunk, ins, &live);
+			if (memcmp(&live, &live_in[i], sizeof(live)) != 0) {
+				live_in[i] = live;
+				changed = true;
+			}
+		}
+	} while (changed && has_loops);
+	return live_in;
+}
+
+// No side effects and no traps, so it can go if nobody reads the result
+static b8 VM_IsPure(VM_Opcode op) {
+	switch (op) {
+		case Opcode_LoadConst:
+		case Opcode_LoadConstWide:
+		case Opcode_LoadSmallInt:
+		case Opcode_LoadInput:
+		case Opcode_Move:
+		case Opcode_AddI32:
+		case Opcode_SubI32:
+		case Opcode_MulI32:
+		case Opcode_NegI32:
+		case Opcode_LtI32:
+		case Opcode_LeI32:
+		case Opcode_EqI32:
+		case Opcode_NeI32:
+		case Opcode_AddI32K:
+		case Opcode_MulAddI32: return true;
+	}
+	return false;
+}
+
+static b8 VM_ReadsRegister(VM_Instruction* ins, u8 reg) {
+	u8 usage = vm_operand_usage[ins->op];
+	return ((usage & VM_Use_ReadA) && ins->a == reg) || ((usage & VM_Use_ReadB) && ins->b == reg) ||
+		((usage & VM_Use_ReadC) && ins->c == reg) || ((usage & VM_Use_ReadX) && ins->extra == reg);
+}
+
+static b8 VM_GetLoadedConstant(IR_Chunk* chunk, VM_Instruction* ins, VM_RuntimeValue* value) {
+	switch (ins->op) {
+		case Opcode_LoadSmallInt: {
+			value->type = RuntimeValueType_Integer;
+			value->as_int = (i16)(ins->b | (ins->c << 8));
+		} return true;
+		case Opcode_LoadConst: *value = chunk->constants.elems[ins->b | (ins->c << 8)]; return true;
+		case Opcode_LoadConstWide: *value = chunk->constants.elems[ins->extra]; return true;
+	}
+	return false;
+}
+
+// Index into out of the constant load that produced reg for ins, or -1 if there is none
+// in the current block (out from block_start on) or the register is read again later
+static i32 VM_FindConstantOperand(IR_Chunk* chunk, darray(VM_Instruction)* out, u32 block_start,
+								  VM_Instruction* ins, u8 reg, u8 read_bit, VM_RuntimeValue* value) {
+	b8 consumed = (ins->dead & read_bit) || ((vm_operand_usage[ins->op] & VM_Use_WriteA) && ins->a == reg);
+	if (!consumed) return -1;
+	
+	for (u32 k = 1; k <= 2 && k <= out->len && out->len - k >= block_start; k++) {
+		VM_Instruction* prev = &out->elems[out->len - k];
+		if (!(vm_operand_usage[prev->op] & VM_Use_WriteA)) return -1;
+		if (VM_ReadsRegister(prev, reg)) return -1;
+		if (prev->a != reg) continue;
+		return VM_GetLoadedConstant(chunk, prev, value) ? (i32)(out->len - k) : -1;
+	}
+	return -1;
+}
+
+static b8 VM_FoldI32(VM_Opcode op, i32 a, i32 b, i32* result) {
+	// Wraps on overflow through VM_WrapI32, same as the interpreter and the JIT
+	switch (op) {
+		case Opcode_AddI32: *result = VM_WrapI32(a, +, b); return true;
+		case Opcode_SubI32: *result = VM_WrapI32(a, -, b); return true;
+		case Opcode_MulI32: *result = VM_WrapI32(a, *, b); return true;
+		case Opcode_DivI32:
+		case Opcode_ModI32: {
+			// Stays in the code, so the run stops with the division error once it gets there
+			if (VM_DivisionTraps(a, b)) return false;
+			*result = op == Opcode_DivI32 ? a / b : a % b;
+		} return true;
+		case Opcode_NegI32: *result = VM_WrapI32(0, -, a); return true;
+		case Opcode_Move: *result = a; return true;
+		case Opcode_LtI32: *result = a < b; return true;
+		case Opcode_LeI32: *result = a <= b; return true;
+		case Opcode_EqI32: *result = a == b; return true;
+		case Opcode_NeI32: *result = a != b; return true;
+	}
+	return false;
+}
+
+// Load x; Load y; Op -> Load (x op y), when the loaded registers die there
+static b8 VM_TryFold(VM_Lowerer* lowerer, darray(VM_Instruction)* out, u32 block_start, VM_Instruction* ins) {
+	IR_Chunk* chunk = lowerer->chunk;
+	VM_RuntimeValue x, y;
+	i32 result;
+	
+	switch (ins->op) {
+		case Opcode_Move:
+		case Opcode_NegI32: {
+			i32 bx = VM_FindConstantOperand(chunk, out, block_start, ins, ins->b, VM_Use_ReadB, &x);
+			if (bx == -1 || bx != (i32) out->len - 1) return false;
+			if (x.type != RuntimeValueType_Integer || !VM_FoldI32(ins->op, x.as_int, 0, &result)) return false;
+			out->len -= 1;
+		} break;
+		
+		case Opcode_AddI32:
+		case Opcode_SubI32:
+		case Opcode_MulI32:
+		case Opcode_DivI32:
+		case Opcode_ModI32:
+		case Opcode_LtI32:
+		case Opcode_LeI32:
+		case Opcode_EqI32:
+		case Opcode_NeI32: {
+			i32 bx = VM_FindConstantOperand(chunk, out, block_start, ins, ins->b, VM_Use_ReadB, &x);
+			i32 cx = VM_FindConstantOperand(chunk, out, block_start, ins, ins->c, VM_Use_ReadC, &y);
+			if (bx == -1 || cx == -1) return false;
+			if (x.type != RuntimeValueType_Integer || y.type != RuntimeValueType_Integer) return false;
+			if (!VM_FoldI32(ins->op, x.as_int, y.as_int, &result)) return false;
+			// Distinct loads are exactly the last two instructions
+			if (bx == cx && bx != (i32) out->len - 1) return false;
+			out->len -= bx == cx ? 1 : 2;
+		} break;
+		
+		default: return false;
+	}
+	
+	VM_RuntimeValue folded = { .type = RuntimeValueType_Integer, .as_int = result };
+	darray_add(VM_Instruction, out, VM_MakeLoad(lowerer, ins->a, folded));
+	return true;
+}
+
+// The most frequent pairs in examples/ under --stats=vm with VM_NO_PEEPHOLE, fused into one dispatch:
+//     LoadSmallInt t, k; AddI32 A, B, t  ->  AddI32K A, B, k
+//     MulI32 t, B, C; AddI32 A, x, t     ->  MulAddI32 A, B, C, x
+//     AddI32 A, B, C; Print A            ->  AddPrintI32 A, B, C
+static b8 VM_TryFuse(IR_Chunk* chunk, darray(VM_Instruction)* out, u32 block_start, VM_Instruction* ins) {
+	if (out->len <= block_start) return false;
+	VM_Instruction* prev = &out->elems[out->len - 1];
+	
+	switch (ins->op) {
+		case Opcode_AddI32:
+		case Opcode_SubI32: {
+			// x - k is x + (-k), the constant has to be on the right for Sub
+			for (u32 side = 0; side < 2; side++) {
+				if (side == 0 && ins->op == Opcode_SubI32) continue;
+				u8 reg = side == 0 ? ins->b : ins->c;
+				u8 other = side == 0 ? ins->c : ins->b;
+				if (reg == other) continue;
+				
+				VM_RuntimeValue k;
+				i32 at = VM_FindConstantOperand(chunk, out, block_start, ins, reg, side == 0 ? VM_Use_ReadB : VM_Use_ReadC, &k);
+				if (at == -1 || k.type != RuntimeValueType_Integer) continue;
+				i64 imm = ins->op == Opcode_SubI32 ? -(i64) k.as_int : k.as_int;
+				if (imm < -128 || imm > 127) continue;
+				
+				if (at == (i32) out->len - 2) out->elems[at] = out->elems[at + 1];
+				out->len -= 1;
+				*ins = (VM_Instruction) { .op = Opcode_AddI32K, .a = ins->a, .b = other, .c = (u8)(i8) imm };
+				return true;
+			}
+			
+			if (ins->op != Opcode_AddI32 || prev->op != Opcode_MulI32) return false;
+			u8 t = prev->a;
+			if (ins->b == ins->c || (ins->b != t && ins->c != t)) return false;
+			u8 read_bit = ins->b == t ? VM_Use_ReadB : VM_Use_ReadC;
+			if (!(ins->dead & read_bit) && ins->a != t) return false;
+			
+			u8 x = ins->b == t ? ins->c : ins->b;
+			*ins = (VM_Instruction) { .op = Opcode_MulAddI32, .a = ins->a, .b = prev->b, .c = prev->c, .extra = x };
+			out->len -= 1;
+			return true;
+		} break;
+		
+		case Opcode_Print: {
+			if (prev->op != Opcode_AddI32 || prev->a != ins->a) return false;
+			*ins = (VM_Instruction) { .op = Opcode_AddPrintI32, .a = prev->a, .b = prev->b, .c = prev->c };
+			out->len -= 1;
+			return true;
+		} break;
+	}
+	return false;
+}
+
+// Jump targets are instruction indices into code on the way in and into the result on the way out
+static b8 VM_PeepholePass(VM_Lowerer* lowerer, darray(VM_Instruction)* code) {
+	darray(VM_Instruction) out = {0};
+	darray_reserve(VM_Instruction, &out, code->len);
+	// Old index -> new index. A dropped instruction maps to whatever took its place
+	u32* remap = malloc((code->len + 1) * sizeof(u32));
+	u32 block_start = 0;
+	b8 reachable = true;
+	b8 changed = false;
+	
+	for (u32 i = 0; i < code->len; i++) {
+		VM_Instruction ins = code->elems[i];
+		remap[i] = out.len;
+		if (ins.target) {
+			block_start = out.len;
+			reachable = true;
+		}
+		
+		if (!reachable) {
+			changed = true;
+			continue;
+		}
+		if ((ins.dead & VM_Use_WriteA) && VM_IsPure(ins.op)) {
+			changed = true;
+			continue;
+		}
+		if (ins.op == Opcode_Move && ins.a == ins.b) {
+			changed = true;
+			continue;
+		}
+		
+		// A branch on a constant either always jumps or never does
+		VM_RuntimeValue condition;
+		if (ins.op == Opcode_JumpIfFalse &&
+			VM_FindConstantOperand(lowerer->chunk, &out, block_start, &ins, ins.a, VM_Use_ReadA, &condition) == (i32) out.len - 1) {
+			out.len -= 1;
+			changed = true;
+			if (condition.as_int) continue;
+			ins = (VM_Instruction) { .op = Opcode_Jump, .extra = ins.extra };
+		}
+		
+		if (VM_TryFold(lowerer, &out, block_start, &ins)) {
+			changed = true;
+			continue;
+		}
+		if (VM_TryFuse(lowerer->chunk, &out, block_start, &ins)) changed = true;
+		
+		darray_add(VM_Instruction, &out, ins);
+		if (VM_IsJump(ins.op)) block_start = out.len;
+		if (VM_EndsFlow(ins.op)) reachable = false;
+	}
+	remap[code->len] = out.len;
+	
+	for (u32 i = 0; i < out.len; i++) out.elems[i].target = false;
+	for (u32 i = 0; i < out.len; i++) {
+		VM_Instruction* ins = &out.elems[i];
+		if (!VM_IsJump(ins->op)) continue;
+		ins->extra = remap[ins->extra];
+		if (ins->extra < out.len) out.elems[ins->extra].target = true;
+	}
+	
+	free(remap);
+	darray_free(VM_Instruction, code);
+	*code = out;
+	return changed;
+}
+
+// Drops constants folding left unused. Indices only shrink, so loads keep their encoding
+static void VM_CompactConstants(IR_Chunk* chunk) {
+	if (!chunk->constants.len) return;
+	
+	u32* remap = malloc(chunk->constants.len * sizeof(u32));
+	for (u32 i = 0; i < chunk->constants.len; i++) remap[i] = u32_max;
+	darray(VM_RuntimeValue) constants = {0};
+	u32* code = chunk->code.elems;
+	
+	for (u32 i = 0; i < chunk->code.len; i++) {
+		u32 word = code[i];
+		VM_Opcode op = VM_DecodeOp(word);
+		if (op != Opcode_LoadConst && op != Opcode_LoadConstWide) {
+			if (vm_operand_usage[op] & VM_Use_Extra) i++;
+			continue;
+		}
+		
+		u32 index = op == Opcode_LoadConst ? VM_DecodeBx(word) : code[i + 1];
+		if (remap[index] == u32_max) {
+			remap[index] = constants.len;
+			darray_add(VM_RuntimeValue, &constants, chunk->constants.elems[index]);
+		}
+		
+		index = remap[index];
+		if (op == Opcode_LoadConst) code[i] = VM_Encode(op, VM_DecodeA(word), index & 0xFF, index >> 8);
+		else code[++i] = index;
+	}
+	
+	free(remap);
+	darray_free(VM_RuntimeValue, &chunk->constants);
+	chunk->constants = constants;
+}
+
+// Rewrites the code from start to the end of the chunk
+static void VM_Optimize(VM_Lowerer* lowerer, u32 start) {
+	IR_Chunk* chunk = lowerer->chunk;
+	
+	darray(VM_Instruction) code = {0};
+	darray_reserve(VM_Instruction, &code, chunk->code.len - start);
+	// Offset from start -> instruction index, a jump to a Nop lands on what follows it
+	u32* indices = malloc((chunk->code.len - start + 1) * sizeof(u32));
+	for (u32 i = start; i < chunk->code.len; i++) {
+		u32 word = chunk->code.elems[i];
+		indices[i - start] = code.len;
+		VM_Instruction ins = { .op = VM_DecodeOp(word), .a = VM_DecodeA(word), .b = VM_DecodeB(word), .c = VM_DecodeC(word) };
+		if (vm_operand_usage[ins.op] & VM_Use_Extra) ins.extra = chunk->code.elems[++i];
+		if (ins.op == Opcode_Nop) continue;
+		darray_add(VM_Instruction, &code, ins);
+	}
+	indices[chunk->code.len - start] = code.len;
+	for (u32 i = 0; i < code.len; i++) {
+		VM_Instruction* ins = &code.elems[i];
+		if (!VM_IsJump(ins->op)) continue;
+		ins->extra = indices[ins->extra - start];
+		if (ins->extra < code.len) code.elems[ins->extra].target = true;
+	}
+	free(indices);
+	
+	// Every fold or drop can make more registers dead, so go until nothing changes
+	VM_RegisterSet* live_in = VM_ComputeLiveness(chunk, code.elems, code.len);
+	while (VM_PeepholePass(lowerer, &code)) {
+		free(live_in);
+		live_in = VM_ComputeLiveness(chunk, code.elems, code.len);
+	}
+	
+	// And back to offsets
+	u32* offsets = malloc((code.len + 1) * sizeof(u32));
+	offsets[0] = start;
+	for (u32 i = 0; i < code.len; i++) {
+		offsets[i + 1] = offsets[i] + ((vm_operand_usage[code.elems[i].op] & VM_Use_Extra) ? 2 : 1);
+	}
+	
+	// Stack maps: the caller registers still read once each call returns
+	for (u32 i = 0; i < code.len; i++) {
+		VM_Instruction* ins = &code.elems[i];
+		if (ins->op != Opcode_Call) continue;
+		VM_StackMap map = { .ip = offsets[i + 1] };
+		for (u32 r = 0; r < ins->a; r++) {
+			if (VM_SetHas(&live_in[i + 1], r)) map.live[r / 32] |= 1u << (r % 32);
+		}
+		darray_add(VM_StackMap, &chunk->stack_maps, map);
+	}
+	free(live_in);
+	
+	chunk->code.len = start;
+	for (u32 i = 0; i < code.len; i++) {
+		VM_Instruction* ins = &code.elems[i];
+		IR_ChunkPushInstruction(chunk, ins->op, ins->a, ins->b, ins->c);
+		if (vm_operand_usage[ins->op] & VM_Use_Extra)
+			IR_ChunkPushU32(chunk, VM_IsJump(ins->op) ? offsets[ins->extra] : ins->extra);
+	}
+	free(offsets);
+	darray_free(VM_Instruction, &code);
+}
+
+static void VM_LowerFunction(VM_Lowerer* lowerer, u32 index) {
+	IR_Chunk* chunk = lowerer->chunk;
+	IR_Ast* ast = lowerer->function_asts.elems[index];
+	u32 entry = chunk->code.len;
+	lowerer->next_register = 0;
+	lowerer->frame_size = 0;
+	lowerer->function = ast;
+	
+	// The caller put the arguments in R[0], R[1]..
+	for (u32 i = 0; i < ast->func.param_count; i++) {
+		VM_DeclareLocal(lowerer, ast->func.param_symbols[i]);
+	}
+	VM_LowerStmt(lowerer, ast->func.body);
+	// The checker makes sure functions with a result end with a return
+	if (ast->func.return_type.type == TokenType_Error)
+		VM_EmitInstruction(lowerer, Opcode_Return, 0, 0, 0);
+#ifndef VM_NO_PEEPHOLE
+	if (!lowerer->out_of_registers) VM_Optimize(lowerer, entry);
+#endif
+	
+	VM_Function* function = &chunk->functions.elems[index];
+	function->entry = entry;
+	function->register_count = lowerer->frame_size;
+}
+
+// Lowers every function the top level declares, nested ones get appended to the same loop
+static b8 VM_FinishLowering(VM_Lowerer* lowerer) {
+	IR_Chunk* chunk = lowerer->chunk;
+	chunk->register_count = lowerer->frame_size;
+#ifndef VM_NO_PEEPHOLE
+	if (!lowerer->out_of_registers) VM_Optimize(lowerer, 0);
+#endif
+	for (u32 i = 0; i < lowerer->function_asts.len; i++) {
+		VM_LowerFunction(lowerer, i);
+	}
+	
+	darray_free(u8, &lowerer->symbol_registers);
+	darray_free(u32, &lowerer->symbol_functions);
+	darray_free(IR_AstRef, &lowerer->function_asts);
+	hash_table_free(u64, u32, &lowerer->constant_indices);
+	if (lowerer->out_of_registers) {
+		// Loop states only get allocated for chunks that lowered
+		chunk->loop_count = 0;
+		IR_ChunkFree(chunk);
+		*chunk = IR_ChunkAlloc();
+		return false;
+	}
+	
+#ifndef VM_NO_PEEPHOLE
+	VM_CompactConstants(chunk);
+#endif
+	VM_BindNatives(chunk);
+	if (chunk->loop_count) chunk->loops = calloc(chunk->loop_count, sizeof(VM_Loop));
+	// Lowered code is well formed, this only picks the handlers it runs through
+	VM_VerifyChunk(chunk);
+	return true;
+}
+
+b8 VM_LowerProgram(IR_Ast* ast, IR_Chunk* chunk) {
+	*chunk = IR_ChunkAlloc();
+	VM_Lowerer lowerer = { .chunk = chunk };
+	VM_LowerStmt(&lowerer, ast);
+	VM_EmitInstruction(&lowerer, Opcode_Halt, 0, 0, 0);
+	if (VM_FinishLowering(&lowerer)) return true;
+	VM_ReportOutOfRegisters(&lowerer);
+	return false;
+}
+
+b8 VM_LowerConstexpr(IR_Ast* ast, IR_Chunk* chunk) {
+	*chunk = IR_ChunkAlloc();
+	VM_Lowerer lowerer = { .chunk = chunk };
+	u8 result = VM_LowerExpr(&lowerer, ast, VM_ANY_REGISTER);
+	VM_EmitInstruction(&lowerer, Opcode_Return, result, 0, 0);
+	return VM_FinishLowering(&lowerer);
+}
+
+b8 VM_LowerBatchProgram(IR_Ast* ast, IR_Chunk* chunk, u32* input_count) {
+	*chunk = IR_ChunkAlloc();
+	VM_Lowerer lowerer = { .chunk = chunk };
+	u32 inputs = 0;
+	i32 result = -1;
+	
+	for (u32 k = 0; k < ast->block.count; k++) {
+		IR_Ast* stmt = ast->block.statements[k];
+		IR_Ast* value = stmt->type == AstType_StmtVarDecl ? stmt->var_decl.value : nullptr;
+		if (stmt->type != AstType_StmtVarDecl || (value && value->type == AstType_ExprFunc)) {
+			VM_LowerStmt(&lowerer, stmt);
+			continue;
+		}
+		
+		if (value) {
+			VM_LowerStmt(&lowerer, stmt);
+			result = lowerer.symbol_registers.elems[stmt->var_decl.symbol];
+		} else {
+			u8 local = VM_DeclareLocal(&lowerer, stmt->var_decl.symbol);
+			VM_EmitInstruction(&lowerer, Opcode_LoadInput, local, inputs & 0xFF, inputs >> 8);
+			inputs++;
+			result = local;
+		}
+	}
+	
+	// Nothing declared, there is no result and VM_RunChunkBatch refuses the chunk
+	if (result == -1) VM_EmitInstruction(&lowerer, Opcode_Halt, 0, 0, 0);
+	else VM_EmitInstruction(&lowerer, Opcode_Return, (u8) result, 0, 0);
+	*input_count = inputs;
+	if (VM_FinishLowering(&lowerer)) return true;
+	VM_ReportOutOfRegisters(&lowerer);
+	return false;
+}
+
+// What the generic ops compute once both operands are known to be ints
+static b8 VM_BinaryOpTraps(i32 a, i32 b, L_TokenType op) {
+	return (op == TokenType_Slash || op == TokenType_Percent) && VM_DivisionTraps(a, b);
+}
+
+// Callers check VM_BinaryOpTraps first
+static i32 VM_BinaryOpI32(i32 a, i32 b, L_TokenType op) {
+	switch (op) {
+		case TokenType_Plus: return VM_WrapI32(a, +, b);
+		case TokenType_Minus: return VM_WrapI32(a, -, b);
+		case TokenType_Star: return VM_WrapI32(a, *, b);
+		case TokenType_Slash: return a / b;
+		case TokenType_Percent: return a % b;
+		case TokenType_Less: return a < b;
+		case TokenType_Greater: return a > b;
+		case TokenType_LessEqual: return a <= b;
+		case TokenType_GreaterEqual: return a >= b;
+		case TokenType_EqualEqual: return a == b;
+		case TokenType_BangEqual: return a != b;
+	}
+	// TODO(voxel): Error Invalid operator
+	return a;
 }
 
+static i32 VM_UnaryOpI32(i32 value, L_TokenType op) {
+	if (op == TokenType_Plus) {
+		// NO OP
+	} else if (op == TokenType_Minus) {
+		value = VM_WrapI32(0, -, value);
+	} else {
+		// TODO(voxel): Error Invalid operator
+	}
+	return value;
+}
 
 static VM_RuntimeValue VM_BinaryOp(VM_RuntimeValue v1, VM_RuntimeValue v2, L_TokenType op) {
 	if (v1.type == RuntimeValueType_Integer && v2.type == RuntimeValueType_Integer) {
-		switch (op) {
-			case TokenType_Plus: v1.as_int = v1.as_int + v2.as_int; break;
-			case TokenType_Minus: v1.as_int = v1.as_int - v2.as_int; break;
-			case TokenType_Star: v1.as_int = v1.as_int * v2.as_int; break;
-			case TokenType_Slash: v1.as_int = v1.as_int / v2.as_int; break;
-			case TokenType_Percent: v1.as_int = v1.as_int % v2.as_int; break;
-		}
+		v1.as_int = VM_BinaryOpI32(v1.as_int, v2.as_int, op);
 	} else {
 		// TODO(voxel): Error Invalid type pair
 	}
 	return v1;
 }
 
-
 static VM_RuntimeValue VM_UnaryOp(VM_RuntimeValue value, L_TokenType op) {
 	if (value.type == RuntimeValueType_Integer) {
-		if (op == TokenType_Plus) {
-			// NO OP
-		} else if (op == TokenType_Minus) {
-			value.as_int = -value.as_int;
-		} else {
-			// TODO(voxel): Error Invalid operator
-		}
+		value.as_int = VM_UnaryOpI32(value.as_int, op);
 	} else {
 		// TODO(voxel): Error Invalid type
 	}
 	return value;
 }
 
-static void VM_Print(VM_RuntimeValue value) {
+void VM_Print(VM_RuntimeValue value) {
 	switch (value.type) {
 		case RuntimeValueType_Integer: {
 			printf("Int32 %d\n", value.as_int); 
@@ -114,51 +1179,1903 @@ static void VM_Print(VM_RuntimeValue value) {
 	}
 }
 
-#define PushValue() dstack_push(VM_RuntimeValue, &datastack, *(VM_RuntimeValue*)&chunk->elems[i])
-#define ReadOp() (*(L_TokenType*)&chunk->elems[i])
-VM_RuntimeValue VM_RunExprChunk(IR_Chunk* chunk) {
-	dstack(VM_RuntimeValue) datastack = {0};
-	
-	u32 i = 0;
-	while (i < chunk->len) {
-		switch (chunk->elems[i]) {
-			case Opcode_Nop: i++; break;
-			case Opcode_Push: {
-				i++;
-				PushValue();
-				i += sizeof(VM_RuntimeValue);
-			} break;
-			
-			case Opcode_Pop: {
-				i++;
-				dstack_pop(VM_RuntimeValue, &datastack);
-			} break;
-			
-			case Opcode_UnaryOp: {
-				i++;
-				L_TokenType op = ReadOp();
-				i += sizeof(L_TokenType);
-				VM_RuntimeValue v = dstack_pop(VM_RuntimeValue, &datastack);
-				v = VM_UnaryOp(v, op);
-				dstack_push(VM_RuntimeValue, &datastack, v);
-			} break;
-			
-			case Opcode_BinaryOp: {
-				i++;
-				L_TokenType op = ReadOp();
-				i += sizeof(L_TokenType);
-				VM_RuntimeValue v2 = dstack_pop(VM_RuntimeValue, &datastack);
-				VM_RuntimeValue v1 = dstack_pop(VM_RuntimeValue, &datastack);
-				v1 = VM_BinaryOp(v1, v2, op);
-				dstack_push(VM_RuntimeValue, &datastack, v1);
-			} break;
-			
-			case Opcode_Print: {
-				i++;
-				VM_RuntimeValue value = dstack_pop(VM_RuntimeValue, &datastack);
-				VM_Print(value);
-			} break;
-		}
-	}
+//~ Output
+
+void VM_OutputBufferInit(VM_OutputBuffer* buffer, FILE* file) {
+	buffer->file = file;
+	buffer->data = malloc(VM_OUTPUT_BUFFER_SIZE);
+	buffer->len = 0;
 }
-#undef PushValue
\ No newline at end of file
+
+void VM_OutputBufferFree(VM_OutputBuffer* buffer) {
+	VM_OutputBufferFlush(buffer);
+	free(buffer->data);
+}
+
+void VM_OutputBufferFlush(VM_OutputBuffer* buffer) {
+	if (!buffer->len) return;
+	fwrite(buffer->data, 1, buffer->len, buffer->file);
+	fflush(buffer->file);
+	buffer->len = 0;
+}
+
+// Writes the digits backwards from end, returns where they start
+static u8* VM_FormatI32(i32 value, u8* end) {
+	// Magnitude as u32 so i32_min doesn't overflow
+	u32 magnitude = value < 0 ? 0u - (u32) value : (u32) value;
+	do {
+		*--end = (u8)('0' + magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude);
+	if (value < 0) *--end = '-';
+	return end;
+}
+
+void VM_OutputBufferWrite(void* user_data, VM_RuntimeValue value) {
+	VM_OutputBuffer* buffer = user_data;
+	switch (value.type) {
+		case RuntimeValueType_Integer: {
+			// Same text as VM_Print, "Int32 -2147483648\n" is the longest
+			u8 text[32];
+			u8* end = text + sizeof(text);
+			*--end = '\n';
+			u8* start = VM_FormatI32(value.as_int, end);
+			start -= 6;
+			memcpy(start, "Int32 ", 6);
+			
+			u64 len = (u64)(text + sizeof(text) - start);
+			if (buffer->len + len > VM_OUTPUT_BUFFER_SIZE) VM_OutputBufferFlush(buffer);
+			memcpy(buffer->data + buffer->len, start, len);
+			buffer->len += len;
+		} break;
+		
+		default:; // TODO(voxel): Error Invalid type
+	}
+}
+
+//~ Call stacks
+
+// Makes room for size registers and one more frame, false if that is past VM_MAX_STACK_VALUES
+static b8 VM_StackGrow(VM_Stack* stack, u64 size) {
+	if (size > VM_MAX_STACK_VALUES || stack->frame_count >= VM_MAX_STACK_VALUES) return false;
+	if (size > stack->cap) {
+		u64 cap = Min(Max(size, (u64) stack->cap * 2), VM_MAX_STACK_VALUES);
+		stack->values = realloc(stack->values, sizeof(VM_RuntimeValue) * cap);
+		// The collector goes by type, fresh registers must not look like references
+		memset(stack->values + stack->cap, 0, sizeof(VM_RuntimeValue) * (cap - stack->cap));
+		stack->cap = (u32) cap;
+	}
+	if (stack->frame_count == stack->frame_cap) {
+		stack->frame_cap = DoubleCapacity(stack->frame_cap);
+		stack->frames = realloc(stack->frames, sizeof(VM_CallFrame) * stack->frame_cap);
+	}
+	return true;
+}
+
+// Drops every frame and makes room for the top level code of a chunk,
+// or for the deepest call chain of a verified one, whose calls don't check
+static void VM_StackReset(VM_Stack* stack, IR_Chunk* chunk) {
+	stack->chunk = chunk;
+	stack->base = 0;
+	stack->frame_count = 0;
+	// +1 so a chunk without registers still gets a valid frame pointer
+	u32 size = (chunk->verified ? chunk->max_stack : chunk->register_count) + 1;
+	if (size > stack->cap) VM_StackGrow(stack, size);
+	if (chunk->verified && chunk->max_frames > stack->frame_cap) {
+		stack->frame_cap = chunk->max_frames;
+		stack->frames = realloc(stack->frames, sizeof(VM_CallFrame) * stack->frame_cap);
+	}
+}
+
+static void VM_StackFree(VM_Stack* stack) {
+	free(stack->values);
+	free(stack->frames);
+}
+
+//~ Heap
+
+#define VM_NURSERY_START ((u32) VM_OLD_SPACE_SIZE)
+#define VM_OldSpaceStart(space) ((space) ? (u64) VM_OLD_SPACE_SIZE + VM_NURSERY_SIZE : 0)
+// Header and payload, 8-byte aligned
+#define VM_AllocationSize(size) (((u64) sizeof(VM_Object) + (size) + 7) & ~7ull)
+
+static void VM_HeapInit(VM_Heap* heap) {
+	MemoryZeroStruct(heap, VM_Heap);
+}
+
+// Most contexts never allocate, so the range is reserved on the first allocation
+static void VM_HeapReserve(VM_Heap* heap) {
+	heap->base = M_Reserve(VM_HEAP_RESERVE);
+	M_Commit(heap->base + VM_NURSERY_START, VM_NURSERY_SIZE);
+	heap->nursery_cursor = VM_NURSERY_START;
+	heap->nursery_limit = VM_NURSERY_START + VM_NURSERY_SIZE;
+	// Offset 0 is the null reference
+	heap->old_cursor = sizeof(VM_Object);
+	heap->old_committed[0] = 0;
+	heap->old_committed[1] = (u32) VM_OldSpaceStart(1);
+	heap->major_threshold = VM_MIN_MAJOR_THRESHOLD;
+}
+
+static void VM_HeapFree(VM_Heap* heap) {
+	if (heap->base) M_Release(heap->base, VM_HEAP_RESERVE);
+	darray_free(u32, &heap->remembered);
+	darray_free(VM_RootSlot, &heap->roots);
+	darray_free(VM_StackRef, &heap->stacks);
+}
+
+// 0 if that would leave less than slack bytes in the current old space
+static u32 VM_HeapBumpOld(VM_Heap* heap, u64 bytes, u64 slack) {
+	u64 end = (u64) heap->old_cursor + bytes;
+	u64 space_end = VM_OldSpaceStart(heap->old_space) + VM_OLD_SPACE_SIZE;
+	if (end + slack > space_end) return 0;
+	
+	u32* committed = &heap->old_committed[heap->old_space];
+	if (end > *committed) {
+		u64 commit_end = Min((end + VM_HEAP_COMMIT_SIZE - 1) & ~(VM_HEAP_COMMIT_SIZE - 1), space_end);
+		M_Commit(heap->base + *committed, commit_end - *committed);
+		*committed = (u32) commit_end;
+	}
+	u32 ref = heap->old_cursor;
+	heap->old_cursor = (u32) end;
+	return ref;
+}
+
+// Copies the object value references out of [from, from + size) once, leaving a forwarding header behind
+static void VM_HeapForward(VM_Heap* heap, VM_RuntimeValue* value, u32 from, u32 size) {
+	if (value->type != RuntimeValueType_Object || !value->as_ref || value->as_ref - from >= size) return;
+	
+	VM_Object* object = VM_HeapObject(heap, value->as_ref);
+	if (object->kind != ObjectKind_Forwarded) {
+		u64 bytes = VM_AllocationSize(object->size);
+		// Never 0, VM_HeapCollect only starts when every survivor fits
+		u32 ref = VM_HeapBumpOld(heap, bytes, 0);
+		VM_Object* copy = VM_HeapObject(heap, ref);
+		memcpy(copy, object, bytes);
+		object->kind = ObjectKind_Forwarded;
+		object->size = ref;
+	}
+	value->as_ref = object->size;
+}
+
+static void VM_HeapForwardObject(VM_Heap* heap, VM_Object* object, u32 from, u32 size) {
+	if (object->kind != ObjectKind_Values) return;
+	VM_RuntimeValue* values = VM_ObjectValues(object);
+	u32 count = object->size / sizeof(VM_RuntimeValue);
+	for (u32 i = 0; i < count; i++) VM_HeapForward(heap, &values[i], from, size);
+}
+
+VM_StackMap* VM_FindStackMap(IR_Chunk* chunk, u32 ip) {
+	u32 lo = 0;
+	u32 hi = chunk->stack_maps.len;
+	while (lo < hi) {
+		u32 mid = lo + (hi - lo) / 2;
+		if (chunk->stack_maps.elems[mid].ip < ip) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo < chunk->stack_maps.len && chunk->stack_maps.elems[lo].ip == ip) return &chunk->stack_maps.elems[lo];
+	return null;
+}
+
+// Frames suspended in a call go by their stack map and drop dead references. The innermost frame
+// can be stopped anywhere, so it and everything above it is scanned by type
+static void VM_HeapScanStack(VM_Heap* heap, VM_Stack* stack, u32 from, u32 size) {
+	for (u32 f = 0; f < stack->frame_count; f++) {
+		VM_CallFrame* frame = &stack->frames[f];
+		u32 callee_base = f + 1 < stack->frame_count ? stack->frames[f + 1].caller_base : stack->base;
+		VM_StackMap* map = stack->chunk ? VM_FindStackMap(stack->chunk, frame->return_ip) : null;
+		for (u32 r = frame->caller_base; r < callee_base; r++) {
+			VM_RuntimeValue* value = &stack->values[r];
+			if (value->type != RuntimeValueType_Object) continue;
+			u32 reg = r - frame->caller_base;
+			if (map && !(map->live[reg / 32] >> (reg % 32) & 1)) value->type = RuntimeValueType_Invalid;
+			else VM_HeapForward(heap, value, from, size);
+		}
+	}
+	for (u32 r = stack->base; r < stack->cap; r++) VM_HeapForward(heap, &stack->values[r], from, size);
+}
+
+u32 VM_HeapAlloc(VM_Heap* heap, VM_ObjectKind kind, u32 size) {
+	if (!heap->base) VM_HeapReserve(heap);
+	u64 bytes = VM_AllocationSize(size);
+	if (bytes > VM_OLD_SPACE_SIZE) return 0;
+	
+	u32 ref;
+	if (bytes > VM_MAX_NURSERY_OBJECT) {
+		// Leaves room to promote a full nursery
+		ref = VM_HeapBumpOld(heap, bytes, heap->nursery_limit - VM_NURSERY_START);
+		if (!ref) {
+			VM_HeapCollect(heap, true);
+			ref = VM_HeapBumpOld(heap, bytes, heap->nursery_limit - VM_NURSERY_START);
+			if (!ref) return 0;
+		}
+	} else {
+		if (heap->nursery_cursor + bytes > heap->nursery_limit) {
+			VM_HeapCollect(heap, false);
+			if (heap->nursery_cursor + bytes > heap->nursery_limit) return 0;
+		}
+		ref = heap->nursery_cursor;
+		heap->nursery_cursor += (u32) bytes;
+	}
+	
+	VM_Object* object = VM_HeapObject(heap, ref);
+	object->kind = kind;
+	object->size = size;
+	memset(object + 1, 0, bytes - sizeof(VM_Object));
+	return ref;
+}
+
+void VM_HeapStore(VM_Heap* heap, u32 ref, u32 index, VM_RuntimeValue value) {
+	u32 slot = ref + sizeof(VM_Object) + index * sizeof(VM_RuntimeValue);
+	*(VM_RuntimeValue*)(heap->base + slot) = value;
+	// An old slot pointing into the nursery is a root of the next minor collection
+	if (value.type == RuntimeValueType_Object && value.as_ref - VM_NURSERY_START < VM_NURSERY_SIZE &&
+		ref - VM_NURSERY_START >= VM_NURSERY_SIZE) {
+		darray_add(u32, &heap->remembered, slot);
+	}
+}
+
+void VM_HeapPushRoot(VM_Heap* heap, VM_RuntimeValue* slot) {
+	darray_add(VM_RootSlot, &heap->roots, slot);
+}
+
+void VM_HeapPopRoot(VM_Heap* heap) {
+	heap->roots.len -= 1;
+}
+
+void VM_HeapCollect(VM_Heap* heap, b8 major) {
+	if (!heap->base) return;
+	u64 start_ns = U_GetTimeNs();
+	
+	u64 old_used = heap->old_cursor - VM_OldSpaceStart(heap->old_space);
+	u64 nursery_used = heap->nursery_cursor - VM_NURSERY_START;
+	major = major || old_used + nursery_used > heap->major_threshold;
+	
+	u32 from = VM_NURSERY_START;
+	u32 size = VM_NURSERY_SIZE;
+	if (major) {
+		// The nursery sits between the old spaces, so it and the current one are one range
+		from = heap->old_space ? VM_NURSERY_START : 0;
+		size = VM_OLD_SPACE_SIZE + VM_NURSERY_SIZE;
+		heap->old_space ^= 1;
+		heap->old_cursor = heap->old_space ? (u32) VM_OldSpaceStart(1) : sizeof(VM_Object);
+	}
+	u32 scan = heap->old_cursor;
+	
+	for (u32 i = 0; i < heap->roots.len; i++) VM_HeapForward(heap, heap->roots.elems[i], from, size);
+	for (u32 i = 0; i < heap->stacks.len; i++) VM_HeapScanStack(heap, heap->stacks.elems[i], from, size);
+	// A major collection looks into every old object it keeps anyway
+	if (!major) {
+		for (u32 i = 0; i < heap->remembered.len; i++) {
+			VM_HeapForward(heap, (VM_RuntimeValue*)(heap->base + heap->remembered.elems[i]), from, size);
+		}
+	}
+	heap->remembered.len = 0;
+	
+	// Copied but not looked into yet
+	while (scan < heap->old_cursor) {
+		VM_Object* object = VM_HeapObject(heap, scan);
+		VM_HeapForwardObject(heap, object, from, size);
+		scan += (u32) VM_AllocationSize(object->size);
+	}
+	
+	heap->nursery_cursor = VM_NURSERY_START;
+	u64 survived = heap->old_cursor - VM_OldSpaceStart(heap->old_space);
+	heap->nursery_limit = VM_NURSERY_START + (u32) Min(VM_OLD_SPACE_SIZE - survived, VM_NURSERY_SIZE);
+	
+	u64 pause_ns = U_GetTimeNs() - start_ns;
+	heap->stats.total_pause_ns += pause_ns;
+	if (major) {
+		heap->major_threshold = Clamp(VM_MIN_MAJOR_THRESHOLD, 2 * survived, VM_OLD_SPACE_SIZE - VM_NURSERY_SIZE);
+		heap->stats.major_collections += 1;
+		heap->stats.max_major_pause_ns = Max(heap->stats.max_major_pause_ns, pause_ns);
+	} else {
+		heap->stats.promoted_bytes += survived - old_used;
+		heap->stats.minor_collections += 1;
+		heap->stats.max_minor_pause_ns = Max(heap->stats.max_minor_pause_ns, pause_ns);
+	}
+}
+
+//~ Execution contexts
+
+void VM_ContextInit(VM_Context* ctx) {
+	MemoryZeroStruct(ctx, VM_Context);
+	VM_OutputBufferInit(&ctx->stdout_buffer, stdout);
+	ctx->output = VM_OutputBufferWrite;
+	ctx->output_data = &ctx->stdout_buffer;
+	ctx->scratch = arena_make();
+	VM_HeapInit(&ctx->heap);
+	darray_add(VM_StackRef, &ctx->heap.stacks, &ctx->stack);
+}
+
+void VM_ContextFree(VM_Context* ctx) {
+	VM_OutputBufferFree(&ctx->stdout_buffer);
+	VM_StackFree(&ctx->stack);
+	arena_free(ctx->scratch);
+	VM_HeapFree(&ctx->heap);
+}
+
+void VM_ContextFlush(VM_Context* ctx) {
+	VM_OutputBufferFlush(&ctx->stdout_buffer);
+}
+
+void VM_ContextPrint(VM_Context* ctx, VM_RuntimeValue value) {
+	ctx->output(ctx->output_data, value);
+}
+
+#define A VM_DecodeA(word)
+#define B VM_DecodeB(word)
+#define C VM_DecodeC(word)
+#define ReadU32() (code[i + 1])
+#define ReadOp() VM_QuickenToken(code[i + 1])
+
+//~ Profiling
+
+static const char* vm_opcode_names[Opcode_COUNT] = {
+	[Opcode_Nop] = "Nop",
+	[Opcode_LoadConst] = "LoadConst",
+	[Opcode_LoadConstWide] = "LoadConstWide",
+	[Opcode_LoadSmallInt] = "LoadSmallInt",
+	[Opcode_LoadInput] = "LoadInput",
+	[Opcode_Move] = "Move",
+	[Opcode_UnaryOp] = "UnaryOp",
+	[Opcode_BinaryOp] = "BinaryOp",
+	[Opcode_Print] = "Print",
+	[Opcode_Return] = "Return",
+	[Opcode_Halt] = "Halt",
+	[Opcode_Call] = "Call",
+	[Opcode_TailCall] = "TailCall",
+	[Opcode_CallNative] = "CallNative",
+	[Opcode_Jump] = "Jump",
+	[Opcode_JumpIfFalse] = "JumpIfFalse",
+	[Opcode_Loop] = "Loop",
+	[Opcode_AddI32] = "AddI32",
+	[Opcode_SubI32] = "SubI32",
+	[Opcode_MulI32] = "MulI32",
+	[Opcode_DivI32] = "DivI32",
+	[Opcode_ModI32] = "ModI32",
+	[Opcode_NegI32] = "NegI32",
+	[Opcode_LtI32] = "LtI32",
+	[Opcode_LeI32] = "LeI32",
+	[Opcode_EqI32] = "EqI32",
+	[Opcode_NeI32] = "NeI32",
+	[Opcode_AddI32K] = "AddI32K",
+	[Opcode_MulAddI32] = "MulAddI32",
+	[Opcode_AddPrintI32] = "AddPrintI32",
+	[Opcode_AddI32Quick] = "AddI32Quick",
+	[Opcode_SubI32Quick] = "SubI32Quick",
+	[Opcode_MulI32Quick] = "MulI32Quick",
+	[Opcode_DivI32Quick] = "DivI32Quick",
+	[Opcode_ModI32Quick] = "ModI32Quick",
+};
+
+const char* VM_OpcodeName(VM_Opcode op) {
+	return op < Opcode_COUNT && vm_opcode_names[op] ? vm_opcode_names[op] : "Invalid";
+}
+
+#ifdef VM_PROFILE
+
+#if defined(COMPILER_CL)
+#  include <intrin.h>
+#  define VM_ReadCycles() __rdtsc()
+#elif defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+#  define VM_ReadCycles() __rdtsc()
+#else
+// No portable cycle counter, these "cycles" are nanoseconds
+#  define VM_ReadCycles() U_GetTimeNs()
+#endif
+
+VM_Profile vm_profile;
+
+typedef struct VM_ProfileCursor {
+	VM_Opcode prev;
+	VM_Opcode sampled; // Opcode_COUNT when no sample is running
+	u32 countdown;
+	u64 sample_start;
+} VM_ProfileCursor;
+
+static inline void VM_ProfileFinishSample(VM_ProfileCursor* cursor) {
+	if (cursor->sampled == Opcode_COUNT) return;
+	vm_profile.sampled_cycles[cursor->sampled] += VM_ReadCycles() - cursor->sample_start;
+	vm_profile.samples[cursor->sampled]++;
+	cursor->sampled = Opcode_COUNT;
+}
+
+static inline void VM_ProfileStep(VM_ProfileCursor* cursor, VM_Opcode op) {
+	VM_ProfileFinishSample(cursor);
+	
+	vm_profile.counts[op]++;
+	if (cursor->prev != Opcode_COUNT) vm_profile.pairs[cursor->prev][op]++;
+	cursor->prev = op;
+	
+	if (--cursor->countdown == 0) {
+		cursor->countdown = VM_PROFILE_SAMPLE_PERIOD;
+		cursor->sampled = op;
+		cursor->sample_start = VM_ReadCycles();
+	}
+}
+
+void VM_ProfileReset(void) {
+	MemoryZeroStruct(&vm_profile, VM_Profile);
+}
+
+static const u64* vm_profile_sort_keys;
+
+static int VM_ProfileCompareDescending(const void* a, const void* b) {
+	u64 ka = vm_profile_sort_keys[*(const u32*) a];
+	u64 kb = vm_profile_sort_keys[*(const u32*) b];
+	return ka < kb ? 1 : ka > kb ? -1 : 0;
+}
+
+// Indices of the non-zero keys, largest first
+static u32 VM_ProfileSort(const u64* keys, u32 count, u32* order) {
+	u32 used = 0;
+	for (u32 i = 0; i < count; i++)
+		if (keys[i]) order[used++] = i;
+	vm_profile_sort_keys = keys;
+	qsort(order, used, sizeof(u32), VM_ProfileCompareDescending);
+	return used;
+}
+
+#define VM_PROFILE_TOP_PAIRS 20
+
+void VM_ProfilePrint(FILE* out) {
+	u32 order[Opcode_COUNT * Opcode_COUNT];
+	u64 total = 0;
+	for (u32 op = 0; op < Opcode_COUNT; op++) total += vm_profile.counts[op];
+	if (!total) total = 1;
+	
+	fprintf(out, "%-16s %12s %7s %12s\n", "Opcode", "Count", "%", "Cycles/op");
+	u32 used = VM_ProfileSort(vm_profile.counts, Opcode_COUNT, order);
+	for (u32 k = 0; k < used; k++) {
+		u32 op = order[k];
+		f64 cycles = vm_profile.samples[op] ? (f64) vm_profile.sampled_cycles[op] / vm_profile.samples[op] : 0;
+		fprintf(out, "%-16s %12llu %6.2f%% %12.1f\n", VM_OpcodeName(op), (unsigned long long) vm_profile.counts[op],
+				100.0 * vm_profile.counts[op] / total, cycles);
+	}
+	
+	fprintf(out, "\n%-16s %-16s %12s %7s\n", "First", "Second", "Count", "%");
+	used = VM_ProfileSort(&vm_profile.pairs[0][0], Opcode_COUNT * Opcode_COUNT, order);
+	for (u32 k = 0; k < used && k < VM_PROFILE_TOP_PAIRS; k++) {
+		u64 count = (&vm_profile.pairs[0][0])[order[k]];
+		fprintf(out, "%-16s %-16s %12llu %6.2f%%\n", VM_OpcodeName(order[k] / Opcode_COUNT),
+				VM_OpcodeName(order[k] % Opcode_COUNT), (unsigned long long) count, 100.0 * count / total);
+	}
+}
+
+void VM_ProfilePrintJson(FILE* out) {
+	u32 order[Opcode_COUNT * Opcode_COUNT];
+	
+	fprintf(out, "{\n\t\"sample_period\": %d,\n\t\"opcodes\": [", VM_PROFILE_SAMPLE_PERIOD);
+	u32 used = VM_ProfileSort(vm_profile.counts, Opcode_COUNT, order);
+	for (u32 k = 0; k < used; k++) {
+		u32 op = order[k];
+		fprintf(out, "%s\n\t\t{ \"name\": \"%s\", \"count\": %llu, \"samples\": %llu, \"sampled_cycles\": %llu }",
+				k ? "," : "", VM_OpcodeName(op), (unsigned long long) vm_profile.counts[op],
+				(unsigned long long) vm_profile.samples[op], (unsigned long long) vm_profile.sampled_cycles[op]);
+	}
+	
+	fprintf(out, "\n\t],\n\t\"pairs\": [");
+	used = VM_ProfileSort(&vm_profile.pairs[0][0], Opcode_COUNT * Opcode_COUNT, order);
+	for (u32 k = 0; k < used; k++) {
+		fprintf(out, "%s\n\t\t{ \"first\": \"%s\", \"second\": \"%s\", \"count\": %llu }", k ? "," : "",
+				VM_OpcodeName(order[k] / Opcode_COUNT), VM_OpcodeName(order[k] % Opcode_COUNT),
+				(unsigned long long)(&vm_profile.pairs[0][0])[order[k]]);
+	}
+	fprintf(out, "\n\t]\n}\n");
+}
+
+#  define VM_ProfileDispatch() VM_ProfileStep(&profile_cursor, VM_DecodeOp(word))
+#else
+#  define VM_ProfileDispatch()
+#endif
+
+// Every dispatch burns one unit of fuel and suspends before the instruction once there
+// is none left. A decrement and a branch that is never taken outside of VM_Resume
+#define VM_UseFuel() if (fuel-- == 0) goto suspend
+
+// Computed gotos give every handler its own indirect jump, see CMakeLists.txt for keeping them apart.
+// Verified chunks run VM_OpUnchecked twins of the VM_OpChecked handlers
+#ifdef VM_COMPUTED_GOTO
+#  define VM_Dispatch() VM_UseFuel(); word = code[i]; VM_ProfileDispatch(); goto *dispatch[VM_DecodeOp(word)]
+#  define VM_Op(op) label_##op:
+#  define VM_OpChecked(op) label_##op:
+#  define VM_OpUnchecked(op) label_unchecked_##op:
+#  define VM_Next() VM_Dispatch()
+#else
+#  define VM_UNCHECKED_OP 0x100
+#  define VM_Dispatch() VM_UseFuel(); word = code[i]; VM_ProfileDispatch(); switch (VM_DecodeOp(word) | unchecked)
+#  define VM_Op(op) case op: case op | VM_UNCHECKED_OP:
+#  define VM_OpChecked(op) case op:
+#  define VM_OpUnchecked(op) case op | VM_UNCHECKED_OP:
+#  define VM_Next() continue
+#endif
+
+//~ Quickening
+
+// Define VM_NO_QUICKEN to keep generic ops generic. The rewrite is one aligned word store,
+// a racing thread sees either form
+static VM_Opcode VM_QuickBinaryOp(L_TokenType op) {
+	switch (op) {
+		case TokenType_Plus: return Opcode_AddI32Quick;
+		case TokenType_Minus: return Opcode_SubI32Quick;
+		case TokenType_Star: return Opcode_MulI32Quick;
+		case TokenType_Slash: return Opcode_DivI32Quick;
+		case TokenType_Percent: return Opcode_ModI32Quick;
+	}
+	return Opcode_COUNT;
+}
+
+static void VM_Quicken(IR_Chunk* chunk, u32 at, VM_RuntimeValue lhs, VM_RuntimeValue rhs) {
+#ifndef VM_NO_QUICKEN
+	if (chunk->read_only) return;
+	if (lhs.type != RuntimeValueType_Integer || rhs.type != RuntimeValueType_Integer) return;
+	
+	u32* code = chunk->code.elems;
+	if (VM_QuickenDequickens(code[at + 1]) >= VM_MAX_DEQUICKENS) return;
+	VM_Opcode quick = VM_QuickBinaryOp(VM_QuickenToken(code[at + 1]));
+	if (quick == Opcode_COUNT) return;
+	
+	u32 word = code[at];
+	U_AtomicStoreU32(&code[at], VM_Encode(quick, VM_DecodeA(word), VM_DecodeB(word), VM_DecodeC(word)));
+#endif
+}
+
+// The guard of a quick op failed, back to the generic op
+static void VM_Dequicken(IR_Chunk* chunk, u32 at) {
+	u32* code = chunk->code.elems;
+	u32 word = code[at];
+	u32 operand = code[at + 1];
+	U_AtomicStoreU32(&code[at + 1], VM_QuickenOperand(VM_QuickenToken(operand), VM_QuickenDequickens(operand) + 1));
+	U_AtomicStoreU32(&code[at], VM_Encode(Opcode_BinaryOp, VM_DecodeA(word), VM_DecodeB(word), VM_DecodeC(word)));
+}
+
+//~ Tracing
+
+static VM_RunStatus VM_Interpret(VM_Context* ctx, IR_Chunk* chunk, VM_Stack* stack, u32* ip, u64 fuel,
+								 VM_RuntimeValue* result);
+
+static u32 vm_hot_loop_threshold = VM_DEFAULT_HOT_LOOP_THRESHOLD;
+
+void VM_SetHotLoopThreshold(u32 back_edges) {
+	vm_hot_loop_threshold = back_edges;
+}
+
+// Leaving the function or entering another loop ends a recording
+static b8 VM_CanTrace(VM_Opcode op) {
+	switch (op) {
+		case Opcode_Return:
+		case Opcode_Halt:
+		case Opcode_Call:
+		case Opcode_TailCall:
+		case Opcode_Loop: return false;
+	}
+	return true;
+}
+
+// Records the next iteration of the loop at loop_ip and hands it to the JIT. Returns the ip to carry on at
+static u32 VM_RecordTrace(VM_Context* ctx, IR_Chunk* chunk, VM_Stack* stack, VM_Loop* loop, u32 loop_ip) {
+	u32* code = chunk->code.elems;
+	VM_Trace* recording = malloc(sizeof(VM_Trace));
+	recording->header = code[loop_ip + 1];
+	recording->step_count = 0;
+	
+	// Loop bodies are contiguous, so the loop is everything from the header to here
+	u32 ip = recording->header;
+	VM_RuntimeValue result;
+	while (ip != loop_ip) {
+		if (ip < recording->header || ip > loop_ip) {
+			free(recording);
+			loop->back_edges = 0;
+			U_AtomicStoreU32(&loop->tier_state, TierState_Interpreted);
+			return ip;
+		}
+		if (recording->step_count == VM_MAX_TRACE_STEPS || !VM_CanTrace(VM_DecodeOp(code[ip]))) {
+			free(recording);
+			U_AtomicStoreU32(&loop->tier_state, TierState_Failed);
+			return ip;
+		}
+		
+		VM_TraceStep* step = &recording->steps[recording->step_count++];
+		step->ip = ip;
+		// ip stays on the failing instruction, the interpreter runs it again and stops there
+		if (VM_Interpret(ctx, chunk, stack, &ip, 1, &result) == RunStatus_Error) {
+			free(recording);
+			U_AtomicStoreU32(&loop->tier_state, TierState_Failed);
+			return ip;
+		}
+		step->next = ip;
+	}
+	
+	LLVM_JitCompileTraceAsync(chunk, loop, recording);
+	return ip;
+}
+
+//~ Interpreter
+
+static u32 vm_tier_up_threshold = VM_DEFAULT_TIER_UP_THRESHOLD;
+
+void VM_SetTierUpThreshold(u32 runs) {
+	vm_tier_up_threshold = runs;
+}
+
+// Runs until the chunk ends, fails or fuel runs out, leaving *ip at the next or failing instruction.
+// Calls never recurse into here
+static VM_RunStatus VM_Interpret(VM_Context* ctx, IR_Chunk* chunk, VM_Stack* stack, u32* ip, u64 fuel,
+								 VM_RuntimeValue* result) {
+	u32* code = chunk->code.elems;
+	VM_RuntimeValue* constants = chunk->constants.elems;
+	VM_Function* functions = chunk->functions.elems;
+	u32 base = stack->base;
+	VM_RuntimeValue* registers = stack->values + base;
+	u32 i = *ip;
+	u32 word;
+	// A trace runs any number of iterations in one go, so runs on a fuel budget never enter one
+	b8 can_trace = fuel == u64_max;
+#ifdef VM_PROFILE
+	VM_ProfileCursor profile_cursor = { .prev = Opcode_COUNT, .sampled = Opcode_COUNT, .countdown = 1 };
+#endif
+	
+#ifdef VM_COMPUTED_GOTO
+	static void* dispatch_table[Opcode_COUNT] = {
+		[Opcode_Nop] = &&label_Opcode_Nop,
+		[Opcode_LoadConst] = &&label_Opcode_LoadConst,
+		[Opcode_LoadConstWide] = &&label_Opcode_LoadConstWide,
+		[Opcode_LoadSmallInt] = &&label_Opcode_LoadSmallInt,
+		[Opcode_LoadInput] = &&label_Opcode_LoadInput,
+		[Opcode_Move] = &&label_Opcode_Move,
+		[Opcode_UnaryOp] = &&label_Opcode_UnaryOp,
+		[Opcode_BinaryOp] = &&label_Opcode_BinaryOp,
+		[Opcode_Print] = &&label_Opcode_Print,
+		[Opcode_Return] = &&label_Opcode_Return,
+		[Opcode_Halt] = &&label_Opcode_Halt,
+		[Opcode_Call] = &&label_Opcode_Call,
+		[Opcode_TailCall] = &&label_Opcode_TailCall,
+		[Opcode_CallNative] = &&label_Opcode_CallNative,
+		[Opcode_Jump] = &&label_Opcode_Jump,
+		[Opcode_JumpIfFalse] = &&label_Opcode_JumpIfFalse,
+		[Opcode_Loop] = &&label_Opcode_Loop,
+		[Opcode_AddI32] = &&label_Opcode_AddI32,
+		[Opcode_SubI32] = &&label_Opcode_SubI32,
+		[Opcode_MulI32] = &&label_Opcode_MulI32,
+		[Opcode_DivI32] = &&label_Opcode_DivI32,
+		[Opcode_ModI32] = &&label_Opcode_ModI32,
+		[Opcode_NegI32] = &&label_Opcode_NegI32,
+		[Opcode_LtI32] = &&label_Opcode_LtI32,
+		[Opcode_LeI32] = &&label_Opcode_LeI32,
+		[Opcode_EqI32] = &&label_Opcode_EqI32,
+		[Opcode_NeI32] = &&label_Opcode_NeI32,
+		[Opcode_AddI32K] = &&label_Opcode_AddI32K,
+		[Opcode_MulAddI32] = &&label_Opcode_MulAddI32,
+		[Opcode_AddPrintI32] = &&label_Opcode_AddPrintI32,
+		[Opcode_AddI32Quick] = &&label_Opcode_AddI32Quick,
+		[Opcode_SubI32Quick] = &&label_Opcode_SubI32Quick,
+		[Opcode_MulI32Quick] = &&label_Opcode_MulI32Quick,
+		[Opcode_DivI32Quick] = &&label_Opcode_DivI32Quick,
+		[Opcode_ModI32Quick] = &&label_Opcode_ModI32Quick,
+	};
+	// Same handlers where nothing could fail a check
+	static void* unchecked_dispatch_table[Opcode_COUNT] = {
+		[Opcode_Nop] = &&label_Opcode_Nop,
+		[Opcode_LoadConst] = &&label_Opcode_LoadConst,
+		[Opcode_LoadConstWide] = &&label_Opcode_LoadConstWide,
+		[Opcode_LoadSmallInt] = &&label_Opcode_LoadSmallInt,
+		[Opcode_LoadInput] = &&label_Opcode_LoadInput,
+		[Opcode_Move] = &&label_Opcode_Move,
+		[Opcode_UnaryOp] = &&label_unchecked_Opcode_UnaryOp,
+		[Opcode_BinaryOp] = &&label_unchecked_Opcode_BinaryOp,
+		[Opcode_Print] = &&label_Opcode_Print,
+		[Opcode_Return] = &&label_Opcode_Return,
+		[Opcode_Halt] = &&label_Opcode_Halt,
+		[Opcode_Call] = &&label_unchecked_Opcode_Call,
+		[Opcode_TailCall] = &&label_unchecked_Opcode_TailCall,
+		[Opcode_CallNative] = &&label_unchecked_Opcode_CallNative,
+		[Opcode_Jump] = &&label_Opcode_Jump,
+		[Opcode_JumpIfFalse] = &&label_Opcode_JumpIfFalse,
+		[Opcode_Loop] = &&label_Opcode_Loop,
+		[Opcode_AddI32] = &&label_Opcode_AddI32,
+		[Opcode_SubI32] = &&label_Opcode_SubI32,
+		[Opcode_MulI32] = &&label_Opcode_MulI32,
+		[Opcode_DivI32] = &&label_Opcode_DivI32,
+		[Opcode_ModI32] = &&label_Opcode_ModI32,
+		[Opcode_NegI32] = &&label_Opcode_NegI32,
+		[Opcode_LtI32] = &&label_Opcode_LtI32,
+		[Opcode_LeI32] = &&label_Opcode_LeI32,
+		[Opcode_EqI32] = &&label_Opcode_EqI32,
+		[Opcode_NeI32] = &&label_Opcode_NeI32,
+		[Opcode_AddI32K] = &&label_Opcode_AddI32K,
+		[Opcode_MulAddI32] = &&label_Opcode_MulAddI32,
+		[Opcode_AddPrintI32] = &&label_Opcode_AddPrintI32,
+		[Opcode_AddI32Quick] = &&label_unchecked_Opcode_AddI32Quick,
+		[Opcode_SubI32Quick] = &&label_unchecked_Opcode_SubI32Quick,
+		[Opcode_MulI32Quick] = &&label_unchecked_Opcode_MulI32Quick,
+		[Opcode_DivI32Quick] = &&label_unchecked_Opcode_DivI32Quick,
+		[Opcode_ModI32Quick] = &&label_unchecked_Opcode_ModI32Quick,
+	};
+	void** dispatch = chunk->verified ? unchecked_dispatch_table : dispatch_table;
+	VM_Dispatch();
+#else
+	u32 unchecked = chunk->verified ? VM_UNCHECKED_OP : 0;
+	while (true) { VM_Dispatch() {
+#endif
+		
+		VM_Op(Opcode_Nop) {
+			i += 1;
+			VM_Next();
+		}
+		
+		VM_Op(Opcode_LoadConst) {
+			registers[A] = constants[VM_DecodeBx(word)];
+			i += 1;
+			VM_Next();
+		}
+		
+		VM_Op(Opcode_LoadConstWide) {
+			registers[A] = constants[ReadU32()];
+			i += 2;
+			VM_Next();
+		}
+		
+		VM_Op(Opcode_LoadSmallInt) {
+			registers[A] = (VM_RuntimeValue) { .type = RuntimeValueType_Integer, .as_int = VM_DecodeSBx(word) };
+			i += 1;
+			VM_Next();
+		}
+		
+		VM_Op(Opcode_LoadInput) {
+			// No columns when running a single row, inputs read like an uninitialized var
+			registers[A] = (VM_RuntimeValue) { .type = RuntimeValueType_Integer, .as_int = 0 };
+			i += 1;
+			VM_Next();
+		}
+		
+		VM_Op(Opcode_Move) {
+			registers[A] = registers[B];
+			i += 1;
+			VM_Next();
+		}
+		
+		VM_OpChecked(Opcode_UnaryOp) {
+			registers[A] = VM_UnaryOp(registers[B], ReadOp());
+			i += 2;
+			VM_Next();
+		}
+		
+		VM_OpUnchecked(Opcode_UnaryOp) {
+			registers[A].type = RuntimeValueType_Integer;
+			registers[A].as_int = VM_UnaryOpI32(registers[B].as_int, ReadOp());
+			i += 2;
+			VM_Next();
+		}
+		
+		VM_OpChecked(Opcode_BinaryOp) {
+			VM_RuntimeValue lhs = registers[B];
+			VM_RuntimeValue rhs = registers[C];
+			if (lhs.type == RuntimeValueType_Integer && rhs.type == RuntimeValueType_Integer &&
+				VM_BinaryOpTraps(lhs.as_int, rhs.as_int, ReadOp())) goto division_error;
+			registers[A] = VM_BinaryOp(lhs, rhs, ReadOp());
+			VM_Quicken(chunk, i, lhs, rhs);
+			i += 2;
+			VM_Next();
+		}
+		
+		// Still quickens, the quick op is cheaper than going through the operator and its
+		// unchecked handler has no guard. Only mapped files keep running this one
+		VM_OpUnchecked(Opcode_BinaryOp) {
+			if (VM_BinaryOpTraps(registers[B].as_int, registers[C].as_int, ReadOp())) goto division_error;
+			VM_Quicken(chunk, i, registers[B], registers[C]);
+			i32 value = VM_BinaryOpI32(registers[B].as_int, registers[C].as_int, ReadOp());
+			registers[A].type = RuntimeValueType_Integer;
+			registers[A].as_int = value;
+			i += 2;
+			VM_Next();
+		}
+		
+		VM_Op(Opcode_Print) {
+			VM_ContextPrint(ctx, registers[A]);
+			i += 1;
+			VM_Next();
+		}
+		
+		VM_Op(Opcode_Return) {
+			if (stack->frame_count == 0) {
+				*result = registers[A];
+				goto halt;
+			}
+			
+			registers[0] = registers[A];
+			VM_CallFrame frame = stack->frames[--stack->frame_count];
+			base = frame.caller_base;
+			registers = stack->values + base;
+			i = frame.return_ip;
+			VM_Next();
+		}
+		
+		VM_Op(Opcode_Halt) {
+			goto halt;
+		}
+		
+		VM_OpChecked(Opcode_Call) {
+			VM_Function* callee = &functions[VM_DecodeBx(word)];
+			u32 callee_base = base + A;
+			if (callee_base + callee->register_count > stack->cap || stack->frame_count == stack->frame_cap) {
+				if (!VM_StackGrow(stack, (u64) callee_base + callee->register_count)) goto overflow;
+			}
+			goto call;
+		}
+		
+		// The stack was reserved for the deepest call chain when the run started
+		VM_OpUnchecked(Opcode_Call) {
+			call: {
+				stack->frames[stack->frame_count++] = (VM_CallFrame) { .return_ip = i + 1, .caller_base = base };
+				base += A;
+				registers = stack->values + base;
+				i = functions[VM_DecodeBx(word)].entry;
+				VM_Next();
+			}
+		}
+		
+		VM_OpChecked(Opcode_TailCall) {
+			VM_Function* callee = &functions[VM_DecodeBx(word)];
+			if (base + callee->register_count > stack->cap) {
+				if (!VM_StackGrow(stack, (u64) base + callee->register_count)) goto overflow;
+				registers = stack->values + base;
+			}
+			goto tail_call;
+		}
+		
+		VM_OpUnchecked(Opcode_TailCall) {
+			tail_call: {
+				// Moving down, a forward copy is fine. Fieldwise to keep store forwarding working
+				VM_Function* callee = &functions[VM_DecodeBx(word)];
+				u32 window = A;
+				for (u32 k = 0; k < callee->param_count; k++) {
+					registers[k].type = registers[window + k].type;
+					registers[k].as_int = registers[window + k].as_int;
+				}
+				i = callee->entry;
+				VM_Next();
+			}
+		}
+		
+		VM_OpChecked(Opcode_CallNative) {
+			if (!chunk->native_bindings[VM_DecodeBx(word)].address) goto unresolved;
+			goto call_native;
+		}
+		
+		// Verified chunks have every native bound
+		VM_OpUnchecked(Opcode_CallNative) {
+			call_native: {
+				VM_NativeBinding* binding = &chunk->native_bindings[VM_DecodeBx(word)];
+				// The native might write to stdout too, what we printed has to be out first
+				if (ctx->stdout_buffer.len) VM_ContextFlush(ctx);
+				i32 value = binding->stub(binding->address, &registers[A]);
+				registers[A].type = RuntimeValueType_Integer;
+				registers[A].as_int = value;
+				i += 1;
+				VM_Next();
+			}
+		}
+		
+		VM_Op(Opcode_Jump) {
+			i = ReadU32();
+			VM_Next();
+		}
+		
+		VM_Op(Opcode_JumpIfFalse) {
+			i = registers[A].as_int ? i + 2 : ReadU32();
+			VM_Next();
+		}
+		
+		VM_Op(Opcode_Loop) {
+			if (can_trace) {
+				VM_Loop* loop = &chunk->loops[VM_DecodeAx(word)];
+				VM_NativeTrace* native = U_AtomicLoadPtr(&loop->native);
+				if (native) {
+					i = native(ctx, registers);
+					VM_Next();
+				}
+				
+				if (vm_hot_loop_threshold && ++loop->back_edges >= vm_hot_loop_threshold &&
+					U_AtomicCasU32(&loop->tier_state, TierState_Interpreted, TierState_Compiling)) {
+					// Keeps interpreting until the trace is swapped in
+					stack->base = base;
+					i = VM_RecordTrace(ctx, chunk, stack, loop, i);
+					VM_Next();
+				}
+			}
+			i = ReadU32();
+			VM_Next();
+		}
+		
+#define VM_ArithI32(op) \
+registers[A].type = RuntimeValueType_Integer;\
+registers[A].as_int = registers[B].as_int op registers[C].as_int;\
+i += 1;\
+VM_Next();
+#define VM_WrapArithI32(op) \
+registers[A].type = RuntimeValueType_Integer;\
+registers[A].as_int = VM_WrapI32(registers[B].as_int, op, registers[C].as_int);\
+i += 1;\
+VM_Next();
+		
+		VM_Op(Opcode_AddI32) { VM_WrapArithI32(+) }
+		VM_Op(Opcode_SubI32) { VM_WrapArithI32(-) }
+		VM_Op(Opcode_MulI32) { VM_WrapArithI32(*) }
+		// Verified or not, nothing proves the divisor away
+		VM_Op(Opcode_DivI32) { if (VM_DivisionTraps(registers[B].as_int, registers[C].as_int)) goto division_error; VM_ArithI32(/) }
+		VM_Op(Opcode_ModI32) { if (VM_DivisionTraps(registers[B].as_int, registers[C].as_int)) goto division_error; VM_ArithI32(%) }
+		VM_Op(Opcode_LtI32) { VM_ArithI32(<) }
+		VM_Op(Opcode_LeI32) { VM_ArithI32(<=) }
+		VM_Op(Opcode_EqI32) { VM_ArithI32(==) }
+		VM_Op(Opcode_NeI32) { VM_ArithI32(!=) }
+#undef VM_ArithI32
+#undef VM_WrapArithI32
+		
+		VM_Op(Opcode_NegI32) {
+			registers[A].type = RuntimeValueType_Integer;
+			registers[A].as_int = VM_WrapI32(0, -, registers[B].as_int);
+			i += 1;
+			VM_Next();
+		}
+		
+		VM_Op(Opcode_AddI32K) {
+			registers[A].type = RuntimeValueType_Integer;
+			registers[A].as_int = VM_WrapI32(registers[B].as_int, +, (i8) C);
+			i += 1;
+			VM_Next();
+		}
+		
+		VM_Op(Opcode_MulAddI32) {
+			registers[A].type = RuntimeValueType_Integer;
+			registers[A].as_int = VM_WrapI32(registers[ReadU32()].as_int, +, VM_WrapI32(registers[B].as_int, *, registers[C].as_int));
+			i += 2;
+			VM_Next();
+		}
+		
+		VM_Op(Opcode_AddPrintI32) {
+			registers[A].type = RuntimeValueType_Integer;
+			registers[A].as_int = VM_WrapI32(registers[B].as_int, +, registers[C].as_int);
+			VM_ContextPrint(ctx, registers[A]);
+			i += 1;
+			VM_Next();
+		}
+		
+#define VM_QuickGuard() \
+if (registers[B].type != RuntimeValueType_Integer || registers[C].type != RuntimeValueType_Integer) goto dequicken;
+#define VM_QuickDivisionGuard() \
+if (VM_DivisionTraps(registers[B].as_int, registers[C].as_int)) goto division_error;
+#define VM_QuickArithI32(op) \
+registers[A].type = RuntimeValueType_Integer;\
+registers[A].as_int = registers[B].as_int op registers[C].as_int;\
+i += 2;\
+VM_Next();
+#define VM_QuickWrapArithI32(op) \
+registers[A].type = RuntimeValueType_Integer;\
+registers[A].as_int = VM_WrapI32(registers[B].as_int, op, registers[C].as_int);\
+i += 2;\
+VM_Next();
+		
+		VM_OpChecked(Opcode_AddI32Quick) { VM_QuickGuard() VM_QuickWrapArithI32(+) }
+		VM_OpChecked(Opcode_SubI32Quick) { VM_QuickGuard() VM_QuickWrapArithI32(-) }
+		VM_OpChecked(Opcode_MulI32Quick) { VM_QuickGuard() VM_QuickWrapArithI32(*) }
+		VM_OpChecked(Opcode_DivI32Quick) { VM_QuickGuard() VM_QuickDivisionGuard() VM_QuickArithI32(/) }
+		VM_OpChecked(Opcode_ModI32Quick) { VM_QuickGuard() VM_QuickDivisionGuard() VM_QuickArithI32(%) }
+		
+		VM_OpUnchecked(Opcode_AddI32Quick) { VM_QuickWrapArithI32(+) }
+		VM_OpUnchecked(Opcode_SubI32Quick) { VM_QuickWrapArithI32(-) }
+		VM_OpUnchecked(Opcode_MulI32Quick) { VM_QuickWrapArithI32(*) }
+		VM_OpUnchecked(Opcode_DivI32Quick) { VM_QuickDivisionGuard() VM_QuickArithI32(/) }
+		VM_OpUnchecked(Opcode_ModI32Quick) { VM_QuickDivisionGuard() VM_QuickArithI32(%) }
+#undef VM_QuickArithI32
+#undef VM_QuickWrapArithI32
+#undef VM_QuickDivisionGuard
+#undef VM_QuickGuard
+		
+		dequicken: {
+			VM_Dequicken(chunk, i);
+			registers[A] = VM_BinaryOp(registers[B], registers[C], ReadOp());
+			i += 2;
+			VM_Next();
+		}
+		
+#ifndef VM_COMPUTED_GOTO
+		default: {
+			// TODO(voxel): Error Invalid opcode
+			goto halt;
+		}
+	}}
+#endif
+	
+	unresolved:
+	snprintf(ctx->error, sizeof(ctx->error), "native function %s was not found",
+			 (const char*) chunk->native_names.elems + chunk->natives.elems[VM_DecodeBx(word)].name_offset);
+	goto error;
+	
+	overflow:
+	snprintf(ctx->error, sizeof(ctx->error), "call stack overflow");
+	goto error;
+	
+	// Every dividing instruction has its divisor in R[C]
+	division_error:
+	snprintf(ctx->error, sizeof(ctx->error), "%s", VM_DivisionError(registers[C].as_int));
+	
+	error:
+#ifdef VM_PROFILE
+	VM_ProfileFinishSample(&profile_cursor);
+#endif
+	*ip = i;
+	stack->base = base;
+	return RunStatus_Error;
+	
+	halt:
+#ifdef VM_PROFILE
+	VM_ProfileFinishSample(&profile_cursor);
+#endif
+	*ip = i;
+	stack->base = base;
+	return RunStatus_Done;
+	
+	suspend:
+#ifdef VM_PROFILE
+	VM_ProfileFinishSample(&profile_cursor);
+#endif
+	*ip = i;
+	stack->base = base;
+	return RunStatus_Suspended;
+}
+#undef A
+#undef B
+#undef C
+#undef ReadU32
+#undef ReadOp
+#undef VM_Dispatch
+#undef VM_Op
+#undef VM_OpChecked
+#undef VM_OpUnchecked
+#undef VM_Next
+#undef VM_ProfileDispatch
+#undef VM_UseFuel
+
+VM_RunStatus VM_RunExprChunk(VM_Context* ctx, IR_Chunk* chunk, VM_RuntimeValue* result) {
+	*result = (VM_RuntimeValue) {0};
+	VM_NativeChunk* native = U_AtomicLoadPtr(&chunk->native);
+	if (native) return native(ctx, result);
+	
+	if (vm_tier_up_threshold && ++chunk->run_count >= vm_tier_up_threshold &&
+		U_AtomicCasU32(&chunk->tier_state, TierState_Interpreted, TierState_Compiling)) {
+		// Keeps interpreting until the compiled code is swapped in
+		LLVM_JitCompileAsync(chunk);
+	}
+	
+	// The top level frame is exactly as big as the lowerer said, only calls check for room
+	// and only in chunks that aren't verified
+	VM_StackReset(&ctx->stack, chunk);
+	u32 ip = 0;
+	return VM_Interpret(ctx, chunk, &ctx->stack, &ip, u64_max, result);
+}
+
+//~ Resumable execution
+
+void VM_ContinuationInit(VM_Continuation* cont, IR_Chunk* chunk) {
+	MemoryZeroStruct(cont, VM_Continuation);
+	cont->chunk = chunk;
+	cont->status = RunStatus_Suspended;
+	VM_StackReset(&cont->stack, chunk);
+}
+
+void VM_ContinuationFree(VM_Continuation* cont) {
+	if (cont->heap) {
+		darray(VM_StackRef)* stacks = &cont->heap->stacks;
+		for (u32 i = 0; i < stacks->len; i++) {
+			if (stacks->elems[i] != &cont->stack) continue;
+			stacks->elems[i] = stacks->elems[--stacks->len];
+			break;
+		}
+	}
+	VM_StackFree(&cont->stack);
+}
+
+VM_RunStatus VM_Resume(VM_Context* ctx, VM_Continuation* cont, u64 fuel) {
+	if (cont->status != RunStatus_Suspended) return cont->status;
+	// Stays a root of this heap while suspended, so collections between resumes see its registers
+	if (!cont->heap) {
+		cont->heap = &ctx->heap;
+		darray_add(VM_StackRef, &ctx->heap.stacks, &cont->stack);
+	} else if (cont->heap != &ctx->heap) {
+		snprintf(ctx->error, sizeof(ctx->error), "continuation resumed on a different context than it started on");
+		return RunStatus_Error;
+	}
+	cont->status = VM_Interpret(ctx, cont->chunk, &cont->stack, &cont->ip, fuel, &cont->result);
+	return cont->status;
+}
+
+//~ Batch evaluation
+
+// Generic vectors, the compiler lowers them to whatever SIMD the target has (SSE2 on
+// plain x86-64, NEON on arm64) even in unoptimized builds. Other compilers get scalar lanes
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+typedef i32 VM_I32xN __attribute__((vector_size(16)));
+typedef u32 VM_U32xN __attribute__((vector_size(16)));
+#  define VM_BATCH_LANES 4
+#else
+typedef i32 VM_I32xN;
+typedef u32 VM_U32xN;
+#  define VM_BATCH_LANES 1
+#endif
+
+#define VM_BATCH_VECTORS (VM_BATCH_SIZE / VM_BATCH_LANES)
+
+// VM_WrapI32 for whole vectors, the casts between the signed and unsigned vector types keep the bits
+#define VM_BatchWrap(a, op, b) ((VM_I32xN)((VM_U32xN)(a) op (VM_U32xN)(b)))
+
+// Only typed i32 code runs column-wise, checked once up front so the block loop doesn't
+static b8 VM_CanRunBatch(IR_Chunk* chunk, u32 input_count) {
+	u32* code = chunk->code.elems;
+	for (u32 i = 0; i < chunk->code.len; i++) {
+		u32 word = code[i];
+		switch (VM_DecodeOp(word)) {
+			case Opcode_Nop:
+			case Opcode_LoadSmallInt:
+			case Opcode_Move:
+			case Opcode_AddI32:
+			case Opcode_SubI32:
+			case Opcode_MulI32:
+			case Opcode_DivI32:
+			case Opcode_ModI32:
+			case Opcode_NegI32:
+			case Opcode_AddI32K: break;
+			
+			case Opcode_LoadConst: {
+				if (chunk->constants.elems[VM_DecodeBx(word)].type != RuntimeValueType_Integer) return false;
+			} break;
+			
+			case Opcode_LoadConstWide: {
+				if (chunk->constants.elems[code[++i]].type != RuntimeValueType_Integer) return false;
+			} break;
+			
+			case Opcode_LoadInput: {
+				if (VM_DecodeBx(word) >= input_count) return false;
+			} break;
+			
+			case Opcode_MulAddI32: i++; break;
+			
+			case Opcode_Return: return true;
+			default: return false;
+		}
+	}
+	return false;
+}
+
+static void VM_BatchFill(VM_I32xN* dst, u32 vectors, i32 value) {
+	VM_I32xN splat = (VM_I32xN){0} + value;
+	for (u32 l = 0; l < vectors; l++) dst[l] = splat;
+}
+
+// One pass over the code per block of rows, division runs scalar so garbage lanes can't trap.
+// False when a row's division has no result, before anything is written
+static b8 VM_RunBatchBlock(VM_Context* ctx, IR_Chunk* chunk, VM_I32xN* registers, const i32* const* inputs,
+						   u64 first_row, u32 rows, i32* output) {
+	u32* code = chunk->code.elems;
+	VM_RuntimeValue* constants = chunk->constants.elems;
+	u32 vectors = (rows + VM_BATCH_LANES - 1) / VM_BATCH_LANES;
+	
+	for (u32 i = 0;; i++) {
+		u32 word = code[i];
+		VM_I32xN* dst = registers + VM_DecodeA(word) * VM_BATCH_VECTORS;
+		VM_I32xN* x = registers + VM_DecodeB(word) * VM_BATCH_VECTORS;
+		VM_I32xN* y = registers + VM_DecodeC(word) * VM_BATCH_VECTORS;
+		
+		switch (VM_DecodeOp(word)) {
+			case Opcode_LoadConst: VM_BatchFill(dst, vectors, constants[VM_DecodeBx(word)].as_int); break;
+			case Opcode_LoadConstWide: VM_BatchFill(dst, vectors, constants[code[++i]].as_int); break;
+			case Opcode_LoadSmallInt: VM_BatchFill(dst, vectors, VM_DecodeSBx(word)); break;
+			
+			case Opcode_LoadInput: {
+				memcpy(dst, inputs[VM_DecodeBx(word)] + first_row, rows * sizeof(i32));
+			} break;
+			
+			case Opcode_Move: memmove(dst, x, vectors * sizeof(VM_I32xN)); break;
+			
+			case Opcode_AddI32: for (u32 l = 0; l < vectors; l++) dst[l] = VM_BatchWrap(x[l], +, y[l]); break;
+			case Opcode_SubI32: for (u32 l = 0; l < vectors; l++) dst[l] = VM_BatchWrap(x[l], -, y[l]); break;
+			case Opcode_MulI32: for (u32 l = 0; l < vectors; l++) dst[l] = VM_BatchWrap(x[l], *, y[l]); break;
+			case Opcode_NegI32: for (u32 l = 0; l < vectors; l++) dst[l] = (VM_I32xN)(0u - (VM_U32xN) x[l]); break;
+			
+			case Opcode_AddI32K: {
+				i32 k = (i8) VM_DecodeC(word);
+				for (u32 l = 0; l < vectors; l++) dst[l] = (VM_I32xN)((VM_U32xN) x[l] + (u32) k);
+			} break;
+			
+			case Opcode_MulAddI32: {
+				VM_I32xN* addend = registers + code[++i] * VM_BATCH_VECTORS;
+				for (u32 l = 0; l < vectors; l++) dst[l] = VM_BatchWrap(addend[l], +, VM_BatchWrap(x[l], *, y[l]));
+			} break;
+			
+			// No SIMD integer division on x86, and the garbage lanes could be 0
+#define VM_BatchDivide(op) \
+i32* d = (i32*) dst, *xs = (i32*) x, *ys = (i32*) y;\
+for (u32 r = 0; r < rows; r++) {\
+if (VM_DivisionTraps(xs[r], ys[r])) {\
+snprintf(ctx->error, sizeof(ctx->error), "%s in row %llu", VM_DivisionError(ys[r]), (unsigned long long)(first_row + r));\
+return false;\
+}\
+d[r] = xs[r] op ys[r];\
+}
+			
+			case Opcode_DivI32: { VM_BatchDivide(/) } break;
+			case Opcode_ModI32: { VM_BatchDivide(%) } break;
+#undef VM_BatchDivide
+			
+			case Opcode_Return: {
+				memcpy(output, dst, rows * sizeof(i32));
+			} return true;
+			
+			default: break;
+		}
+	}
+}
+
+b8 VM_RunChunkBatch(VM_Context* ctx, IR_Chunk* chunk, const i32* const* inputs, u32 input_count,
+					 i32* output, u64 row_count) {
+	if (!VM_CanRunBatch(chunk, input_count)) return false;
+	
+	// 4KB per register, too much for the stack with a few hundred registers.
+	// Arena allocations are only pointer aligned, vectors want their own size
+	M_ArenaTemp temp = arena_begin_temp(ctx->scratch);
+	u64 size = sizeof(VM_I32xN) * VM_BATCH_VECTORS * (chunk->register_count + 1);
+	u8* memory = arena_alloc(ctx->scratch, size + sizeof(VM_I32xN));
+	uintptr_t align = sizeof(VM_I32xN) - 1;
+	VM_I32xN* registers = (VM_I32xN*)(((uintptr_t) memory + align) & ~align);
+	
+	b8 ok = true;
+	for (u64 row = 0; ok && row < row_count; row += VM_BATCH_SIZE) {
+		u32 rows = (u32) Min(row_count - row, VM_BATCH_SIZE);
+		ok = VM_RunBatchBlock(ctx, chunk, registers, inputs, row, rows, output + row);
+	}
+	arena_end_temp(temp);
+	return ok;
+}
+
+//~ Verification
+
+// The top level code (region 0) or the body of function index - 1. Bodies are
+// contiguous, each one runs up to where the next one starts
+typedef struct VM_VerifyRegion {
+	u32 start;
+	u32 end;
+	u32 register_count;
+	u32 param_count;
+} VM_VerifyRegion;
+
+enum {
+	VM_Mark_Instruction = 1 << 0,
+	VM_Mark_Target      = 1 << 1,
+};
+
+// What a register might hold at some point of a region, a set of these
+enum {
+	VM_Holds_Integer = 1 << 0,
+	VM_Holds_Other   = 1 << 1, // Anything else, including whatever an earlier run left there
+};
+
+static int VM_VerifyCompareStarts(const void* a, const void* b) {
+	u64 x = *(const u64*) a;
+	u64 y = *(const u64*) b;
+	return (x > y) - (x < y);
+}
+
+// Decodes every instruction of the region and checks its operands against the tables and
+// the frame. Marks where instructions start and where jumps land on the way
+static b8 VM_VerifyRegionStructure(IR_Chunk* chunk, VM_VerifyRegion* region, u8* marks) {
+	u32* code = chunk->code.elems;
+	u32 last = region->start;
+	for (u32 ip = region->start; ip < region->end; ip++) {
+		VM_Opcode op = VM_DecodeOp(code[ip]);
+		if (op >= Opcode_COUNT) return false;
+		if (vm_operand_usage[op] & VM_Use_Extra) {
+			if (ip + 1 == region->end) return false;
+			marks[ip] = VM_Mark_Instruction;
+			last = ip++;
+		} else {
+			marks[ip] = VM_Mark_Instruction;
+			last = ip;
+		}
+	}
+	if (!VM_EndsFlow(VM_DecodeOp(code[last]))) return false;
+	
+	u32 frame = region->register_count;
+	for (u32 ip = region->start; ip < region->end; ip++) {
+		u32 word = code[ip];
+		VM_Opcode op = VM_DecodeOp(word);
+		u8 usage = vm_operand_usage[op];
+		u32 a = VM_DecodeA(word);
+		u32 extra = (usage & VM_Use_Extra) ? code[++ip] : 0;
+		
+		if ((usage & (VM_Use_WriteA | VM_Use_ReadA)) && a >= frame) return false;
+		if ((usage & VM_Use_ReadB) && VM_DecodeB(word) >= frame) return false;
+		if ((usage & VM_Use_ReadC) && VM_DecodeC(word) >= frame) return false;
+		if ((usage & VM_Use_ReadX) && extra >= frame) return false;
+		
+		switch (op) {
+			case Opcode_LoadConst: {
+				if (VM_DecodeBx(word) >= chunk->constants.len) return false;
+			} break;
+			
+			case Opcode_LoadConstWide: {
+				if (extra >= chunk->constants.len) return false;
+			} break;
+			
+			case Opcode_Call:
+			case Opcode_TailCall: {
+				if (VM_DecodeBx(word) >= chunk->functions.len) return false;
+				if ((u64) a + chunk->functions.elems[VM_DecodeBx(word)].param_count > frame) return false;
+			} break;
+			
+			case Opcode_CallNative: {
+				if (VM_DecodeBx(word) >= chunk->natives.len) return false;
+				if ((u64) a + chunk->natives.elems[VM_DecodeBx(word)].param_count > frame) return false;
+			} break;
+			
+			// Only Opcode_Loop goes backwards, the tracer relies on it too
+			case Opcode_Jump:
+			case Opcode_JumpIfFalse: {
+				if (extra <= ip || extra >= region->end || !(marks[extra] & VM_Mark_Instruction)) return false;
+				marks[extra] |= VM_Mark_Target;
+			} break;
+			
+			case Opcode_Loop: {
+				if (VM_DecodeAx(word) >= chunk->loop_count) return false;
+				if (extra < region->start || extra >= ip || !(marks[extra] & VM_Mark_Instruction)) return false;
+				marks[extra] |= VM_Mark_Target;
+			} break;
+		}
+	}
+	return true;
+}
+
+// Moves holds past one instruction. False if it reads a register that might not hold an int,
+// everything but Print and Move reads only ints, and everything that writes writes an int
+static b8 VM_StepHolds(IR_Chunk* chunk, u32 frame, u32 word, u32 extra, u8* holds) {
+	VM_Opcode op = VM_DecodeOp(word);
+	u8 usage = vm_operand_usage[op];
+	u32 a = VM_DecodeA(word);
+	
+	switch (op) {
+		case Opcode_LoadConst:
+		case Opcode_LoadConstWide: {
+			u32 index = op == Opcode_LoadConst ? VM_DecodeBx(word) : extra;
+			b8 integer = chunk->constants.elems[index].type == RuntimeValueType_Integer;
+			holds[a] = integer ? VM_Holds_Integer : VM_Holds_Other;
+		} break;
+		
+		case Opcode_Move: {
+			holds[a] = holds[VM_DecodeB(word)];
+		} break;
+		
+		case Opcode_Print: break;
+		
+		case Opcode_Call:
+		case Opcode_TailCall:
+		case Opcode_CallNative: {
+			u32 args = op == Opcode_CallNative ? chunk->natives.elems[VM_DecodeBx(word)].param_count
+				: chunk->functions.elems[VM_DecodeBx(word)].param_count;
+			for (u32 k = 0; k < args; k++) {
+				if (holds[a + k] != VM_Holds_Integer) return false;
+			}
+			// The callee's window started at R[A], whatever it left up there is unknown
+			if (op == Opcode_Call) {
+				for (u32 r = a + 1; r < frame; r++) holds[r] = VM_Holds_Other;
+			}
+			if (op != Opcode_TailCall) holds[a] = VM_Holds_Integer;
+		} break;
+		
+		default: {
+			if ((usage & VM_Use_ReadA) && holds[a] != VM_Holds_Integer) return false;
+			if ((usage & VM_Use_ReadB) && holds[VM_DecodeB(word)] != VM_Holds_Integer) return false;
+			if ((usage & VM_Use_ReadC) && holds[VM_DecodeC(word)] != VM_Holds_Integer) return false;
+			if ((usage & VM_Use_ReadX) && holds[extra] != VM_Holds_Integer) return false;
+			if (usage & VM_Use_WriteA) holds[a] = VM_Holds_Integer;
+		} break;
+	}
+	return true;
+}
+
+// in[0] says whether anything reached the target yet, the sets follow it
+static b8 VM_MergeHolds(u8* in, u8* holds, u32 frame) {
+	b8 changed = !in[0];
+	in[0] = 1;
+	for (u32 r = 0; r < frame; r++) {
+		u8 merged = in[r + 1] | holds[r];
+		changed |= merged != in[r + 1];
+		in[r + 1] = merged;
+	}
+	return changed;
+}
+
+// Forward dataflow over register types. Only Opcode_Loop jumps back, so it sweeps again only when one widens
+static b8 VM_VerifyRegionTypes(IR_Chunk* chunk, VM_VerifyRegion* region, u8* marks) {
+	u32* code = chunk->code.elems;
+	u32 frame = region->register_count;
+	u32 stride = frame + 1;
+	
+	u32* slots = malloc(sizeof(u32) * (region->end - region->start));
+	u32 target_count = 0;
+	for (u32 ip = region->start; ip < region->end; ip++) {
+		if (marks[ip] & VM_Mark_Target) slots[ip - region->start] = target_count++;
+	}
+	u8* merged = calloc(target_count, stride);
+	u8 holds[VM_MAX_REGISTERS];
+	
+	b8 proven = true;
+	b8 widened;
+	do {
+		widened = false;
+		// Callers proved their arguments to be ints
+		for (u32 r = 0; r < frame; r++) holds[r] = r < region->param_count ? VM_Holds_Integer : VM_Holds_Other;
+		b8 reached = true;
+		
+		for (u32 ip = region->start; ip < region->end && proven; ip++) {
+			if (marks[ip] & VM_Mark_Target) {
+				u8* in = merged + (u64) slots[ip - region->start] * stride;
+				if (reached) VM_MergeHolds(in, holds, frame);
+				reached = in[0];
+				memcpy(holds, in + 1, frame);
+			}
+			
+			u32 word = code[ip];
+			VM_Opcode op = VM_DecodeOp(word);
+			u32 extra = (vm_operand_usage[op] & VM_Use_Extra) ? code[++ip] : 0;
+			if (!reached) continue;
+			
+			proven = VM_StepHolds(chunk, frame, word, extra, holds);
+			if (VM_IsJump(op)) {
+				u8* in = merged + (u64) slots[extra - region->start] * stride;
+				if (VM_MergeHolds(in, holds, frame) && op == Opcode_Loop) widened = true;
+			}
+			if (VM_EndsFlow(op)) reached = false;
+		}
+	} while (widened && proven);
+	
+	free(merged);
+	free(slots);
+	return proven;
+}
+
+typedef struct VM_CallEdge {
+	u32 caller; // Regions
+	u32 callee;
+	u32 window; // 0 for tail calls, they reuse the caller's
+	u32 frames; // 1 for calls, 0 for tail calls
+} VM_CallEdge;
+
+// Longest paths over the call graph, tail calls add nothing. A longer chain than there are functions is recursion
+static b8 VM_VerifyStackBound(IR_Chunk* chunk, VM_VerifyRegion* regions, u32 region_count) {
+	u32* code = chunk->code.elems;
+	u32 edge_count = 0;
+	for (u32 ip = 0; ip < chunk->code.len; ip++) {
+		VM_Opcode op = VM_DecodeOp(code[ip]);
+		edge_count += op == Opcode_Call || op == Opcode_TailCall;
+		if (vm_operand_usage[op] & VM_Use_Extra) ip++;
+	}
+	
+	VM_CallEdge* edges = malloc(sizeof(VM_CallEdge) * Max(edge_count, 1));
+	edge_count = 0;
+	for (u32 r = 0; r < region_count; r++) {
+		for (u32 ip = regions[r].start; ip < regions[r].end; ip++) {
+			u32 word = code[ip];
+			VM_Opcode op = VM_DecodeOp(word);
+			if (op == Opcode_Call || op == Opcode_TailCall) {
+				b8 tail = op == Opcode_TailCall;
+				edges[edge_count++] = (VM_CallEdge) {
+					.caller = r,
+					.callee = VM_DecodeBx(word) + 1,
+					.window = tail ? 0 : VM_DecodeA(word),
+					.frames = !tail,
+				};
+			}
+			if (vm_operand_usage[op] & VM_Use_Extra) ip++;
+		}
+	}
+	
+	u64* stack = malloc(sizeof(u64) * region_count);
+	u32* frames = calloc(region_count, sizeof(u32));
+	for (u32 r = 0; r < region_count; r++) stack[r] = regions[r].register_count;
+	
+	b8 bounded = true;
+	b8 changed = true;
+	while (changed && bounded) {
+		changed = false;
+		for (u32 e = 0; e < edge_count && bounded; e++) {
+			VM_CallEdge* edge = &edges[e];
+			u64 need = edge->window + stack[edge->callee];
+			u32 depth = edge->frames + frames[edge->callee];
+			if (need > stack[edge->caller]) {
+				stack[edge->caller] = need;
+				changed = true;
+			}
+			if (depth > frames[edge->caller]) {
+				frames[edge->caller] = depth;
+				changed = true;
+			}
+			bounded = frames[edge->caller] < region_count && stack[edge->caller] < VM_MAX_STACK_VALUES;
+		}
+	}
+	
+	if (bounded) {
+		chunk->max_stack = (u32) stack[0];
+		chunk->max_frames = frames[0];
+	}
+	free(frames);
+	free(stack);
+	free(edges);
+	return bounded;
+}
+
+VM_VerifyResult VM_VerifyChunk(IR_Chunk* chunk) {
+	chunk->verified = false;
+	u32 code_count = chunk->code.len;
+	if (code_count == 0 || chunk->register_count > VM_MAX_REGISTERS) return VerifyResult_Malformed;
+	
+	// A reference only means something in the heap it was allocated in
+	for (u32 k = 0; k < chunk->constants.len; k++) {
+		if (chunk->constants.elems[k].type == RuntimeValueType_Object) return VerifyResult_Malformed;
+	}
+	
+	u32 region_count = chunk->functions.len + 1;
+	VM_VerifyRegion* regions = malloc(sizeof(VM_VerifyRegion) * region_count);
+	u64* order = malloc(sizeof(u64) * region_count);
+	u8* marks = calloc(code_count, 1);
+	VM_VerifyResult result = VerifyResult_Malformed;
+	
+	regions[0] = (VM_VerifyRegion) { .start = 0, .register_count = chunk->register_count };
+	for (u32 f = 0; f < chunk->functions.len; f++) {
+		VM_Function* function = &chunk->functions.elems[f];
+		if (function->entry >= code_count || function->register_count > VM_MAX_REGISTERS ||
+			function->param_count > function->register_count) goto done;
+		regions[f + 1] = (VM_VerifyRegion) {
+			.start = function->entry,
+			.register_count = function->register_count,
+			.param_count = function->param_count,
+		};
+	}
+	
+	// Sorted by start, the low half keeps which region it was
+	for (u32 r = 0; r < region_count; r++) order[r] = (u64) regions[r].start << 32 | r;
+	qsort(order, region_count, sizeof(u64), VM_VerifyCompareStarts);
+	for (u32 k = 0; k < region_count; k++) {
+		VM_VerifyRegion* region = &regions[(u32) order[k]];
+		region->end = k + 1 < region_count ? (u32)(order[k + 1] >> 32) : code_count;
+		// Two functions sharing a body, or one sharing the top level code's
+		if (region->end == region->start) goto done;
+	}
+	
+	for (u32 r = 0; r < region_count; r++) {
+		if (!VM_VerifyRegionStructure(chunk, &regions[r], marks)) goto done;
+	}
+	
+	result = VerifyResult_Unproven;
+	for (u32 r = 0; r < region_count; r++) {
+		if (!VM_VerifyRegionTypes(chunk, &regions[r], marks)) goto done;
+	}
+	for (u32 n = 0; n < chunk->natives.len; n++) {
+		if (!chunk->native_bindings[n].address) goto done;
+	}
+	if (!VM_VerifyStackBound(chunk, regions, region_count)) goto done;
+	
+	result = VerifyResult_Verified;
+	chunk->verified = true;
+	
+	done:
+	free(marks);
+	free(order);
+	free(regions);
+	return result;
+}
+
+//~ Bytecode files
+
+#define VM_CHECKSUM_SEED 2166136261u
+
+// FNV-1a over whole words instead of bytes, chained from the constants into the code
+static u32 VM_ChunkChecksum(u32 hash, u32* words, u64 count) {
+	for (u64 i = 0; i < count; i++) {
+		hash ^= words[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+b8 VM_WriteChunkFile(IR_Chunk* chunk, const char* path) {
+	FILE* file = fopen(path, "wb");
+	if (!file) return false;
+	
+	u64 constant_words = chunk->constants.len * sizeof(VM_RuntimeValue) / sizeof(u32);
+	u64 function_words = chunk->functions.len * sizeof(VM_Function) / sizeof(u32);
+	u64 native_words = chunk->natives.len * sizeof(VM_Native) / sizeof(u32);
+	u64 stack_map_words = chunk->stack_maps.len * sizeof(VM_StackMap) / sizeof(u32);
+	u32 checksum = VM_ChunkChecksum(VM_CHECKSUM_SEED, (u32*) chunk->constants.elems, constant_words);
+	checksum = VM_ChunkChecksum(checksum, (u32*) chunk->functions.elems, function_words);
+	checksum = VM_ChunkChecksum(checksum, (u32*) chunk->natives.elems, native_words);
+	checksum = VM_ChunkChecksum(checksum, (u32*) chunk->stack_maps.elems, stack_map_words);
+	checksum = VM_ChunkChecksum(checksum, chunk->code.elems, chunk->code.len);
+	checksum = VM_ChunkChecksum(checksum, (u32*) chunk->native_names.elems, chunk->native_names.len / sizeof(u32));
+	
+	VM_ChunkFileHeader header = {
+		.magic = VM_CHUNK_FILE_MAGIC,
+		.version = VM_CHUNK_FILE_VERSION,
+		.register_count = chunk->register_count,
+		.constant_count = chunk->constants.len,
+		.function_count = chunk->functions.len,
+		.native_count = chunk->natives.len,
+		.code_count = chunk->code.len,
+		.native_names_size = chunk->native_names.len,
+		.checksum = checksum,
+		.loop_count = chunk->loop_count,
+		.stack_map_count = chunk->stack_maps.len,
+	};
+	
+	b8 ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	if (chunk->constants.len)
+		ok = ok && fwrite(chunk->constants.elems, sizeof(VM_RuntimeValue), chunk->constants.len, file) == chunk->constants.len;
+	if (chunk->functions.len)
+		ok = ok && fwrite(chunk->functions.elems, sizeof(VM_Function), chunk->functions.len, file) == chunk->functions.len;
+	if (chunk->natives.len)
+		ok = ok && fwrite(chunk->natives.elems, sizeof(VM_Native), chunk->natives.len, file) == chunk->natives.len;
+	if (chunk->stack_maps.len)
+		ok = ok && fwrite(chunk->stack_maps.elems, sizeof(VM_StackMap), chunk->stack_maps.len, file) == chunk->stack_maps.len;
+	ok = ok && fwrite(chunk->code.elems, sizeof(u32), chunk->code.len, file) == chunk->code.len;
+	if (chunk->native_names.len)
+		ok = ok && fwrite(chunk->native_names.elems, 1, chunk->native_names.len, file) == chunk->native_names.len;
+	ok = (fclose(file) == 0) && ok;
+	return ok;
+}
+
+b8 VM_LoadChunkFile(U_MappedFile* file, IR_Chunk* chunk) {
+	if (file->size < sizeof(VM_ChunkFileHeader)) return false;
+	
+	VM_ChunkFileHeader* header = (VM_ChunkFileHeader*) file->data;
+	if (header->magic != VM_CHUNK_FILE_MAGIC || header->version != VM_CHUNK_FILE_VERSION) return false;
+	if (header->register_count > VM_MAX_REGISTERS || header->code_count == 0) return false;
+	if (header->native_names_size % sizeof(u32)) return false;
+	
+	u64 expected = sizeof(VM_ChunkFileHeader) + (u64) header->constant_count * sizeof(VM_RuntimeValue)
+		+ (u64) header->function_count * sizeof(VM_Function) + (u64) header->native_count * sizeof(VM_Native)
+		+ (u64) header->stack_map_count * sizeof(VM_StackMap) + (u64) header->code_count * sizeof(u32)
+		+ header->native_names_size;
+	if (file->size != expected) return false;
+	
+	VM_RuntimeValue* constants = (VM_RuntimeValue*)(header + 1);
+	VM_Function* functions = (VM_Function*)(constants + header->constant_count);
+	VM_Native* natives = (VM_Native*)(functions + header->function_count);
+	VM_StackMap* stack_maps = (VM_StackMap*)(natives + header->native_count);
+	u32* code = (u32*)(stack_maps + header->stack_map_count);
+	u8* native_names = (u8*)(code + header->code_count);
+	
+	u64 constant_words = (u64) header->constant_count * sizeof(VM_RuntimeValue) / sizeof(u32);
+	u64 function_words = (u64) header->function_count * sizeof(VM_Function) / sizeof(u32);
+	u64 native_words = (u64) header->native_count * sizeof(VM_Native) / sizeof(u32);
+	u64 stack_map_words = (u64) header->stack_map_count * sizeof(VM_StackMap) / sizeof(u32);
+	u32 checksum = VM_ChunkChecksum(VM_CHECKSUM_SEED, (u32*) constants, constant_words);
+	checksum = VM_ChunkChecksum(checksum, (u32*) functions, function_words);
+	checksum = VM_ChunkChecksum(checksum, (u32*) natives, native_words);
+	checksum = VM_ChunkChecksum(checksum, (u32*) stack_maps, stack_map_words);
+	checksum = VM_ChunkChecksum(checksum, code, header->code_count);
+	checksum = VM_ChunkChecksum(checksum, (u32*) native_names, header->native_names_size / sizeof(u32));
+	if (checksum != header->checksum) return false;
+	
+	// Names are padded with at least one nul, so a name in range is terminated in range too
+	for (u32 n = 0; n < header->native_count; n++) {
+		if (natives[n].name_offset >= header->native_names_size || natives[n].param_count > TYPE_MAX_NATIVE_PARAMS) return false;
+	}
+	if (header->native_count && native_names[header->native_names_size - 1] != 0) return false;
+	// The collector binary searches them
+	for (u32 m = 1; m < header->stack_map_count; m++) {
+		if (stack_maps[m].ip <= stack_maps[m - 1].ip) return false;
+	}
+	
+	*chunk = (IR_Chunk) {0};
+	chunk->code.elems = code;
+	chunk->code.len = header->code_count;
+	chunk->constants.elems = constants;
+	chunk->constants.len = header->constant_count;
+	chunk->functions.elems = functions;
+	chunk->functions.len = header->function_count;
+	chunk->natives.elems = natives;
+	chunk->natives.len = header->native_count;
+	chunk->stack_maps.elems = stack_maps;
+	chunk->stack_maps.len = header->stack_map_count;
+	chunk->native_names.elems = native_names;
+	chunk->native_names.len = header->native_names_size;
+	chunk->register_count = header->register_count;
+	chunk->loop_count = header->loop_count;
+	chunk->read_only = true;
+	VM_BindNatives(chunk);
+	// The file could come from anywhere. One that indexes out of a table or a frame never
+	// runs, one that is only unproven runs through the checked handlers
+	if (VM_VerifyChunk(chunk) == VerifyResult_Malformed) {
+		free(chunk->native_bindings);
+		return false;
+	}
+	if (chunk->loop_count) chunk->loops = calloc(chunk->loop_count, sizeof(VM_Loop));
+	return true;
+}
+
+//~ Constexpr evaluation
+
+#define ConstexprTombstone ((VM_Constexpr) { .value.type = RuntimeValueType_COUNT })
+#define ConstexprIsNull(v) ((v).ast == nullptr && (v).value.type != RuntimeValueType_COUNT)
+#define ConstexprIsTombstone(v) ((v).value.type == RuntimeValueType_COUNT)
+
+HashTable_Impl(u64, VM_Constexpr, U64KeyIsNull, U64KeyIsEqual, U64HashKey, ConstexprTombstone, ConstexprIsNull, ConstexprIsTombstone);
+
+static u64 VM_HashCombine(u64 hash, u64 value) {
+	for (u32 i = 0; i < sizeof(u64); i++) {
+		hash ^= (value >> (i * 8)) & 0xFF;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static u64 VM_HashConstantSubtree(IR_Ast* ast) {
+	u64 hash = VM_HashCombine(14695981039346656037ull, ast->type);
+	switch (ast->type) {
+		case AstType_IntLiteral: {
+			hash = VM_HashCombine(hash, (u32) ast->int_lit.value);
+		} break;
+		
+		case AstType_ExprUnary: {
+			hash = VM_HashCombine(hash, ast->unary.operator.type);
+			hash = VM_HashCombine(hash, VM_HashConstantSubtree(ast->unary.operand));
+		} break;
+		
+		case AstType_ExprBinary: {
+			hash = VM_HashCombine(hash, ast->binary.operator.type);
+			hash = VM_HashCombine(hash, VM_HashConstantSubtree(ast->binary.a));
+			hash = VM_HashCombine(hash, VM_HashConstantSubtree(ast->binary.b));
+		} break;
+		
+		default: {} break;
+	}
+	// 0 is the empty key of the hash table
+	return hash ? hash : 1;
+}
+
+// Compares exactly what VM_HashConstantSubtree hashes
+static b8 VM_ConstantSubtreesEqual(IR_Ast* a, IR_Ast* b) {
+	if (a->type != b->type) return false;
+	switch (a->type) {
+		case AstType_IntLiteral: {
+			return a->int_lit.value == b->int_lit.value;
+		} break;
+		
+		case AstType_ExprUnary: {
+			return a->unary.operator.type == b->unary.operator.type &&
+				VM_ConstantSubtreesEqual(a->unary.operand, b->unary.operand);
+		} break;
+		
+		case AstType_ExprBinary: {
+			return a->binary.operator.type == b->binary.operator.type &&
+				VM_ConstantSubtreesEqual(a->binary.a, b->binary.a) &&
+				VM_ConstantSubtreesEqual(a->binary.b, b->binary.b);
+		} break;
+		
+		default: {} break;
+	}
+	return true;
+}
+
+// Sets ast->constexpr_key to the subtree's entry if there is one, otherwise to the free key
+// it goes in at. Collisions are rare enough that probing key after key is fine
+static b8 VM_FindConstexpr(VM_ConstexprCache* cache, IR_Ast* ast, VM_Constexpr* entry) {
+	u64 key = VM_HashConstantSubtree(ast);
+	b8 found;
+	while ((found = hash_table_get(u64, VM_Constexpr, &cache->values, key, entry)) &&
+		   !VM_ConstantSubtreesEqual(entry->ast, ast)) {
+		key = key + 1 ? key + 1 : 1;
+	}
+	ast->constexpr_key = key;
+	return found;
+}
+
+void VM_ConstexprCacheInit(VM_ConstexprCache* cache) {
+	MemoryZeroStruct(cache, VM_ConstexprCache);
+	hash_table_init(u64, VM_Constexpr, &cache->values);
+	VM_ContextInit(&cache->context);
+}
+
+void VM_ConstexprCacheFree(VM_ConstexprCache* cache) {
+	hash_table_free(u64, VM_Constexpr, &cache->values);
+	VM_ContextFree(&cache->context);
+}
+
+void VM_EvalConstexprs(VM_ConstexprCache* cache, IR_Ast* ast) {
+	if (!ast) return;
+	
+	// Only the outermost constant node of a subtree is evaluated, failures are left to the emitter
+	if (ast->flags & AstFlag_Constant) {
+		VM_Constexpr entry;
+		if (VM_FindConstexpr(cache, ast, &entry)) {
+			cache->hits++;
+		} else {
+			IR_Chunk chunk;
+			entry.ast = ast;
+			entry.value = (VM_RuntimeValue) {0};
+			if (VM_LowerConstexpr(ast, &chunk) && VM_RunExprChunk(&cache->context, &chunk, &entry.value) != RunStatus_Done)
+				entry.value = (VM_RuntimeValue) {0};
+			IR_ChunkFree(&chunk);
+			
+			hash_table_set(u64, VM_Constexpr, &cache->values, ast->constexpr_key, entry);
+			cache->evaluated++;
+		}
+		if (entry.value.type != RuntimeValueType_Invalid) return;
+	}
+	
+	switch (ast->type) {
+		case AstType_ExprUnary: {
+			VM_EvalConstexprs(cache, ast->unary.operand);
+		} break;
+		
+		case AstType_ExprBinary: {
+			VM_EvalConstexprs(cache, ast->binary.a);
+			VM_EvalConstexprs(cache, ast->binary.b);
+		} break;
+		
+		case AstType_StmtPrint: {
+			VM_EvalConstexprs(cache, ast->print.value);
+		} break;
+		
+		case AstType_StmtVarDecl: {
+			VM_EvalConstexprs(cache, ast->var_decl.value);
+		} break;
+		
+		case AstType_StmtAssign: {
+			VM_EvalConstexprs(cache, ast->assign.value);
+		} break;
+		
+		case AstType_StmtBlock: {
+			for (u32 i = 0; i < ast->block.count; i++) {
+				VM_EvalConstexprs(cache, ast->block.statements[i]);
+			}
+		} break;
+		
+		case AstType_ExprFunc: {
+			VM_EvalConstexprs(cache, ast->func.body);
+		} break;
+		
+		case AstType_ExprCall: {
+			for (u32 i = 0; i < ast->call.arg_count; i++) {
+				VM_EvalConstexprs(cache, ast->call.args[i]);
+			}
+		} break;
+		
+		case AstType_StmtReturn: {
+			VM_EvalConstexprs(cache, ast->return_stmt.value);
+		} break;
+		
+		case AstType_StmtExpr: {
+			VM_EvalConstexprs(cache, ast->expr_stmt.expr);
+		} break;
+		
+		case AstType_StmtIf: {
+			VM_EvalConstexprs(cache, ast->if_stmt.condition);
+			VM_EvalConstexprs(cache, ast->if_stmt.then_body);
+			VM_EvalConstexprs(cache, ast->if_stmt.else_body);
+		} break;
+		
+		case AstType_StmtWhile: {
+			VM_EvalConstexprs(cache, ast->while_stmt.condition);
+			VM_EvalConstexprs(cache, ast->while_stmt.body);
+		} break;
+		
+		default: {} break;
+	}
+}
+
+b8 VM_GetConstexpr(VM_ConstexprCache* cache, IR_Ast* ast, VM_RuntimeValue* value) {
+	if (!(ast->flags & AstFlag_Constant) || ast->constexpr_key == 0) return false;
+	VM_Constexpr entry;
+	if (!hash_table_get(u64, VM_Constexpr, &cache->values, ast->constexpr_key, &entry)) return false;
+	*value = entry.value;
+	return value->type != RuntimeValueType_Invalid;
+}
\ No newline at end of file
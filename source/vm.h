@@ -3,61 +3,554 @@
 #ifndef VM_H
 #define VM_H
 
+#include <stdio.h>
 #include "ast_nodes.h"
 #include "base/ds.h"
+#include "base/mem.h"
+#include "base/utils.h"
+
+//~ Runtime values
+
+typedef u32 VM_RuntimeValueType;
+enum {
+	RuntimeValueType_Invalid,
+	RuntimeValueType_Integer,
+	RuntimeValueType_Object,
+	
+	RuntimeValueType_COUNT,
+};
+
+typedef struct VM_RuntimeValue {
+	VM_RuntimeValueType type;
+	
+	union {
+		i32 as_int;
+		u32 as_ref; // Into the heap of the context that allocated it, see VM_Heap
+	};
+} VM_RuntimeValue;
+
+//~ Output
+
+// Receives every value a chunk prints
+typedef void VM_OutputProc(void* user_data, VM_RuntimeValue value);
+
+#define VM_OUTPUT_BUFFER_SIZE Kilobytes(64)
+
+// Formats prints itself into a big buffer and hands it to the file with one fwrite
+// when it fills up or gets flushed, so stdio locking and printf parsing are paid per buffer
+typedef struct VM_OutputBuffer {
+	FILE* file;
+	u8* data;
+	u64 len;
+} VM_OutputBuffer;
+
+void VM_OutputBufferInit(VM_OutputBuffer* buffer, FILE* file);
+// Flushes whatever is left
+void VM_OutputBufferFree(VM_OutputBuffer* buffer);
+void VM_OutputBufferFlush(VM_OutputBuffer* buffer);
+// A VM_OutputProc, user_data is the VM_OutputBuffer
+void VM_OutputBufferWrite(void* user_data, VM_RuntimeValue value);
+
+//~ Call stacks
+
+// Where a call returns to, pushed by Opcode_Call and popped by Opcode_Return
+typedef struct VM_CallFrame {
+	u32 return_ip;
+	u32 caller_base;
+} VM_CallFrame;
+
+// Register windows of all active calls, back to back. A callee's window starts at its first argument,
+// its R[0] is where the caller finds the result
+typedef struct VM_Stack {
+	struct IR_Chunk* chunk; // Whose frames these are, for the collector
+	VM_RuntimeValue* values;
+	u32 cap;
+	u32 base; // Window of the running function
+	
+	VM_CallFrame* frames;
+	u32 frame_count;
+	u32 frame_cap;
+} VM_Stack;
+
+// 128MB of registers, a call that would need more stops the run
+#define VM_MAX_STACK_VALUES (1u << 24)
+
+//~ Heap
+
+typedef u32 VM_ObjectKind;
+enum {
+	ObjectKind_Forwarded, // Copied by a collection, size holds the new reference
+	ObjectKind_Values,    // size / sizeof(VM_RuntimeValue) values, traced by the collector
+	ObjectKind_Bytes,     // size raw bytes, never traced
+};
+
+// In front of every object, the payload follows 8-byte aligned
+typedef struct VM_Object {
+	VM_ObjectKind kind;
+	u32 size;
+} VM_Object;
+
+#define VM_HeapObject(heap, ref) ((VM_Object*)((heap)->base + (ref)))
+#define VM_ObjectValues(object) ((VM_RuntimeValue*)((object) + 1))
+#define VM_ObjectBytes(object) ((u8*)((object) + 1))
+
+// Caller registers still read after a call returns, keyed by its return ip
+typedef struct VM_StackMap {
+	u32 ip;
+	u32 live[8]; // Bit r is register r
+} VM_StackMap;
+
+// One reserved range per heap: [old space 0][nursery][old space 1]. References are offsets into it, 0 is null
+#define VM_NURSERY_SIZE Megabytes(2)
+#define VM_OLD_SPACE_SIZE (Gigabytes(2ull) - VM_NURSERY_SIZE)
+#define VM_HEAP_RESERVE (2 * VM_OLD_SPACE_SIZE + VM_NURSERY_SIZE)
+#define VM_HEAP_COMMIT_SIZE Megabytes(1)
+// Bigger objects are allocated old
+#define VM_MAX_NURSERY_OBJECT Kilobytes(64)
+// Old generation size of the first major collection, after that twice what survived
+#define VM_MIN_MAJOR_THRESHOLD Megabytes(64)
+
+typedef VM_RuntimeValue* VM_RootSlot;
+typedef VM_Stack* VM_StackRef;
+
+DArray_Prototype(u32);
+DArray_Prototype(VM_RootSlot);
+DArray_Prototype(VM_StackRef);
+
+typedef struct VM_HeapStats {
+	u64 minor_collections;
+	u64 major_collections;
+	u64 promoted_bytes;
+	u64 max_minor_pause_ns;
+	u64 max_major_pause_ns;
+	u64 total_pause_ns;
+} VM_HeapStats;
+
+// Generational and copying, owned by one context. A minor collection copies the nursery survivors into
+// the current old space, a major one copies the nursery and that old space into the other one
+typedef struct VM_Heap {
+	u8* base; // Reserved on the first allocation
+	u32 nursery_cursor;
+	// Shrinks once the old space can't take a full nursery anymore
+	u32 nursery_limit;
+	
+	u32 old_space; // 0 or 1
+	u32 old_cursor;
+	u32 old_committed[2]; // End of the committed part of each old space
+	u64 major_threshold;
+	
+	// Old slots holding nursery references, slots rather than objects so big arrays stay cheap
+	darray(u32) remembered;
+	// References held outside the stacks, pushed and popped like a stack
+	darray(VM_RootSlot) roots;
+	// Stacks whose registers are roots: the context's own and every continuation it has resumed
+	darray(VM_StackRef) stacks;
+	
+	VM_HeapStats stats;
+} VM_Heap;
+
+// A zeroed object, 0 when the heap is full. Any allocation can move every object, so references
+// held in C variables have to sit in a root slot across it
+u32 VM_HeapAlloc(VM_Heap* heap, VM_ObjectKind kind, u32 size);
+// The write barrier, every store into an ObjectKind_Values object goes through it
+void VM_HeapStore(VM_Heap* heap, u32 ref, u32 index, VM_RuntimeValue value);
+void VM_HeapPushRoot(VM_Heap* heap, VM_RuntimeValue* slot);
+void VM_HeapPopRoot(VM_Heap* heap);
+void VM_HeapCollect(VM_Heap* heap, b8 major);
+// The map of the call returning to ip, null if it has none
+VM_StackMap* VM_FindStackMap(struct IR_Chunk* chunk, u32 ip);
+
+//~ Execution contexts
+
+// Everything a run touches apart from the chunk, which is only ever read.
+// One context per thread and any number of threads can run chunks at once
+typedef struct VM_Context {
+	// Grown to the deepest call chain run on this context
+	VM_Stack stack;
+	
+	VM_OutputProc* output;
+	void* output_data;
+	// Where output goes by default, the context must not move once initialized
+	VM_OutputBuffer stdout_buffer;
+	
+	// Temporary memory for a single run, reset to where it was once the run is done
+	M_Arena* scratch;
+	
+	// Why the last run on this context stopped with RunStatus_Error
+	char error[256];
+	
+	VM_Heap heap;
+} VM_Context;
+
+// Output goes to stdout_buffer until output is replaced. Flush before anything else
+// writes to stdout, VM_ContextFree flushes too
+void VM_ContextInit(VM_Context* ctx);
+void VM_ContextFree(VM_Context* ctx);
+void VM_ContextFlush(VM_Context* ctx);
+void VM_ContextPrint(VM_Context* ctx, VM_RuntimeValue value);
 
 //~ Chunk Helpers
 
+typedef u32 VM_RunStatus;
+enum {
+	RunStatus_Suspended, // Out of fuel (or not started), VM_Resume picks up where it stopped
+	RunStatus_Done,
+	RunStatus_Error,     // Stopped for good, ctx->error says why
+};
+
+// Native code for a whole chunk, returns and writes what VM_RunExprChunk would have
+typedef VM_RunStatus VM_NativeChunk(VM_Context* ctx, VM_RuntimeValue* result);
+
+typedef u32 VM_TierState;
+enum {
+	TierState_Interpreted,
+	TierState_Compiling,
+	TierState_Native,
+	TierState_Failed, // Has something the JIT does not handle, stays interpreted
+};
+
+// Addressed by index from Opcode_Call, there are no names at runtime
+typedef struct VM_Function {
+	u32 entry; // Offset into the chunk's code
+	u32 register_count;
+	u32 param_count;
+} VM_Function;
+
+// A #native function, addressed by index from Opcode_CallNative. Parameters and result are
+// C ints, the name is only looked up when the chunk gets bound
+typedef struct VM_Native {
+	u32 name_offset; // Into the chunk's native_names, nul terminated
+	u32 param_count;
+	u32 has_result; // 0 for natives that return nothing
+} VM_Native;
+
+// Calls the C function at address with args[0].as_int, args[1].as_int.. One prebuilt stub
+// per arity and result kind, so a call does no marshalling beyond loading the arguments
+typedef i32 VM_NativeStub(void* address, VM_RuntimeValue* args);
+
+typedef struct VM_NativeBinding {
+	VM_NativeStub* stub;
+	void* address; // Null if the symbol wasn't found, calling it stops the run
+} VM_NativeBinding;
+
+// Native code for one loop, entered at its header. Writes back what it touched, returns where to carry on
+typedef u32 VM_NativeTrace(VM_Context* ctx, VM_RuntimeValue* registers);
+
+// Tiering state of one while loop, addressed by the Ax operand of its Opcode_Loop.
+// back_edges is bumped without atomics like run_count, native is published like the chunk's
+typedef struct VM_Loop {
+	u32 back_edges;
+	VM_TierState tier_state;
+	VM_NativeTrace* native;
+} VM_Loop;
+
 DArray_Prototype(u8);
+DArray_Prototype(VM_RuntimeValue);
+DArray_Prototype(VM_Function);
+DArray_Prototype(VM_Native);
+DArray_Prototype(VM_StackMap);
 
-#if 0
-typedef struct IR_Chunk IR_Chunk;
-#endif
-typedef darray(u8) IR_Chunk;
+typedef struct IR_Chunk {
+	// The top level code starts at 0, function bodies follow it
+	darray(u32) code;
+	// Deduplicated, addressed by Opcode_LoadConst(Wide)
+	darray(VM_RuntimeValue) constants;
+	darray(VM_Function) functions;
+	darray(VM_Native) natives;
+	// Sorted by ip, empty without the peephole optimizer
+	darray(VM_StackMap) stack_maps;
+	// Names of the natives back to back, padded to a multiple of 4 bytes
+	darray(u8) native_names;
+	// One per native, resolved once when the chunk is lowered or loaded
+	VM_NativeBinding* native_bindings;
+	// One per while loop, allocated when the chunk is lowered or loaded
+	VM_Loop* loops;
+	u32 loop_count;
+	// Most registers live at once in the top level code, computed while lowering.
+	// VM_RunExprChunk sizes its frame with it and never grows or checks it
+	u32 register_count;
+	
+	// Tiering. run_count is bumped without atomics, an undercount only delays promotion.
+	// native is published after the background compile finished and read with acquire
+	u32 run_count;
+	VM_TierState tier_state;
+	VM_NativeChunk* native;
+	
+	// Code lives in read-only memory (a mapped .rbc file), the interpreter doesn't quicken it
+	b8 read_only;
+	
+	// Set by VM_VerifyChunk. Runs of a verified chunk reserve max_stack registers and
+	// max_frames call frames up front, that is as deep as its calls can ever go
+	b8 verified;
+	u32 max_stack;
+	u32 max_frames;
+} IR_Chunk;
 
 IR_Chunk IR_ChunkAlloc(void);
-void IR_ChunkPushOp(IR_Chunk* chunk, u8 byte);
+void IR_ChunkPushInstruction(IR_Chunk* chunk, u8 op, u8 a, u8 b, u8 c);
 void IR_ChunkPushU32(IR_Chunk* chunk, u32 value);
-void IR_ChunkPush(IR_Chunk* chunk, u8* bytes, u32 count);
 void IR_ChunkFree(IR_Chunk* chunk);
 
-//~ Opcodes and runtime values
+// Natives are looked up in the executable (and whatever it links against) first, then in
+// these libraries in the order they were added. Add them before lowering or loading chunks
+#define VM_MAX_NATIVE_LIBRARIES 16
+b8 VM_AddNativeLibrary(const char* path);
+
+//~ Opcodes
 
+// Every instruction is one 32-bit word, opcode | A << 8 | B << 16 | C << 24, A the destination.
+// Some opcodes carry one extra operand word, noted next to them
 typedef u32 VM_Opcode;
 enum {
 	Opcode_Nop,
-	Opcode_Push,
-	Opcode_Pop,
-	Opcode_UnaryOp,
-	Opcode_BinaryOp,
-	Opcode_Print,
+	Opcode_LoadConst,     // R[A] = K[Bx]
+	Opcode_LoadConstWide, // R[A] = K[index]         + u32 index
+	Opcode_LoadSmallInt,  // R[A] = sBx
+	Opcode_LoadInput,     // R[A] = input column Bx of the current row, 0 outside VM_RunChunkBatch
+	Opcode_Move,     // R[A] = R[B]
+	Opcode_UnaryOp,  // R[A] = op R[B]          + u32 L_TokenType
+	Opcode_BinaryOp, // R[A] = R[B] op R[C]     + u32 VM_QuickenOperand
+	Opcode_Print,    // print R[A]
+	Opcode_Return,   // return R[A], or stop with result R[A] at the top level
+	Opcode_Halt,     // stop, no result
+	// Everything from R[A] up is clobbered. TailCall reuses the frame and never returns here
+	Opcode_Call,     // R[A] = F[Bx](R[A], R[A+1]..)
+	Opcode_TailCall, // return F[Bx](R[A], R[A+1]..)
+	// Runs on the native stack and leaves the registers past the arguments alone
+	Opcode_CallNative, // R[A] = N[Bx](R[A], R[A+1]..)
+	// Targets are absolute offsets into the chunk's code. Loop is the back edge of a while
+	// loop and the only jump that goes backwards, Ax is its index into chunk->loops
+	Opcode_Jump,        // goto target               + u32 target
+	Opcode_JumpIfFalse, // if R[A] == 0 goto target  + u32 target
+	Opcode_Loop,        // goto target               + u32 target
+	
+	// Emitted when the checker proved the operand types,
+	// these do no runtime type checks
+	Opcode_AddI32,   // R[A] = R[B] + R[C]
+	Opcode_SubI32,
+	Opcode_MulI32,
+	Opcode_DivI32,
+	Opcode_ModI32,
+	Opcode_NegI32,   // R[A] = -R[B]
+	// 1 or 0, > and >= are lowered with the operands swapped
+	Opcode_LtI32,    // R[A] = R[B] < R[C]
+	Opcode_LeI32,
+	Opcode_EqI32,
+	Opcode_NeI32,
+	
+	// Superinstructions, only ever produced by the peephole pass.
+	// Picked from opcode pair counts over our test programs
+	Opcode_AddI32K,     // R[A] = R[B] + (i8) C
+	Opcode_MulAddI32,   // R[A] = R[x] + R[B] * R[C]  + u32 register x
+	Opcode_AddPrintI32, // R[A] = R[B] + R[C]; print R[A]
+	
+	// Quickened Opcode_BinaryOp, written by the interpreter and turned back when an operand isn't an int
+	Opcode_AddI32Quick, // R[A] = R[B] + R[C]      + u32 VM_QuickenOperand
+	Opcode_SubI32Quick,
+	Opcode_MulI32Quick,
+	Opcode_DivI32Quick,
+	Opcode_ModI32Quick,
 	
 	Opcode_COUNT
 };
 
-typedef u32 VM_RuntimeValueType;
+#define VM_MAX_REGISTERS 256
+
+#define VM_Encode(op, a, b, c) ((u32)(op) | ((u32)(a) << 8) | ((u32)(b) << 16) | ((u32)(c) << 24))
+#define VM_DecodeOp(w) ((w) & 0xFF)
+#define VM_DecodeA(w)  (((w) >> 8) & 0xFF)
+#define VM_DecodeB(w)  (((w) >> 16) & 0xFF)
+#define VM_DecodeC(w)  ((w) >> 24)
+// B and C read together as one 16-bit operand, unsigned or sign extended
+#define VM_DecodeBx(w)  ((w) >> 16)
+#define VM_DecodeSBx(w) ((i32)(i16)((w) >> 16))
+// A, B and C read together as one 24-bit operand
+#define VM_DecodeAx(w)  ((w) >> 8)
+
+// Operand word of a (quickened) BinaryOp. The operator's L_TokenType, with the number of
+// times the instruction got de-quickened on top. Past VM_MAX_DEQUICKENS it stays generic
+#define VM_QuickenOperand(token, dequickens) ((u32)(token) | ((u32)(dequickens) << 24))
+#define VM_QuickenToken(w)      ((L_TokenType)((w) & 0xFFFFFF))
+#define VM_QuickenDequickens(w) ((w) >> 24)
+#define VM_MAX_DEQUICKENS 4
+
+//~ VM Helpers
+
+// Direct threaded dispatch through computed gotos where the compiler has them,
+// define VM_NO_COMPUTED_GOTO to force the portable switch loop
+#if (defined(COMPILER_GCC) || defined(COMPILER_CLANG)) && !defined(VM_NO_COMPUTED_GOTO)
+#  define VM_COMPUTED_GOTO
+#endif
+
+// Runs after which a chunk gets compiled by the JIT in the background, 0 turns tiering off
+#define VM_DEFAULT_TIER_UP_THRESHOLD 1000
+void VM_SetTierUpThreshold(u32 runs);
+
+// Why a division by divisor had no result (0, or -1 under i32_min). Interpreted, batched
+// and native code all stop with it
+const char* VM_DivisionError(i32 divisor);
+
+// Ends the top level code with Opcode_Halt. False if code needs more than VM_MAX_REGISTERS, the chunk
+// is empty then but safe to free
+b8 VM_LowerProgram(IR_Ast* ast, IR_Chunk* chunk);
+// Terminates the chunk with Opcode_Return of the expression's register.
+// Returns false without reporting anything if it ran out of registers
+b8 VM_LowerConstexpr(IR_Ast* ast, IR_Chunk* chunk);
+
+// RunStatus_Done with the chunk's result, or RunStatus_Error with ctx->error saying why
+VM_RunStatus VM_RunExprChunk(VM_Context* ctx, IR_Chunk* chunk, VM_RuntimeValue* result);
+void VM_Print(VM_RuntimeValue value);
+
+//~ Tracing
+
+// Back edges after which a loop's next iteration gets recorded and compiled in the
+// background, 0 turns tracing off. Only runs that can't suspend trace, VM_Resume never does
+#define VM_DEFAULT_HOT_LOOP_THRESHOLD 1000
+void VM_SetHotLoopThreshold(u32 back_edges);
+
+// Longer iterations aren't worth the compile, the loop stays interpreted
+#define VM_MAX_TRACE_STEPS 512
+
+// The instructions one iteration ran, from the loop header up to (not including) its
+// Opcode_Loop. next is where each of them went, so branches record the side they took
+typedef struct VM_TraceStep {
+	u32 ip;
+	u32 next;
+} VM_TraceStep;
+
+typedef struct VM_Trace {
+	u32 header;
+	u32 step_count;
+	VM_TraceStep steps[VM_MAX_TRACE_STEPS];
+} VM_Trace;
+
+//~ Resumable execution
+
+// A chunk run that can stop after any instruction, always interpreted. Suspending just stores ip.
+// The first context to resume it roots its registers in that context's heap until VM_ContinuationFree,
+// so only that context can resume it afterwards, and neither may move
+typedef struct VM_Continuation {
+	IR_Chunk* chunk;
+	u32 ip;
+	VM_Stack stack;
+	VM_RunStatus status;
+	VM_RuntimeValue result; // Valid once status is RunStatus_Done
+	VM_Heap* heap; // Rooted in, null until the first resume
+} VM_Continuation;
+
+void VM_ContinuationInit(VM_Continuation* cont, IR_Chunk* chunk);
+// Before the context it ran on is freed
+void VM_ContinuationFree(VM_Continuation* cont);
+// Runs at most fuel more instructions. A continuation that is done or failed stays that way
+VM_RunStatus VM_Resume(VM_Context* ctx, VM_Continuation* cont, u64 fuel);
+
+//~ Batch evaluation
+
+// Rows go through the chunk this many at a time, every register holds one column block
+#define VM_BATCH_SIZE 1024
+
+// Per-row formulas: top-level `x : int;` declarations are the inputs, the last declaration the result
+b8 VM_LowerBatchProgram(IR_Ast* ast, IR_Chunk* chunk, u32* input_count);
+// output[r] = chunk(inputs[0][r], inputs[1][r], ...). False for chunks that can't run column-wise,
+// or when a row's division traps, with ctx->error naming the row
+b8 VM_RunChunkBatch(VM_Context* ctx, IR_Chunk* chunk, const i32* const* inputs, u32 input_count, i32* output, u64 row_count);
+
+//~ Profiling
+
+const char* VM_OpcodeName(VM_Opcode op);
+
+// Only compiled in with VM_PROFILE defined (cmake -DRIFT_VM_PROFILE=ON),
+// the regular interpreter carries no counters. JIT-compiled chunks aren't seen
+#ifdef VM_PROFILE
+// One in this many dispatches gets timed, until the next dispatch
+#define VM_PROFILE_SAMPLE_PERIOD 64
+
+typedef struct VM_Profile {
+	u64 counts[Opcode_COUNT];
+	u64 pairs[Opcode_COUNT][Opcode_COUNT]; // [first][second]
+	u64 samples[Opcode_COUNT];
+	u64 sampled_cycles[Opcode_COUNT];
+} VM_Profile;
+
+// Process wide and unsynchronized, profile one interpreter thread at a time
+extern VM_Profile vm_profile;
+
+void VM_ProfileReset(void);
+void VM_ProfilePrint(FILE* out);
+void VM_ProfilePrintJson(FILE* out);
+#endif
+
+//~ Verification
+
+typedef u32 VM_VerifyResult;
 enum {
-	RuntimeValueType_Invalid,
-	RuntimeValueType_Integer,
-	
-	RuntimeValueType_COUNT,
+	VerifyResult_Verified,  // Runs through the handlers without checks
+	VerifyResult_Unproven,  // Well formed, runs through the checked handlers
+	VerifyResult_Malformed, // Must not run at all
 };
 
-typedef struct VM_RuntimeValue {
-	VM_RuntimeValueType type;
-	
-	union {
-		i32 as_int;
-	};
-} VM_RuntimeValue;
+// Proves every operand, jump and call stays in bounds. A chunk is verified once int ops only ever read
+// ints, natives are bound and only tail calls recurse. Chunks that fail the first part never load
+VM_VerifyResult VM_VerifyChunk(IR_Chunk* chunk);
 
-//~ VM Helpers
+//~ Bytecode files
+
+// .rbc layout, every section 4-byte aligned (constants 8) so a mapped file runs in place:
+//     VM_ChunkFileHeader
+//     VM_RuntimeValue constants[constant_count]
+//     VM_Function     functions[function_count]
+//     VM_Native       natives[native_count]
+//     VM_StackMap     stack_maps[stack_map_count]
+//     u32             code[code_count]
+//     u8              native_names[native_names_size]
+// Host byte order, a swapped magic means a foreign file
+#define VM_CHUNK_FILE_MAGIC 0x43425252 // "RRBC"
+// Bump whenever the opcode set or the instruction encoding changes
+#define VM_CHUNK_FILE_VERSION 7
+
+typedef struct VM_ChunkFileHeader {
+	u32 magic;
+	u32 version;
+	u32 register_count;
+	u32 constant_count;
+	u32 function_count;
+	u32 native_count;
+	u32 code_count;
+	u32 native_names_size;
+	u32 checksum; // Over every section in file order, see VM_ChunkChecksum
+	u32 loop_count; // Their state is runtime only, it gets allocated on load
+	u32 stack_map_count;
+	u32 reserved; // Keeps the constants 8-byte aligned
+} VM_ChunkFileHeader;
+
+b8 VM_WriteChunkFile(IR_Chunk* chunk, const char* path);
+// The chunk points into the mapping, IR_ChunkFree only frees its native bindings.
+// Free it before unmapping the file
+b8 VM_LoadChunkFile(U_MappedFile* file, IR_Chunk* chunk);
+
+//~ Constexpr evaluation
+
+// ast is the first subtree that evaluated to value. A subtree whose run stopped with an
+// error (a division by 0) has an Invalid value, it doesn't fold and gets emitted as is
+typedef struct VM_Constexpr {
+	IR_Ast* ast;
+	VM_RuntimeValue value;
+} VM_Constexpr;
+
+HashTable_Prototype(u64, VM_Constexpr);
 
-Stack_Prototype(VM_RuntimeValue);
+// Keyed by the structural hash of the subtree, identical constant subtrees run through the VM once
+typedef struct VM_ConstexprCache {
+	hash_table(u64, VM_Constexpr) values;
+	VM_Context context;
+	u32 evaluated;
+	u32 hits;
+} VM_ConstexprCache;
 
-void VM_Lower(IR_Chunk* chunk, IR_Ast* ast);
-IR_Chunk VM_LowerConstexpr(IR_Ast* ast);
+void VM_ConstexprCacheInit(VM_ConstexprCache* cache);
+void VM_ConstexprCacheFree(VM_ConstexprCache* cache);
 
-VM_RuntimeValue VM_RunExprChunk(IR_Chunk* chunk);
+void VM_EvalConstexprs(VM_ConstexprCache* cache, IR_Ast* ast);
+b8 VM_GetConstexpr(VM_ConstexprCache* cache, IR_Ast* ast, VM_RuntimeValue* value);
 
 #endif //VM_H